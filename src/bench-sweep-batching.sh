@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# Runs kaldinnet2onlinedecoder-bench over a grid of nnet3-batch-size and
+# nnet3-batch-max-wait-ms, after a run without batching, and prints the
+# throughput and latency of each setting, e.g.:
+#
+#   GST_PLUGIN_PATH=. ./bench-sweep-batching.sh --num-streams=16 --realtime \
+#     wavs.txt nnet-mode=3 model=final.mdl fst=HCLG.fst word-syms=words.txt \
+#     mfcc-config=conf/mfcc.conf ivector-extraction-config=conf/ivector_extractor.conf \
+#     do-endpointing=true
+#
+# The arguments are those of the benchmark, without the batching
+# properties. BATCH_SIZES and MAX_WAITS_MS override the values swept, and
+# the JSON of each run is kept in OUTPUT_DIR (default: sweep-batching).
+
+BENCH=${BENCH:-$(dirname "$0")/kaldinnet2onlinedecoder-bench}
+BATCH_SIZES=${BATCH_SIZES:-"4 8 16 32"}
+MAX_WAITS_MS=${MAX_WAITS_MS:-"2 5 10 20"}
+OUTPUT_DIR=${OUTPUT_DIR:-sweep-batching}
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 [BENCH-OPTIONS] WAV-LIST [PROPERTY=VALUE ...]" >&2
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR" || exit 1
+
+runs="$OUTPUT_DIR/batch-0.json"
+"$BENCH" --output="$runs" --label=batch-0 "$@" nnet3-batch-size=0 || exit 1
+for size in $BATCH_SIZES; do
+  for wait in $MAX_WAITS_MS; do
+    out="$OUTPUT_DIR/batch-$size-wait-$wait.json"
+    "$BENCH" --output="$out" --label="batch-$size-wait-$wait" "$@" \
+      nnet3-batch-size=$size nnet3-batch-max-wait-ms=$wait || exit 1
+    runs="$runs $out"
+  done
+done
+
+python3 - $runs <<'PYTHON'
+import json
+import sys
+
+print("%-20s %8s %8s %10s %10s %10s %10s" % (
+    "run", "rtf", "cpu-rtf", "final-p50", "final-p95", "nnet-p50", "nnet-p95"))
+for filename in sys.argv[1:]:
+    with open(filename) as f:
+        run = json.load(f)
+    nnet = run["segment-stats"].get("nnet-time", {"p50": 0, "p95": 0})
+    print("%-20s %8.3f %8.3f %10.3f %10.3f %10.3f %10.3f" % (
+        run["label"], run["real-time-factor"], run["cpu-real-time-factor"],
+        run["final-latency"]["p50"], run["final-latency"]["p95"],
+        nnet["p50"], nnet["p95"]))
+PYTHON
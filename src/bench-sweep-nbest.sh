@@ -0,0 +1,47 @@
+#!/bin/bash
+#
+# Runs kaldinnet2onlinedecoder-bench with a range of num-nbest values and
+# prints what producing the n-best lists costs, from the nbest-time of the
+# kaldi-segment-stats messages, and its effect on the final latency, e.g.:
+#
+#   GST_PLUGIN_PATH=. ./bench-sweep-nbest.sh wavs.txt nnet-mode=3 \
+#     model=final.mdl fst=HCLG.fst word-syms=words.txt \
+#     mfcc-config=conf/mfcc.conf ivector-extraction-config=conf/ivector_extractor.conf \
+#     do-endpointing=true do-phone-alignment=true
+#
+# The arguments are those of the benchmark, without num-nbest. NUM_NBEST
+# overrides the values swept, and the JSON of each run is kept in
+# OUTPUT_DIR (default: sweep-nbest).
+
+BENCH=${BENCH:-$(dirname "$0")/kaldinnet2onlinedecoder-bench}
+NUM_NBEST=${NUM_NBEST:-"1 2 5 10 20"}
+OUTPUT_DIR=${OUTPUT_DIR:-sweep-nbest}
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 [BENCH-OPTIONS] WAV-LIST [PROPERTY=VALUE ...]" >&2
+  exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR" || exit 1
+
+runs=""
+for n in $NUM_NBEST; do
+  out="$OUTPUT_DIR/nbest-$n.json"
+  "$BENCH" --output="$out" --label="num-nbest=$n" "$@" num-nbest=$n || exit 1
+  runs="$runs $out"
+done
+
+python3 - $runs <<'PYTHON'
+import json
+import sys
+
+print("%-14s %10s %10s %10s %10s %10s" % (
+    "run", "nbest-p50", "nbest-p95", "nbest-p99", "final-p50", "final-p95"))
+for filename in sys.argv[1:]:
+    with open(filename) as f:
+        run = json.load(f)
+    nbest = run["segment-stats"]["nbest-time"]
+    print("%-14s %10.4f %10.4f %10.4f %10.3f %10.3f" % (
+        run["label"], nbest["p50"], nbest["p95"], nbest["p99"],
+        run["final-latency"]["p50"], run["final-latency"]["p95"]))
+PYTHON
@@ -0,0 +1,226 @@
+// const-arpa-lm-cache.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits>
+
+#include "./const-arpa-lm-cache.h"
+
+namespace kaldi {
+
+GMutex ConstArpaLmCache::caches_lock_;
+std::map<const ConstArpaLm*, ConstArpaLmCache*> ConstArpaLmCache::caches_;
+
+ConstArpaLmCache *ConstArpaLmCache::Acquire(const ConstArpaLm *lm,
+                                            size_t max_bytes) {
+  KALDI_ASSERT(lm != NULL);
+  ConstArpaLmCache *cache;
+  g_mutex_lock(&caches_lock_);
+  std::map<const ConstArpaLm*, ConstArpaLmCache*>::iterator it = caches_.find(lm);
+  if (it != caches_.end()) {
+    cache = it->second;
+    cache->ref_count_++;
+  } else {
+    cache = new ConstArpaLmCache(lm, max_bytes);
+    caches_[lm] = cache;
+  }
+  g_mutex_unlock(&caches_lock_);
+  return cache;
+}
+
+void ConstArpaLmCache::Ref(ConstArpaLmCache *cache) {
+  if (cache == NULL)
+    return;
+  g_mutex_lock(&caches_lock_);
+  cache->ref_count_++;
+  g_mutex_unlock(&caches_lock_);
+}
+
+void ConstArpaLmCache::Release(ConstArpaLmCache *cache) {
+  if (cache == NULL)
+    return;
+  g_mutex_lock(&caches_lock_);
+  bool unused = (--(cache->ref_count_) == 0);
+  if (unused) {
+    caches_.erase(&(cache->lm_));
+  }
+  g_mutex_unlock(&caches_lock_);
+  if (unused) {
+    delete cache;
+  }
+}
+
+ConstArpaLmCache::ConstArpaLmCache(const ConstArpaLm *lm, size_t max_bytes)
+    : lm_(*lm), max_bytes_per_shard_(max_bytes / kNumShards), ref_count_(1) {
+  for (int32 i = 0; i < kNumShards; i++) {
+    g_mutex_init(&shards_[i].lock);
+    shards_[i].num_bytes = 0;
+    shards_[i].hits = 0;
+    shards_[i].misses = 0;
+  }
+}
+
+ConstArpaLmCache::~ConstArpaLmCache() {
+  guint64 hits, misses;
+  size_t num_bytes;
+  GetStats(&hits, &misses, &num_bytes);
+  KALDI_VLOG(1) << "Big LM cache: " << hits << " hits, " << misses
+                << " misses, " << num_bytes << " bytes";
+  for (int32 i = 0; i < kNumShards; i++) {
+    g_mutex_clear(&shards_[i].lock);
+  }
+}
+
+size_t ConstArpaLmCache::EntryBytes(const Entry &entry) {
+  // The key is stored twice, in the entry and in the index; the constant
+  // is a rough guess of the list node and hash table overhead
+  return sizeof(Entry) + sizeof(std::vector<int32>) + 64
+      + (2 * entry.key.size() + entry.next_history.size()) * sizeof(int32);
+}
+
+BaseFloat ConstArpaLmCache::GetNgram(const std::vector<int32> &history,
+                                     int32 word,
+                                     std::vector<int32> *next_history) {
+  std::vector<int32> key(history);
+  key.push_back(word);
+  Shard &shard = shards_[VectorHasher<int32>()(key) % kNumShards];
+
+  g_mutex_lock(&shard.lock);
+  std::unordered_map<std::vector<int32>, EntryList::iterator,
+                     VectorHasher<int32> >::iterator it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    shard.hits++;
+    // Move to the front
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    BaseFloat logprob = it->second->logprob;
+    if (next_history != NULL)
+      *next_history = it->second->next_history;
+    g_mutex_unlock(&shard.lock);
+    return logprob;
+  }
+  shard.misses++;
+  g_mutex_unlock(&shard.lock);
+
+  // Look it up in the LM without holding the lock, like
+  // ConstArpaLmDeterministicFst::GetArc() does
+  Entry entry;
+  entry.logprob = lm_.GetNgramLogprob(word, history);
+  if (entry.logprob != -std::numeric_limits<BaseFloat>::infinity()) {
+    std::vector<int32> &wseq = entry.next_history;
+    wseq = history;
+    wseq.push_back(word);
+    while (wseq.size() >= lm_.NgramOrder()) {
+      // History state has at most lm_.NgramOrder() -1 words in the state.
+      wseq.erase(wseq.begin(), wseq.begin() + 1);
+    }
+    while (!lm_.HistoryStateExists(wseq)) {
+      KALDI_ASSERT(wseq.size() > 0);
+      wseq.erase(wseq.begin(), wseq.begin() + 1);
+    }
+  }
+  if (next_history != NULL)
+    *next_history = entry.next_history;
+  BaseFloat logprob = entry.logprob;
+
+  entry.key.swap(key);
+  size_t entry_bytes = EntryBytes(entry);
+  g_mutex_lock(&shard.lock);
+  if (entry_bytes <= max_bytes_per_shard_
+      && shard.index.find(entry.key) == shard.index.end()) {
+    shard.entries.push_front(Entry());
+    shard.entries.front().key = entry.key;
+    shard.entries.front().logprob = entry.logprob;
+    shard.entries.front().next_history.swap(entry.next_history);
+    shard.index[entry.key] = shard.entries.begin();
+    shard.num_bytes += entry_bytes;
+    while (shard.num_bytes > max_bytes_per_shard_) {
+      const Entry &oldest = shard.entries.back();
+      shard.num_bytes -= EntryBytes(oldest);
+      shard.index.erase(oldest.key);
+      shard.entries.pop_back();
+    }
+  }
+  g_mutex_unlock(&shard.lock);
+  return logprob;
+}
+
+void ConstArpaLmCache::GetStats(guint64 *hits, guint64 *misses,
+                                size_t *num_bytes) const {
+  *hits = 0;
+  *misses = 0;
+  *num_bytes = 0;
+  for (int32 i = 0; i < kNumShards; i++) {
+    Shard &shard = const_cast<Shard&>(shards_[i]);
+    g_mutex_lock(&shard.lock);
+    *hits += shard.hits;
+    *misses += shard.misses;
+    *num_bytes += shard.num_bytes;
+    g_mutex_unlock(&shard.lock);
+  }
+}
+
+
+CachedConstArpaLmDeterministicFst::CachedConstArpaLmDeterministicFst(
+    ConstArpaLmCache *cache)
+    : cache_(cache) {
+  // Creates a history state for <s>.
+  std::vector<Label> bos_state(1, cache_->Lm().BosSymbol());
+  state_to_wseq_.push_back(bos_state);
+  wseq_to_state_[bos_state] = 0;
+}
+
+fst::StdArc::Weight CachedConstArpaLmDeterministicFst::Final(StateId s) {
+  // At this point, we should have created the state.
+  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
+  BaseFloat logprob = cache_->GetNgram(state_to_wseq_[s],
+                                       cache_->Lm().EosSymbol(), NULL);
+  return Weight(-logprob);
+}
+
+bool CachedConstArpaLmDeterministicFst::GetArc(StateId s, Label ilabel,
+                                               fst::StdArc *oarc) {
+  // At this point, we should have created the state.
+  KALDI_ASSERT(static_cast<size_t>(s) < state_to_wseq_.size());
+  std::vector<Label> wseq;
+  BaseFloat logprob = cache_->GetNgram(state_to_wseq_[s], ilabel, &wseq);
+  if (logprob == -std::numeric_limits<BaseFloat>::infinity()) {
+    return false;
+  }
+
+  std::pair<const std::vector<Label>, StateId> wseq_state_pair(
+      wseq, static_cast<Label>(state_to_wseq_.size()));
+
+  // Attemps to insert the current <wseq_state_pair>. If the pair already exists
+  // then it returns false.
+  typedef MapType::iterator IterType;
+  std::pair<IterType, bool> result = wseq_to_state_.insert(wseq_state_pair);
+
+  // If the pair was just inserted, then also add it to <state_to_wseq_>.
+  if (result.second == true)
+    state_to_wseq_.push_back(wseq);
+
+  // Creates the arc.
+  oarc->ilabel = ilabel;
+  oarc->olabel = ilabel;
+  oarc->nextstate = result.first->second;
+  oarc->weight = Weight(-logprob);
+
+  return true;
+}
+
+}  // namespace kaldi
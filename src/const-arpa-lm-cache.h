@@ -0,0 +1,132 @@
+// const-arpa-lm-cache.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_CONST_ARPA_LM_CACHE_H_
+#define KALDI_SRC_CONST_ARPA_LM_CACHE_H_
+
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+
+#include "fstext/deterministic-fst.h"
+#include "lm/const-arpa-lm.h"
+#include "util/stl-utils.h"
+
+namespace kaldi {
+
+// Bounded LRU cache of ConstArpaLm lookups: for a history and a word, the
+// log-probability of the word and the history state that follows it. The
+// cache outlives the lattices it is used for, and is shared by everyone
+// who uses the same ConstArpaLm, so the frequent histories are only looked
+// up in the LM once. It is split into shards with a lock each, so that
+// decoders rescoring at the same time rarely wait for each other.
+class ConstArpaLmCache {
+ public:
+  // Returns the cache for 'lm', creating it with a capacity of about
+  // max_bytes if needed; an existing cache keeps its capacity.
+  static ConstArpaLmCache *Acquire(const ConstArpaLm *lm, size_t max_bytes);
+
+  // Adds a reference to a cache obtained with Acquire()
+  static void Ref(ConstArpaLmCache *cache);
+
+  // Drops a reference; the cache is freed with the last one. NULL is
+  // ignored.
+  static void Release(ConstArpaLmCache *cache);
+
+  // Returns the log-probability of 'word' after 'history'
+  // (-infinity if the LM doesn't allow it) and, if next_history is not
+  // NULL, the history state after it, as ConstArpaLmDeterministicFst does.
+  BaseFloat GetNgram(const std::vector<int32> &history, int32 word,
+                     std::vector<int32> *next_history);
+
+  const ConstArpaLm &Lm() const { return lm_; }
+
+  void GetStats(guint64 *hits, guint64 *misses, size_t *num_bytes) const;
+
+ private:
+  static const int32 kNumShards = 16;
+
+  struct Entry {
+    std::vector<int32> key;  // the history followed by the word
+    BaseFloat logprob;
+    std::vector<int32> next_history;
+  };
+  typedef std::list<Entry> EntryList;
+
+  struct Shard {
+    GMutex lock;
+    EntryList entries;  // most recently used first
+    std::unordered_map<std::vector<int32>, EntryList::iterator,
+                       VectorHasher<int32> > index;
+    size_t num_bytes;
+    guint64 hits;
+    guint64 misses;
+  };
+
+  ConstArpaLmCache(const ConstArpaLm *lm, size_t max_bytes);
+  ~ConstArpaLmCache();
+
+  static size_t EntryBytes(const Entry &entry);
+
+  const ConstArpaLm &lm_;
+  const size_t max_bytes_per_shard_;
+  Shard shards_[kNumShards];
+  int32 ref_count_;  // protected by caches_lock_
+
+  static GMutex caches_lock_;
+  static std::map<const ConstArpaLm*, ConstArpaLmCache*> caches_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ConstArpaLmCache);
+};
+
+
+// Works like ConstArpaLmDeterministicFst, but looks up the LM through a
+// ConstArpaLmCache. The states are numbered per instance, so one instance
+// should be used for one lattice, but the lookups are shared.
+class CachedConstArpaLmDeterministicFst
+    : public fst::DeterministicOnDemandFst<fst::StdArc> {
+ public:
+  typedef fst::StdArc::Weight Weight;
+  typedef fst::StdArc::StateId StateId;
+  typedef fst::StdArc::Label Label;
+
+  explicit CachedConstArpaLmDeterministicFst(ConstArpaLmCache *cache);
+
+  virtual StateId Start() { return 0; }
+
+  virtual Weight Final(StateId s);
+
+  virtual bool GetArc(StateId s, Label ilabel, fst::StdArc *oarc);
+
+ private:
+  typedef std::unordered_map<std::vector<Label>, StateId, VectorHasher<Label> > MapType;
+
+  ConstArpaLmCache *cache_;
+  MapType wseq_to_state_;
+  std::vector<std::vector<Label> > state_to_wseq_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(CachedConstArpaLmDeterministicFst);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_CONST_ARPA_LM_CACHE_H_
@@ -0,0 +1,244 @@
+// gst-audio-source-bench.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the cost of passing audio buffers from the streaming thread to
+// the decoding thread through GstBufferSource, against the GAsyncQueue and
+// mutex it used before the lock-free ring, e.g.:
+//
+//   ./gst-audio-source-bench --num-buffers=1000000 --buffer-samples=160
+//
+// A producer thread pushes the same buffer over and over while the main
+// thread reads it back in chunks, as the decoder does. Both sources convert
+// the S16LE mono samples with GstBufferSource::ConvertS16Mono(), so the
+// difference is in the queue. The time per buffer is reported for each, in
+// nanoseconds.
+
+#include <algorithm>
+#include <cstdio>
+
+#include <gst/gst.h>
+
+#include "./gst-audio-source.h"
+
+namespace kaldi {
+
+// The queue of GstBufferSource as it was before the lock-free ring, with
+// the S16LE mono conversion of the current one
+class AsyncQueueBufferSource {
+ public:
+  AsyncQueueBufferSource() : ended_(false) {
+    buf_queue_ = g_async_queue_new();
+    current_buffer_ = NULL;
+    pos_in_current_buf_ = 0;
+    g_cond_init(&data_cond_);
+    g_mutex_init(&lock_);
+  }
+
+  ~AsyncQueueBufferSource() {
+    g_cond_clear(&data_cond_);
+    g_mutex_clear(&lock_);
+    GstBuffer *buf;
+    while ((buf = reinterpret_cast<GstBuffer*>(g_async_queue_try_pop(buf_queue_))) != NULL) {
+      gst_buffer_unref(buf);
+    }
+    g_async_queue_unref(buf_queue_);
+    ReleaseCurrentBuffer();
+  }
+
+  void PushBuffer(GstBuffer *buf) {
+    g_mutex_lock(&lock_);
+    gst_buffer_ref(buf);
+    g_async_queue_push(buf_queue_, buf);
+    g_cond_signal(&data_cond_);
+    g_mutex_unlock(&lock_);
+  }
+
+  void SetEnded(bool ended) {
+    g_mutex_lock(&lock_);
+    ended_ = ended;
+    g_cond_signal(&data_cond_);
+    g_mutex_unlock(&lock_);
+  }
+
+  bool Read(Vector<BaseFloat> *data) {
+    uint32 nsamples_req = data->Dim();
+    uint32 nsamples_received = 0;
+    BaseFloat *out = data->Data();
+    while (nsamples_received < nsamples_req && NextBuffer()) {
+      const guint8 *in = current_map_.data + pos_in_current_buf_;
+      uint32 nsamples = std::min(static_cast<gsize>(nsamples_req - nsamples_received),
+                                 (current_map_.size - pos_in_current_buf_) / sizeof(int16));
+      GstBufferSource::ConvertS16Mono(in, nsamples, out + nsamples_received);
+      nsamples_received += nsamples;
+      pos_in_current_buf_ += nsamples * sizeof(int16);
+      if (pos_in_current_buf_ == current_map_.size) {
+        ReleaseCurrentBuffer();
+      }
+    }
+    if (nsamples_received < nsamples_req) {
+      data->Resize(nsamples_received, kCopyData);
+    }
+    return !((g_async_queue_length(buf_queue_) == 0)
+        && ended_
+        && (current_buffer_ == NULL));
+  }
+
+ private:
+  bool NextBuffer() {
+    while (current_buffer_ == NULL) {
+      g_mutex_lock(&lock_);
+      while ((current_buffer_ == NULL) &&
+          !((g_async_queue_length(buf_queue_) == 0) && ended_)) {
+        current_buffer_ = reinterpret_cast<GstBuffer*>(g_async_queue_try_pop(buf_queue_));
+        if (current_buffer_ == NULL) {
+          g_cond_wait(&data_cond_, &lock_);
+        }
+      }
+      g_mutex_unlock(&lock_);
+      if (current_buffer_ == NULL) {
+        return false;
+      }
+      gst_buffer_map(current_buffer_, &current_map_, GST_MAP_READ);
+    }
+    return true;
+  }
+
+  void ReleaseCurrentBuffer() {
+    if (current_buffer_) {
+      gst_buffer_unmap(current_buffer_, &current_map_);
+      gst_buffer_unref(current_buffer_);
+      current_buffer_ = NULL;
+    }
+    pos_in_current_buf_ = 0;
+  }
+
+  GAsyncQueue* buf_queue_;
+  gsize pos_in_current_buf_;
+  GstBuffer *current_buffer_;
+  GstMapInfo current_map_;
+  bool ended_;
+  GMutex lock_;
+  GCond data_cond_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(AsyncQueueBufferSource);
+};
+
+}  // namespace kaldi
+
+namespace {
+
+using kaldi::BaseFloat;
+using kaldi::Vector;
+
+gint num_buffers = 1000000;
+gint buffer_samples = 160;
+gint read_samples = 800;
+gint num_runs = 5;
+
+GOptionEntry entries[] = {
+  { "num-buffers", 'n', 0, G_OPTION_ARG_INT, &num_buffers,
+    "Number of buffers pushed per run (default: 1000000)", "N" },
+  { "buffer-samples", 'b', 0, G_OPTION_ARG_INT, &buffer_samples,
+    "Samples per pushed buffer (default: 160, 10 ms at 16 kHz)", "N" },
+  { "read-samples", 's', 0, G_OPTION_ARG_INT, &read_samples,
+    "Samples per Read(), as with chunk-length-in-secs (default: 800)", "N" },
+  { "runs", 'r', 0, G_OPTION_ARG_INT, &num_runs,
+    "Number of runs of each source; the fastest is reported (default: 5)", "N" },
+  { NULL }
+};
+
+template<class Source>
+struct Producer {
+  Source *source;
+  GstBuffer *buffer;
+};
+
+template<class Source>
+gpointer Produce(gpointer data) {
+  Producer<Source> *producer = static_cast<Producer<Source>*>(data);
+  for (gint i = 0; i < num_buffers; i++) {
+    producer->source->PushBuffer(producer->buffer);
+  }
+  producer->source->SetEnded(true);
+  return NULL;
+}
+
+// Returns the time per buffer in nanoseconds of the fastest run
+template<class Source>
+double Run(GstBuffer *buffer) {
+  double best = 0.0;
+  for (gint run = 0; run < num_runs; run++) {
+    Source source;
+    Producer<Source> producer;
+    producer.source = &source;
+    producer.buffer = buffer;
+    Vector<BaseFloat> data(read_samples);
+    gint64 num_samples = 0;
+
+    gint64 start_time = g_get_monotonic_time();
+    GThread *thread = g_thread_new("producer", Produce<Source>, &producer);
+    bool more_data = true;
+    while (more_data) {
+      more_data = source.Read(&data);
+      num_samples += data.Dim();
+    }
+    g_thread_join(thread);
+    gint64 elapsed = g_get_monotonic_time() - start_time;
+
+    if (num_samples != static_cast<gint64>(num_buffers) * buffer_samples) {
+      g_printerr("Read %" G_GINT64_FORMAT " samples instead of %" G_GINT64_FORMAT "\n",
+                 num_samples, static_cast<gint64>(num_buffers) * buffer_samples);
+    }
+    double ns_per_buffer = 1000.0 * elapsed / num_buffers;
+    if (run == 0 || ns_per_buffer < best)
+      best = ns_per_buffer;
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new(
+      "- benchmark the audio queue of kaldinnet2onlinedecoder");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  GError *error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free(context);
+  if (num_buffers <= 0 || buffer_samples <= 0 || read_samples <= 0 || num_runs <= 0) {
+    g_printerr("All options must be positive\n");
+    return 1;
+  }
+
+  GstBuffer *buffer = gst_buffer_new_allocate(NULL, buffer_samples * sizeof(kaldi::int16), NULL);
+  gst_buffer_memset(buffer, 0, 0, buffer_samples * sizeof(kaldi::int16));
+
+  double ring = Run<kaldi::GstBufferSource>(buffer);
+  double async_queue = Run<kaldi::AsyncQueueBufferSource>(buffer);
+  printf("%d buffers of %d samples, read in chunks of %d samples\n",
+         num_buffers, buffer_samples, read_samples);
+  printf("lock-free ring (GstBufferSource): %.1f ns/buffer\n", ring);
+  printf("GAsyncQueue + mutex:              %.1f ns/buffer\n", async_queue);
+
+  gst_buffer_unref(buffer);
+  return 0;
+}
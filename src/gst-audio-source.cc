@@ -17,103 +17,440 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
+#include <string.h>
+
 #include <algorithm>
 
+#if defined(__SSE2__) && (KALDI_DOUBLEPRECISION == 0)
+#include <emmintrin.h>
+#define GST_BUFFER_SOURCE_SSE2 1
+#endif
+
 #include "./gst-audio-source.h"
 
 namespace kaldi {
 
+namespace {
+
+typedef void (*ConvertFunc)(const guint8 *in, uint32 nframes, BaseFloat *out);
+
+// Sample loaders for little-endian input, scaled to the 16-bit range.
+// The input is not necessarily aligned, so it is read with memcpy(),
+// which compilers turn into plain (vectorizable) loads.
+inline BaseFloat LoadS16(const guint8 *p) {
+  int16 sample;
+  memcpy(&sample, p, sizeof(sample));
+  return sample;
+}
+
+inline BaseFloat LoadS24(const guint8 *p) {
+  int32 sample = p[0] | (p[1] << 8) | static_cast<int8>(p[2]) * 65536;
+  return sample * static_cast<BaseFloat>(1.0 / 256);
+}
+
+inline BaseFloat LoadS32(const guint8 *p) {
+  int32 sample;
+  memcpy(&sample, p, sizeof(sample));
+  return sample * static_cast<BaseFloat>(1.0 / 65536);
+}
+
+inline BaseFloat LoadF32(const guint8 *p) {
+  float sample;
+  memcpy(&sample, p, sizeof(sample));
+  return sample * static_cast<BaseFloat>(32768);
+}
+
+// Converts interleaved frames, averaging the channels
+template<BaseFloat (*Load)(const guint8 *p), int kBytesPerSample, int kChannels>
+void Convert(const guint8 *in, uint32 nframes, BaseFloat *out) {
+  for (uint32 i = 0; i < nframes; i++) {
+    BaseFloat sum = 0;
+    for (int c = 0; c < kChannels; c++) {
+      sum += Load(in + (i * kChannels + c) * kBytesPerSample);
+    }
+    out[i] = sum * static_cast<BaseFloat>(1.0 / kChannels);
+  }
+}
+
+#ifdef GST_BUFFER_SOURCE_SSE2
+// Hand-written kernels for the most common formats; the remainder that
+// doesn't fill a vector is done by the generic code
+
+void ConvertS16MonoSse2(const guint8 *in, uint32 nframes, BaseFloat *out) {
+  uint32 i = 0;
+  for (; i + 8 <= nframes; i += 8) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 2));
+    // Sign-extend to 32 bits: move each sample to the upper half and
+    // shift it back arithmetically
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    _mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+    _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+  }
+  Convert<LoadS16, 2, 1>(in + i * 2, nframes - i, out + i);
+}
+
+void ConvertS16StereoSse2(const guint8 *in, uint32 nframes, BaseFloat *out) {
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128 half = _mm_set1_ps(0.5f);
+  uint32 i = 0;
+  for (; i + 4 <= nframes; i += 4) {
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * 4));
+    // Adds the left and right samples of each frame into 32 bits
+    __m128i sum = _mm_madd_epi16(s, ones);
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(sum), half));
+  }
+  Convert<LoadS16, 2, 2>(in + i * 4, nframes - i, out + i);
+}
+
+void ConvertF32MonoSse2(const guint8 *in, uint32 nframes, BaseFloat *out) {
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  uint32 i = 0;
+  for (; i + 4 <= nframes; i += 4) {
+    __m128 s = _mm_loadu_ps(reinterpret_cast<const float*>(in + i * 4));
+    _mm_storeu_ps(out + i, _mm_mul_ps(s, scale));
+  }
+  Convert<LoadF32, 4, 1>(in + i * 4, nframes - i, out + i);
+}
+
+void ConvertF32StereoSse2(const guint8 *in, uint32 nframes, BaseFloat *out) {
+  const __m128 scale = _mm_set1_ps(16384.0f);
+  uint32 i = 0;
+  for (; i + 4 <= nframes; i += 4) {
+    __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(in + i * 8));
+    __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(in + i * 8 + 16));
+    __m128 left = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(left, right), scale));
+  }
+  Convert<LoadF32, 4, 2>(in + i * 8, nframes - i, out + i);
+}
+#endif  // GST_BUFFER_SOURCE_SSE2
+
+}  // namespace
+
+struct GstBufferSource::SampleFormat {
+  GstAudioFormat format;
+  gint channels;
+  guint bytes_per_frame;
+  ConvertFunc convert;
+};
+
+// The queue refers to these, so they must stay at fixed addresses
+const GstBufferSource::SampleFormat GstBufferSource::kSampleFormats[] = {
+#ifdef GST_BUFFER_SOURCE_SSE2
+  { GST_AUDIO_FORMAT_S16LE, 1, 2, ConvertS16MonoSse2 },
+  { GST_AUDIO_FORMAT_S16LE, 2, 4, ConvertS16StereoSse2 },
+  { GST_AUDIO_FORMAT_F32LE, 1, 4, ConvertF32MonoSse2 },
+  { GST_AUDIO_FORMAT_F32LE, 2, 8, ConvertF32StereoSse2 },
+#else
+  { GST_AUDIO_FORMAT_S16LE, 1, 2, Convert<LoadS16, 2, 1> },
+  { GST_AUDIO_FORMAT_S16LE, 2, 4, Convert<LoadS16, 2, 2> },
+  { GST_AUDIO_FORMAT_F32LE, 1, 4, Convert<LoadF32, 4, 1> },
+  { GST_AUDIO_FORMAT_F32LE, 2, 8, Convert<LoadF32, 4, 2> },
+#endif
+  { GST_AUDIO_FORMAT_S24LE, 1, 3, Convert<LoadS24, 3, 1> },
+  { GST_AUDIO_FORMAT_S24LE, 2, 6, Convert<LoadS24, 3, 2> },
+  { GST_AUDIO_FORMAT_S32LE, 1, 4, Convert<LoadS32, 4, 1> },
+  { GST_AUDIO_FORMAT_S32LE, 2, 8, Convert<LoadS32, 4, 2> },
+};
+
+void GstBufferSource::ConvertS16Mono(const guint8 *in, uint32 nframes,
+                                     BaseFloat *out) {
+  kSampleFormats[0].convert(in, nframes, out);
+}
 
 GstBufferSource::GstBufferSource() :
-  ended_(false) {
-  buf_queue_ = g_async_queue_new();
+  head_(0), tail_(0), reader_waiting_(0), writer_waiting_(0), ended_(0),
+  interrupted_(0) {
   current_buffer_ = NULL;
   pos_in_current_buf_ = 0;
+  current_format_ = NULL;
+  current_rate_ = 0;
+  start_timestamp_ = GST_CLOCK_TIME_NONE;
+  read_first_buffer_ = false;
+  num_partial_bytes_ = 0;
+  output_rate_ = 0;
+  resampler_ = NULL;
+  resampler_rate_ = 0;
+  pos_in_resampled_ = 0;
 
-  // Monophone, 16-bit input hardcoded
-  KALDI_ASSERT(sizeof(SampleType) == 2 &&
-      "The current GstBufferSource code assumes 16-bit input");
+  // S16LE mono, unless told otherwise
+  push_format_ = NULL;
+  push_rate_ = 0;
+  SetFormat(GST_AUDIO_FORMAT_S16LE, 1);
   g_cond_init(&data_cond_);
+  g_cond_init(&space_cond_);
   g_mutex_init(&lock_);
 }
 
 GstBufferSource::~GstBufferSource() {
   g_cond_clear(&data_cond_);
+  g_cond_clear(&space_cond_);
   g_mutex_clear(&lock_);
-  g_async_queue_unref(buf_queue_);
-  if (current_buffer_) {
-    gst_buffer_unref(current_buffer_);
-    current_buffer_ = NULL;
+  for (guint i = tail_; i != static_cast<guint>(head_); i++) {
+    gst_buffer_unref(queue_[i & (kQueueCapacity - 1)].buffer);
   }
+  ReleaseCurrentBuffer();
+  delete resampler_;
+}
+
+bool GstBufferSource::SetFormat(GstAudioFormat format, gint channels) {
+  for (size_t i = 0; i < G_N_ELEMENTS(kSampleFormats); i++) {
+    if (kSampleFormats[i].format == format && kSampleFormats[i].channels == channels) {
+      push_format_ = &kSampleFormats[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+void GstBufferSource::SetSampleRate(gint rate) {
+  push_rate_ = rate;
+}
+
+void GstBufferSource::SetOutputSampleRate(gint rate) {
+  output_rate_ = rate;
 }
 
 void GstBufferSource::PushBuffer(GstBuffer *buf) {
+  guint head = head_;  // only we change it
+  if (head - g_atomic_int_get(&tail_) == kQueueCapacity) {
+    g_mutex_lock(&lock_);
+    g_atomic_int_set(&writer_waiting_, 1);
+    while (head - g_atomic_int_get(&tail_) == kQueueCapacity
+           && !g_atomic_int_get(&ended_)) {
+      g_cond_wait(&space_cond_, &lock_);
+    }
+    g_atomic_int_set(&writer_waiting_, 0);
+    g_mutex_unlock(&lock_);
+    if (head - g_atomic_int_get(&tail_) == kQueueCapacity) {
+      // Nobody is going to read it anymore
+      return;
+    }
+  }
+
+  QueueItem *item = &queue_[head & (kQueueCapacity - 1)];
+  item->buffer = gst_buffer_ref(buf);
+  item->format = push_format_;
+  item->rate = push_rate_;
+  // Publishes the buffer; the atomic operations are full memory barriers
+  g_atomic_int_set(&head_, static_cast<gint>(head + 1));
+
+  if (g_atomic_int_get(&reader_waiting_)) {
+    // The reader sets the flag before checking the queue for the last
+    // time, with the lock held until it sleeps, so it cannot miss this
+    g_mutex_lock(&lock_);
+    g_cond_signal(&data_cond_);
+    g_mutex_unlock(&lock_);
+  }
+}
+
+void GstBufferSource::SetEnded(bool ended) {
   g_mutex_lock(&lock_);
-  gst_buffer_ref(buf);
-  g_async_queue_push(buf_queue_, buf);
+  g_atomic_int_set(&ended_, ended);
   g_cond_signal(&data_cond_);
+  g_cond_signal(&space_cond_);
   g_mutex_unlock(&lock_);
 }
 
-void GstBufferSource::SetEnded(bool ended) {
+void GstBufferSource::Interrupt() {
   g_mutex_lock(&lock_);
-  ended_ = ended;
+  g_atomic_int_set(&interrupted_, 1);
   g_cond_signal(&data_cond_);
   g_mutex_unlock(&lock_);
 }
 
+bool GstBufferSource::PopBuffer(QueueItem *item) {
+  guint tail = tail_;  // only we change it
+  if (static_cast<guint>(g_atomic_int_get(&head_)) == tail) {
+    g_mutex_lock(&lock_);
+    g_atomic_int_set(&reader_waiting_, 1);
+    while (static_cast<guint>(g_atomic_int_get(&head_)) == tail
+           && !g_atomic_int_get(&ended_)
+           && !g_atomic_int_get(&interrupted_)) {
+      g_cond_wait(&data_cond_, &lock_);
+    }
+    g_atomic_int_set(&reader_waiting_, 0);
+    g_mutex_unlock(&lock_);
+    if (static_cast<guint>(g_atomic_int_get(&head_)) == tail) {
+      return false;
+    }
+  }
 
-bool GstBufferSource::Read(Vector<BaseFloat> *data) {
-  uint32 nsamples_req = data->Dim();  // (16bit) samples requested
-  uint32 kDim = data->Dim();
-  int16 *buf = new int16[kDim];
-  uint32 nbytes_transferred = 0;
+  *item = queue_[tail & (kQueueCapacity - 1)];
+  g_atomic_int_set(&tail_, static_cast<gint>(tail + 1));
 
-  while ((nbytes_transferred  < nsamples_req * sizeof(SampleType))) {
+  if (g_atomic_int_get(&writer_waiting_)) {
     g_mutex_lock(&lock_);
-    while ((current_buffer_ == NULL) &&
-        !((g_async_queue_length(buf_queue_) == 0) && ended_)) {
-      current_buffer_ = reinterpret_cast<GstBuffer*>(g_async_queue_try_pop(buf_queue_));
-      if (current_buffer_ == NULL) {
-        g_cond_wait(&data_cond_, &lock_);
-      }
-    }
+    g_cond_signal(&space_cond_);
     g_mutex_unlock(&lock_);
-    if (current_buffer_ == NULL) {
-      break;
+  }
+  return true;
+}
+
+bool GstBufferSource::NextBuffer() {
+  while (current_buffer_ == NULL) {
+    QueueItem item;
+    if (!PopBuffer(&item)) {
+      return false;
     }
-    uint32 nbytes_from_current =
-        std::min(nsamples_req * sizeof(SampleType) - nbytes_transferred,
-                 (gst_buffer_get_size(current_buffer_) - pos_in_current_buf_));
-    uint32 nbytes_extracted =
-        gst_buffer_extract(current_buffer_, pos_in_current_buf_,
-                           (reinterpret_cast<char *>(buf)) + nbytes_transferred,
-                           nbytes_from_current);
-    KALDI_ASSERT(nbytes_extracted == nbytes_from_current
-                 && "Unexpected number of bytes extracted from Gst buffer");
-
-    nbytes_transferred += nbytes_from_current;
-    pos_in_current_buf_ += nbytes_from_current;
-    if (pos_in_current_buf_ == gst_buffer_get_size(current_buffer_)) {
-      // we are done with the current buffer
+    current_buffer_ = item.buffer;
+    if (!read_first_buffer_) {
+      start_timestamp_ = GST_BUFFER_PTS(current_buffer_);
+      read_first_buffer_ = true;
+    }
+    if (item.format != current_format_ || item.rate != current_rate_) {
+      // The format has changed, an incomplete frame is of no use
+      current_format_ = item.format;
+      current_rate_ = item.rate;
+      num_partial_bytes_ = 0;
+    }
+    if (!gst_buffer_map(current_buffer_, &current_map_, GST_MAP_READ)) {
+      KALDI_WARN << "Could not map audio buffer, skipping it";
       gst_buffer_unref(current_buffer_);
       current_buffer_ = NULL;
-      pos_in_current_buf_ = 0;
+    } else if (current_map_.size == 0) {
+      ReleaseCurrentBuffer();
+    }
+  }
+  return true;
+}
+
+void GstBufferSource::ReleaseCurrentBuffer() {
+  if (current_buffer_) {
+    gst_buffer_unmap(current_buffer_, &current_map_);
+    gst_buffer_unref(current_buffer_);
+    current_buffer_ = NULL;
+  }
+  pos_in_current_buf_ = 0;
+}
+
+uint32 GstBufferSource::ReadFrames(BaseFloat *out, uint32 nframes_req, gint *rate) {
+  uint32 nframes_received = 0;
+
+  // Frames are converted straight from the mapped buffers into out
+  while (nframes_received < nframes_req && NextBuffer()) {
+    if (nframes_received == 0) {
+      *rate = current_rate_;
+    } else if (current_rate_ != *rate) {
+      break;
+    }
+
+    const guint8 *in = current_map_.data + pos_in_current_buf_;
+    gsize nbytes_left = current_map_.size - pos_in_current_buf_;
+    gsize bytes_per_frame = current_format_->bytes_per_frame;
+    gsize nbytes_used;
+
+    if (num_partial_bytes_ > 0) {
+      // Complete the frame that was split between two buffers
+      nbytes_used = std::min(bytes_per_frame - num_partial_bytes_, nbytes_left);
+      memcpy(partial_frame_ + num_partial_bytes_, in, nbytes_used);
+      num_partial_bytes_ += nbytes_used;
+      if (num_partial_bytes_ == bytes_per_frame) {
+        current_format_->convert(partial_frame_, 1, out + nframes_received);
+        nframes_received++;
+        num_partial_bytes_ = 0;
+      }
+    } else {
+      uint32 nframes = std::min(static_cast<gsize>(nframes_req - nframes_received),
+                                nbytes_left / bytes_per_frame);
+      if (nframes > 0) {
+        current_format_->convert(in, nframes, out + nframes_received);
+        nframes_received += nframes;
+        nbytes_used = nframes * bytes_per_frame;
+      } else {
+        // Only the start of a frame is left in this buffer
+        memcpy(partial_frame_, in, nbytes_left);
+        num_partial_bytes_ = nbytes_left;
+        nbytes_used = nbytes_left;
+      }
+    }
+
+    pos_in_current_buf_ += nbytes_used;
+    if (pos_in_current_buf_ == current_map_.size) {
+      // we are done with the current buffer
+      ReleaseCurrentBuffer();
     }
   }
+  return nframes_received;
+}
 
-  uint32 nsamples_received = nbytes_transferred / sizeof(SampleType);
-  for (int i = 0; i < nsamples_received ; ++i) {
-    (*data)(i) = static_cast<BaseFloat>(buf[i]);
+void GstBufferSource::FlushResampler() {
+  if (resampler_) {
+    Vector<BaseFloat> empty;
+    resampler_->Resample(empty, true, &resampled_);
+    pos_in_resampled_ = 0;
+    delete resampler_;
+    resampler_ = NULL;
   }
+}
+
+bool GstBufferSource::Read(Vector<BaseFloat> *data) {
+  uint32 nframes_req = data->Dim();  // (mono) samples requested
+  uint32 nframes_received = 0;
+  BaseFloat *out = data->Data();
 
-  delete[] buf;
+  while (nframes_received < nframes_req) {
+    // Use up the resampled data first
+    if (pos_in_resampled_ < resampled_.Dim()) {
+      uint32 n = std::min(nframes_req - nframes_received,
+                          static_cast<uint32>(resampled_.Dim() - pos_in_resampled_));
+      memcpy(out + nframes_received, resampled_.Data() + pos_in_resampled_,
+             n * sizeof(BaseFloat));
+      nframes_received += n;
+      pos_in_resampled_ += n;
+      continue;
+    }
+
+    if (!NextBuffer()) {
+      if (g_atomic_int_get(&interrupted_) && !g_atomic_int_get(&ended_)) {
+        // Interrupted while waiting for audio, return what we have
+        break;
+      }
+      // End of the stream
+      FlushResampler();
+      if (pos_in_resampled_ < resampled_.Dim())
+        continue;
+      break;
+    }
+
+    gint rate;
+    if (output_rate_ == 0 || current_rate_ == 0 || current_rate_ == output_rate_) {
+      // No resampling needed, convert directly into data
+      FlushResampler();
+      if (pos_in_resampled_ < resampled_.Dim())
+        continue;
+      nframes_received += ReadFrames(out + nframes_received,
+                                     nframes_req - nframes_received, &rate);
+      continue;
+    }
+
+    if (resampler_rate_ != current_rate_ || resampler_ == NULL) {
+      FlushResampler();
+      if (pos_in_resampled_ < resampled_.Dim())
+        continue;
+      // The same filter as Kaldi's feature extractors use for resampling
+      BaseFloat cutoff = 0.99 * 0.5 * std::min(current_rate_, output_rate_);
+      resampler_ = new LinearResample(current_rate_, output_rate_, cutoff, 6);
+      resampler_rate_ = current_rate_;
+    }
+    // Resample a chunk of (at most) the requested size; Resize() keeps the
+    // memory when the size doesn't change
+    input_.Resize(nframes_req, kUndefined);
+    uint32 n = ReadFrames(input_.Data(), nframes_req, &rate);
+    resampler_->Resample(SubVector<BaseFloat>(input_, 0, n), false, &resampled_);
+    pos_in_resampled_ = 0;
+  }
 
-  if (nsamples_received < nsamples_req) {
-    data->Resize(nsamples_received, kCopyData);
+  if (nframes_received < nframes_req) {
+    // Only happens at the end of the stream or after Interrupt()
+    data->Resize(nframes_received, kCopyData);
   }
-  return !((g_async_queue_length(buf_queue_) < sizeof(SampleType))
-      && ended_
-      && (current_buffer_ == NULL));
+  g_atomic_int_set(&interrupted_, 0);
+  return !(g_atomic_int_get(&head_) == tail_
+      && g_atomic_int_get(&ended_)
+      && (current_buffer_ == NULL)
+      && (pos_in_resampled_ == resampled_.Dim()));
 }
 }
@@ -21,35 +21,131 @@
 #define KALDI_SRC_GST_AUDIO_SOURCE_H_
 
 #include <matrix/kaldi-vector.h>
+#include <feat/resample.h>
 #include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include "./stream-decoder.h"
 
 namespace kaldi {
 
 
-// OnlineAudioSourceItf implementation using a queue of Gst Buffers
-class GstBufferSource {
+// StreamAudioSource implementation using a queue of Gst Buffers.
+//
+// PushBuffer() must only be called from one thread (the streaming thread)
+// and Read() from another one (the decoding thread). The buffers are
+// passed through a bounded lock-free ring; a thread only takes the lock to
+// sleep when the ring is empty (reader) or full (writer), and the other
+// side only takes it to wake it up.
+//
+// The audio can be S16LE, S24LE, S32LE or F32LE, mono or interleaved
+// stereo; it is converted to floats in the 16-bit range that Kaldi
+// expects, and stereo is mixed down to mono. Audio at a sample rate other
+// than the output rate is resampled.
+class GstBufferSource : public StreamAudioSource {
  public:
-  typedef int16 SampleType;  // hardcoded 16-bit audio
-
   GstBufferSource();
 
-  // Implementation of the OnlineAudioSourceItf
-  bool Read(Vector<BaseFloat> *data);
+  // Implementation of the StreamAudioSource
+  virtual bool Read(Vector<BaseFloat> *data);
+
+  // Sets the format of the buffers pushed after this call (S16LE mono by
+  // default). Returns false if the format is not supported.
+  bool SetFormat(GstAudioFormat format, gint channels);
+
+  // Sets the sample rate of the buffers pushed after this call. Audio at
+  // another rate than the one given to SetOutputSampleRate() is resampled;
+  // 0 (the default) means the output rate.
+  void SetSampleRate(gint rate);
 
+  // Sets the sample rate of the data returned by Read(); must be called
+  // before reading. 0 (the default) disables resampling.
+  void SetOutputSampleRate(gint rate);
+
+  // Blocks while the queue is full (kQueueCapacity buffers), unless the
+  // stream has ended, in which case the buffer is dropped. The queue used
+  // to be unbounded; now, when decoding falls behind, the streaming thread
+  // and so upstream are held back instead of the buffers piling up.
   void PushBuffer(GstBuffer *buf);
 
+  // Converts S16LE mono samples to floats as Read() does, so that other
+  // queues can be benchmarked against this one with the same conversion
+  static void ConvertS16Mono(const guint8 *in, uint32 nframes, BaseFloat *out);
+
   void SetEnded(bool ended);
 
+  // Implementation of the StreamAudioSource; wakes up a waiting Read()
+  virtual void Interrupt();
+
+  // The timestamp of the first buffer of the stream, GST_CLOCK_TIME_NONE if
+  // it had none or nothing has been read yet; for the reader
+  GstClockTime StartTimestamp() const { return start_timestamp_; }
+
   ~GstBufferSource();
 
  private:
-
-  GAsyncQueue* buf_queue_;
-  gint pos_in_current_buf_;
+  struct SampleFormat;
+  static const SampleFormat kSampleFormats[];
+
+  struct QueueItem {
+    GstBuffer *buffer;
+    const SampleFormat *format;
+    gint rate;
+  };
+
+  // Reads up to nframes frames, as long as they have the sample rate of
+  // the first one (returned in rate). Returns the number of frames read,
+  // which is only 0 at the end of the stream.
+  uint32 ReadFrames(BaseFloat *out, uint32 nframes, gint *rate);
+
+  // Passes what is left in the resampler to resampled_ and deletes it
+  void FlushResampler();
+
+  // Makes sure that there is a current buffer and that it is mapped,
+  // waiting for more data if needed. Returns false at the end of the
+  // stream.
+  bool NextBuffer();
+
+  // Takes the next buffer from the queue, waiting for one if needed.
+  // Returns false at the end of the stream.
+  bool PopBuffer(QueueItem *item);
+
+  void ReleaseCurrentBuffer();
+
+  static const guint kQueueCapacity = 256;  // must be a power of two
+  static const guint kMaxBytesPerFrame = 8;
+
+  // Buffers in the queue are at positions [tail_, head_) modulo the
+  // capacity; head_ is only changed by the writer and tail_ by the reader
+  QueueItem queue_[kQueueCapacity];
+  gint head_;
+  gint tail_;
+  gint reader_waiting_;
+  gint writer_waiting_;
+  const SampleFormat *push_format_;
+  gint push_rate_;
+  gsize pos_in_current_buf_;
   GstBuffer *current_buffer_;
-  bool ended_;
+  GstMapInfo current_map_;
+  const SampleFormat *current_format_;
+  gint current_rate_;
+  GstClockTime start_timestamp_;
+  bool read_first_buffer_;
+  // Start of a frame that was split between two buffers
+  guint8 partial_frame_[kMaxBytesPerFrame];
+  gsize num_partial_bytes_;
+  // Resampling state, only used by the reader
+  gint output_rate_;
+  LinearResample *resampler_;
+  gint resampler_rate_;
+  Vector<BaseFloat> input_;
+  Vector<BaseFloat> resampled_;
+  int32 pos_in_resampled_;
+  gint ended_;
+  gint interrupted_;  // cleared by Read()
   GMutex lock_;
   GCond data_cond_;
+  GCond space_cond_;
   KALDI_DISALLOW_COPY_AND_ASSIGN(GstBufferSource);
 };
 
@@ -48,25 +48,21 @@
 
 #include "./kaldimarshal.h"
 #include "./gstkaldinnet2onlinedecoder.h"
+#include "./kaldi-result.h"
+#include "./state-blob.h"
+#include "./speaker-cache.h"
+#include "./stage-profiler.h"
+#include "./stream-decoder.h"
 
 #include "fstext/fstext-lib.h"
-#include "lat/confidence.h"
-#include "hmm/hmm-utils.h"
 #include "nnet3/nnet-utils.h"
-#include "lat/sausages.h"
 
 #include <fst/script/project.h>
 
+#include <deque>
 #include <fstream>
 #include <iostream>
 
-#include <jansson.h>
-
-/* JSON_REAL_PRECISION is a macro from libjansson 2.7. Ubuntu 12.04 only has 2.2.1-1 */
-#ifndef JSON_REAL_PRECISION
-#define JSON_REAL_PRECISION(n)  (((n) & 0x1F) << 11)
-#endif // JSON_REAL_PRECISION
-
 
 namespace kaldi {
 
@@ -78,6 +74,7 @@ enum {
   PARTIAL_RESULT_SIGNAL,
   FINAL_RESULT_SIGNAL,
   FULL_FINAL_RESULT_SIGNAL,
+  PARTIAL_RESULT_DELTA_SIGNAL,
   LAST_SIGNAL
 };
 
@@ -104,6 +101,25 @@ enum {
   PROP_NUM_PHONE_ALIGNMENT,
   PROP_WORD_BOUNDARY_FILE,
   PROP_MIN_WORDS_FOR_IVECTOR,
+  PROP_FST_MMAP,
+  PROP_ASYNC_MODEL_LOADING,
+  PROP_RESAMPLE,
+  PROP_MAX_LAG_IN_FRAMES,
+  PROP_MAX_LAG_IN_MS,
+  PROP_NNET3_BATCH_SIZE,
+  PROP_NNET3_BATCH_FRAMES_PER_CHUNK,
+  PROP_NNET3_BATCH_MAX_WAIT_MS,
+  PROP_BIG_LM_CACHE_MB,
+  PROP_BIG_LM_CACHE_HITS,
+  PROP_BIG_LM_CACHE_MISSES,
+  PROP_MAX_PENDING_RESULTS,
+  PROP_ASYNC_SIGNALS,
+  PROP_ADAPTATION_STATE_BYTES,
+  PROP_CMVN_STATE_BYTES,
+  PROP_SPEAKER_ID,
+  PROP_SPEAKER_CACHE_SIZE,
+  PROP_SPEAKER_CACHE_DIR,
+  PROP_STATS,
   PROP_LAST
 };
 
@@ -120,45 +136,30 @@ enum {
 #define DEFAULT_NUM_NBEST 1
 #define DEFAULT_NUM_PHONE_ALIGNMENT 1
 #define DEFAULT_MIN_WORDS_FOR_IVECTOR 2
+#define DEFAULT_FST_MMAP false
+#define DEFAULT_ASYNC_MODEL_LOADING false
+#define DEFAULT_RESAMPLE false
+#define DEFAULT_MAX_LAG_IN_FRAMES 100
+#define DEFAULT_MAX_LAG_IN_MS 0
+#define DEFAULT_NNET3_BATCH_SIZE 0
+#define DEFAULT_NNET3_BATCH_FRAMES_PER_CHUNK 50
+#define DEFAULT_NNET3_BATCH_MAX_WAIT_MS 10
+#define DEFAULT_BIG_LM_CACHE_MB 64
+#define DEFAULT_MAX_PENDING_RESULTS 0
+#define DEFAULT_ASYNC_SIGNALS false
+#define DEFAULT_SPEAKER_ID ""
 
 /**
- * Some structs used for storing recognition results
+ * Structs used for loading models in the background and for emitting
+ * result signals from the dispatcher thread
  */
-typedef struct _WordInHypothesis WordInHypothesis;
-typedef struct _PhoneAlignmentInfo PhoneAlignmentInfo;
-typedef struct _WordAlignmentInfo WordAlignmentInfo;
-typedef struct _NBestResult NBestResult;
-typedef struct _FullFinalResult FullFinalResult;
-
-struct _WordInHypothesis {
-  int32 word_id;
-};
-
-struct _WordAlignmentInfo {
-  int32 word_id;
-  int32 start_frame;
-  int32 length_in_frames;
-  double confidence;
-};
-
-struct _PhoneAlignmentInfo {
-  int32 phone_id;
-  int32 start_frame;
-  int32 length_in_frames;
-  double confidence;
-};
-
-struct _NBestResult {
-  int32 num_frames;
-  double likelihood;
-  std::vector<WordInHypothesis> words;
-  std::vector<PhoneAlignmentInfo> phone_alignment;
-  std::vector<WordAlignmentInfo> word_alignment;
-};
+typedef struct _ModelLoadJob ModelLoadJob;
+typedef struct _PendingSignal PendingSignal;
 
-struct _FullFinalResult {
-  std::vector<NBestResult> nbest_results;
-  std::string phone_alignment;
+// A result signal waiting to be emitted by the signal dispatcher
+struct _PendingSignal {
+  guint signal;
+  std::string result;
 };
 
 
@@ -171,18 +172,23 @@ GST_STATIC_PAD_TEMPLATE("sink",
     GST_PAD_ALWAYS,
     GST_STATIC_CAPS(
         "audio/x-raw, "
-        "format = (string) S16LE, "
-        "channels = (int) 1, "
+        "format = (string) { S16LE, S24LE, S32LE, F32LE }, "
+        "channels = (int) [ 1, 2 ], "
+        "layout = (string) interleaved, "
         "rate = (int) [ 1, MAX ]"));
 
 static GstStaticPadTemplate src_template =
 GST_STATIC_PAD_TEMPLATE("src",
     GST_PAD_SRC,
     GST_PAD_ALWAYS,
-    GST_STATIC_CAPS("text/x-raw, format= { utf8 }"));
+    GST_STATIC_CAPS("text/x-raw, format= { utf8 }; " KALDI_RESULT_MEDIA_TYPE));
 
 static guint gst_kaldinnet2onlinedecoder_signals[LAST_SIGNAL];
 
+/* Worker threads for loading models in the background, shared by all
+ * decoder instances */
+static GThreadPool *gst_kaldinnet2onlinedecoder_load_pool;
+
 #define gst_kaldinnet2onlinedecoder_parent_class parent_class
 G_DEFINE_TYPE(Gstkaldinnet2onlinedecoder, gst_kaldinnet2onlinedecoder,
               GST_TYPE_ELEMENT);
@@ -193,17 +199,21 @@ static void gst_kaldinnet2onlinedecoder_load_phone_syms(Gstkaldinnet2onlinedecod
 static void gst_kaldinnet2onlinedecoder_load_word_syms(Gstkaldinnet2onlinedecoder * filter,
                                                        const GValue * value);
 
-static void gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
-                                                   const GValue * value);
+static void gst_kaldinnet2onlinedecoder_schedule_load(Gstkaldinnet2onlinedecoder * filter,
+                                                      guint prop_id,
+                                                      GParamSpec * pspec,
+                                                      const GValue * value);
+
+static void gst_kaldinnet2onlinedecoder_run_load_job(gpointer data,
+                                                     gpointer user_data);
 
-static void gst_kaldinnet2onlinedecoder_load_fst(Gstkaldinnet2onlinedecoder * filter,
-                                                 const GValue * value);
+static void gst_kaldinnet2onlinedecoder_wait_for_models(Gstkaldinnet2onlinedecoder * filter);
 
-static void gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
-                                                    const GValue * value);
+static StreamDecoderListener *gst_kaldinnet2onlinedecoder_new_listener(
+    Gstkaldinnet2onlinedecoder * filter);
 
-static void gst_kaldinnet2onlinedecoder_load_big_lm(Gstkaldinnet2onlinedecoder * filter,
-                                                    const GValue * value);
+static void gst_kaldinnet2onlinedecoder_dispatch_signals(gpointer data,
+                                                         gpointer user_data);
 
 static void gst_kaldinnet2onlinedecoder_load_word_boundary_info(Gstkaldinnet2onlinedecoder * filter,
                                                                 const GValue * value);
@@ -215,6 +225,32 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
                                                      const GValue * value,
                                                      GParamSpec * pspec);
 
+// Returns the percentiles of the stage durations and the counters of the
+// profiler as a new structure
+static GstStructure *gst_kaldinnet2onlinedecoder_stats(
+    Gstkaldinnet2onlinedecoder * filter) {
+  GstStructure *stats = gst_structure_new_empty("kaldi-decoder-stats");
+  for (int32 i = 0; i < kNumProfilerStages; i++) {
+    ProfilerStage stage = static_cast<ProfilerStage>(i);
+    const LatencyHistogram &histogram = filter->profiler->Histogram(stage);
+    std::string name = StageProfiler::StageName(stage);
+    gst_structure_set(stats,
+                      (name + "-count").c_str(), G_TYPE_UINT64, histogram.Count(),
+                      (name + "-p50").c_str(), G_TYPE_DOUBLE, histogram.Percentile(0.50),
+                      (name + "-p95").c_str(), G_TYPE_DOUBLE, histogram.Percentile(0.95),
+                      (name + "-p99").c_str(), G_TYPE_DOUBLE, histogram.Percentile(0.99),
+                      NULL);
+  }
+  for (int32 i = 0; i < kNumProfilerCounters; i++) {
+    ProfilerCounter counter = static_cast<ProfilerCounter>(i);
+    gst_structure_set(stats,
+                      StageProfiler::CounterName(counter), G_TYPE_UINT64,
+                      filter->profiler->Counter(counter),
+                      NULL);
+  }
+  return stats;
+}
+
 static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
                                                      guint prop_id,
                                                      GValue * value,
@@ -279,6 +315,140 @@ static void gst_kaldinnet2onlinedecoder_class_init(
       g_param_spec_string("fst", "Decoding FST", "Filename of the HCLG FST",
       DEFAULT_FST,
                           (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_FST_MMAP,
+      g_param_spec_boolean(
+          "fst-mmap",
+          "Memory-map the decoding graph instead of reading it into memory (NB! must be set before the 'fst' property)",
+          "If true, memory-map the HCLG FST from disk instead of reading it into memory, "
+          "so that its pages are shared between processes. Graphs that are not aligned ConstFsts "
+          "are converted once to '<fst>.mmap' (NB! must be set before the 'fst' property)",
+          DEFAULT_FST_MMAP,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_ASYNC_MODEL_LOADING,
+      g_param_spec_boolean(
+          "async-model-loading",
+          "Load models in the background (NB! must be set before the model properties)",
+          "If true, the model, fst, lm-fst and big-lm-const-arpa properties are loaded in background "
+          "threads and setting them returns immediately. A 'kaldi-model-loaded' element message is posted "
+          "for each of them, and the READY to PAUSED state change completes asynchronously when all are loaded",
+          DEFAULT_ASYNC_MODEL_LOADING,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_RESAMPLE,
+      g_param_spec_boolean(
+          "resample",
+          "Accept audio at any sample rate",
+          "If true, accept audio at any sample rate and resample it internally to the sample rate "
+          "of the models; otherwise the audio must be at the sample rate of the models",
+          DEFAULT_RESAMPLE,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_MAX_LAG_IN_FRAMES,
+      g_param_spec_uint(
+          "max-lag-in-frames", "Maximum decoding lag in frames",
+          "With the threaded decoder, the maximum number of frames that decoding may lag behind the "
+          "received audio before the element waits for it to catch up, e.g. for endpoint detection. "
+          "With nnet3 models, the maximum number of scored frames queued for the search",
+          0,
+          G_MAXUINT,
+          DEFAULT_MAX_LAG_IN_FRAMES,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_MAX_LAG_IN_MS,
+      g_param_spec_uint(
+          "max-lag-in-ms", "Maximum decoding lag in milliseconds",
+          "If greater than 0, max-lag-in-frames given in milliseconds of audio instead, "
+          "which overrides max-lag-in-frames",
+          0,
+          G_MAXUINT,
+          DEFAULT_MAX_LAG_IN_MS,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_NNET3_BATCH_SIZE,
+      g_param_spec_uint(
+          "nnet3-batch-size", "Batch size of shared nnet3 computation",
+          "If greater than 0, nnet3 acoustic scores are computed by a process-wide service that "
+          "evaluates chunks from all decoders that use the same model in minibatches of this size. "
+          "0 means that each decoder computes its own scores",
+          0,
+          G_MAXUINT,
+          DEFAULT_NNET3_BATCH_SIZE,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_NNET3_BATCH_FRAMES_PER_CHUNK,
+      g_param_spec_uint(
+          "nnet3-batch-frames-per-chunk", "Chunk size of shared nnet3 computation in frames",
+          "With nnet3-batch-size, the number of frames in each chunk. Every chunk is computed with "
+          "its full left and right context, so longer chunks waste less computation on the context "
+          "but delay the scores of the frames at their start",
+          1,
+          G_MAXUINT,
+          DEFAULT_NNET3_BATCH_FRAMES_PER_CHUNK,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_NNET3_BATCH_MAX_WAIT_MS,
+      g_param_spec_uint(
+          "nnet3-batch-max-wait-ms", "Maximum wait for a full nnet3 batch in milliseconds",
+          "With nnet3-batch-size, the maximum time a chunk waits for the minibatch to fill up "
+          "before an incomplete minibatch is computed",
+          0,
+          G_MAXUINT,
+          DEFAULT_NNET3_BATCH_MAX_WAIT_MS,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_BIG_LM_CACHE_MB,
+      g_param_spec_uint(
+          "big-lm-cache-mb", "Size of the big LM lookup cache in megabytes (NB! must be set before big-lm-const-arpa)",
+          "Approximate maximum size of the cache of big LM lookups that is kept across segments and "
+          "shared by all decoders that use the same big LM; the first decoder to load the LM decides it. "
+          "0 disables the cache",
+          0,
+          G_MAXUINT,
+          DEFAULT_BIG_LM_CACHE_MB,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_BIG_LM_CACHE_HITS,
+      g_param_spec_uint64(
+          "big-lm-cache-hits", "Big LM cache hits",
+          "Number of big LM lookups answered from the cache (shared with other decoders using the same LM)",
+          0,
+          G_MAXUINT64,
+          0,
+          (GParamFlags) G_PARAM_READABLE));
+  g_object_class_install_property(
+      gobject_class, PROP_BIG_LM_CACHE_MISSES,
+      g_param_spec_uint64(
+          "big-lm-cache-misses", "Big LM cache misses",
+          "Number of big LM lookups that were not in the cache (shared with other decoders using the same LM)",
+          0,
+          G_MAXUINT64,
+          0,
+          (GParamFlags) G_PARAM_READABLE));
+  g_object_class_install_property(
+      gobject_class, PROP_MAX_PENDING_RESULTS,
+      g_param_spec_uint(
+          "max-pending-results", "Maximum number of segments whose results are produced in the background",
+          "If greater than 0, big LM rescoring and producing the final results of a segment are done in a "
+          "background thread while the next segment is decoded, and decoding waits only if this many "
+          "segments are already waiting. The results are still emitted in order. The adaptation state is "
+          "then updated based on the first-pass result. 0 produces the results before decoding continues",
+          0,
+          G_MAXUINT,
+          DEFAULT_MAX_PENDING_RESULTS,
+          (GParamFlags) G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_ASYNC_SIGNALS,
+      g_param_spec_boolean(
+          "async-signals",
+          "Emit the result signals from a separate thread",
+          "If true, the partial-result, partial-result-delta, final-result and full-final-result signals "
+          "are emitted from a dispatcher thread, so that slow handlers don't hold up decoding. If the "
+          "handlers fall behind, only the newest of the partial results waiting in a row is emitted; "
+          "all other results are emitted in order, and all of them before EOS",
+          DEFAULT_ASYNC_SIGNALS,
+          (GParamFlags) G_PARAM_READWRITE));
   g_object_class_install_property(
       gobject_class,
       PROP_WORD_SYMS,
@@ -328,6 +498,63 @@ static void gst_kaldinnet2onlinedecoder_class_init(
                           "",
                           (GParamFlags) G_PARAM_READWRITE));
 
+  g_object_class_install_property(
+      gobject_class,
+      PROP_ADAPTATION_STATE_BYTES,
+      g_param_spec_boxed("adaptation-state-bytes", "Adaptation state in binary form",
+                         "Current adaptation state, in a compact binary form (GBytes), set to NULL to reset",
+                         G_TYPE_BYTES,
+                         (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_CMVN_STATE_BYTES,
+      g_param_spec_boxed("cmvn-state-bytes", "CMVN state in binary form",
+                         "Current online CMVN state, in a compact binary form (GBytes), set to NULL to reset",
+                         G_TYPE_BYTES,
+                         (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_SPEAKER_ID,
+      g_param_spec_string("speaker-id", "Speaker ID",
+                          "If set, the adaptation and CMVN states are taken from the speaker cache when a stream "
+                          "starts (or reset, for a new speaker) and stored there when it ends",
+                          DEFAULT_SPEAKER_ID,
+                          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_SPEAKER_CACHE_SIZE,
+      g_param_spec_uint("speaker-cache-size", "Speaker cache size",
+                        "Maximum number of speakers whose states are kept in memory. The cache is shared by all "
+                        "decoders in the process and keeps the largest size that any of them has set, which is "
+                        "what reading the property returns",
+                        0,
+                        G_MAXUINT,
+                        SpeakerStateCache::kDefaultCapacity,
+                        (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_SPEAKER_CACHE_DIR,
+      g_param_spec_string("speaker-cache-dir", "Speaker cache directory",
+                          "If set, the states of speakers that don't fit in the speaker cache are written to "
+                          "this directory and read back when they return. The directory is shared by all decoders "
+                          "in the process: setting it changes it for all of them",
+                          "",
+                          (GParamFlags) G_PARAM_READWRITE));
+
+  g_object_class_install_property(
+      gobject_class,
+      PROP_STATS,
+      g_param_spec_boxed("stats", "Decoding statistics",
+                         "The 50th, 95th and 99th percentiles of the time (in seconds) spent in each stage "
+                         "of decoding, and counts of segments, endpoints, partial results and rescoring "
+                         "failures, since the decoder was created",
+                         GST_TYPE_STRUCTURE,
+                         (GParamFlags) G_PARAM_READABLE));
+
   g_object_class_install_property(
       gobject_class,
       PROP_INVERSE_SCALE,
@@ -402,7 +629,8 @@ static void gst_kaldinnet2onlinedecoder_class_init(
       g_param_spec_boolean(
           "use-threaded-decoder",
           "Use a decoder that does feature calculation and decoding in separate threads (NB! must be set before other properties)",
-          "Whether to use a threaded decoder (NB! must be set before other properties)",
+          "Whether to use a threaded decoder (NB! must be set before other properties). With nnet3 "
+          "models, features and acoustic scores are computed in one thread and the search runs in another",
           DEFAULT_USE_THREADED_DECODER,
           (GParamFlags) G_PARAM_READWRITE));
 
@@ -460,6 +688,19 @@ static void gst_kaldinnet2onlinedecoder_class_init(
       NULL, kaldi_marshal_VOID__STRING, G_TYPE_NONE, 1,
       G_TYPE_STRING);
 
+  gst_kaldinnet2onlinedecoder_signals[PARTIAL_RESULT_DELTA_SIGNAL] = g_signal_new(
+      "partial-result-delta", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(Gstkaldinnet2onlinedecoderClass, partial_result_delta),
+      NULL,
+      NULL, kaldi_marshal_VOID__STRING, G_TYPE_NONE, 1,
+      G_TYPE_STRING);
+
+  // Bounded, so that many elements loading at once don't hold all their
+  // models in memory at the same time while they are being read
+  gst_kaldinnet2onlinedecoder_load_pool =
+      g_thread_pool_new(gst_kaldinnet2onlinedecoder_run_load_job, NULL,
+                        g_get_num_processors(), FALSE, NULL);
+
   gst_element_class_set_details_simple(
       gstelement_class, "KaldiNNet2OnlineDecoder", "Speech/Audio",
       "Convert speech to text", "Tanel Alumae <tanel.alumae@phon.ioc.ee>");
@@ -485,10 +726,7 @@ static void gst_kaldinnet2onlinedecoder_init(
   double tmp_double;
   std::string tmp_string;
 
-  filter->trans_model = NULL;
-  filter->am_nnet2 = NULL;
-  filter->am_nnet3 = NULL;
-  filter->decode_fst = NULL;
+  filter->models = new ModelSet();
 
   filter->sinkpad = NULL;
 
@@ -511,6 +749,43 @@ static void gst_kaldinnet2onlinedecoder_init(
   filter->silent = FALSE;
   filter->model_rspecifier = g_strdup(DEFAULT_MODEL);
   filter->fst_rspecifier = g_strdup(DEFAULT_FST);
+  filter->fst_mmap = DEFAULT_FST_MMAP;
+  filter->async_model_loading = DEFAULT_ASYNC_MODEL_LOADING;
+  filter->resample = DEFAULT_RESAMPLE;
+  filter->max_lag_in_frames = DEFAULT_MAX_LAG_IN_FRAMES;
+  filter->max_lag_in_ms = DEFAULT_MAX_LAG_IN_MS;
+  filter->nnet3_batch_size = DEFAULT_NNET3_BATCH_SIZE;
+  filter->nnet3_batch_frames_per_chunk = DEFAULT_NNET3_BATCH_FRAMES_PER_CHUNK;
+  filter->nnet3_batch_max_wait_ms = DEFAULT_NNET3_BATCH_MAX_WAIT_MS;
+  filter->big_lm_cache_mb = DEFAULT_BIG_LM_CACHE_MB;
+  g_mutex_init(&filter->models_lock);
+  filter->load_serial = 0;
+  filter->model_load_serial = 0;
+  filter->fst_load_serial = 0;
+  filter->lm_fst_load_serial = 0;
+  filter->big_lm_load_serial = 0;
+  g_mutex_init(&filter->load_lock);
+  g_cond_init(&filter->load_cond);
+  filter->num_pending_loads = 0;
+  filter->async_state_change = FALSE;
+  filter->max_pending_results = DEFAULT_MAX_PENDING_RESULTS;
+  filter->async_signals = DEFAULT_ASYNC_SIGNALS;
+  filter->signal_pool = g_thread_pool_new(gst_kaldinnet2onlinedecoder_dispatch_signals,
+                                          NULL, 1, FALSE, NULL);
+  g_mutex_init(&filter->signal_lock);
+  g_cond_init(&filter->signal_cond);
+  filter->pending_signals = new std::deque<PendingSignal>();
+  filter->pending_partial_result = -1;
+  filter->dispatching_signals = FALSE;
+  filter->binary_results = FALSE;
+  filter->src_caps_pushed = FALSE;
+  filter->speaker_id = g_strdup(DEFAULT_SPEAKER_ID);
+  filter->speaker_cache_size = SpeakerStateCache::kDefaultCapacity;
+  filter->speaker_cache_size_requested = FALSE;
+  filter->profiler = new StageProfiler();
+  filter->decoder_listener = gst_kaldinnet2onlinedecoder_new_listener(filter);
+  filter->stream_decoder = new StreamDecoder(filter->decoder_listener,
+                                             filter->profiler);
   filter->word_syms_filename = g_strdup(DEFAULT_WORD_SYMS);
   filter->phone_syms_filename = g_strdup(DEFAULT_PHONE_SYMS);
   filter->word_boundary_info_filename = g_strdup(DEFAULT_WORD_BOUNDARY_FILE);
@@ -557,6 +832,9 @@ static void gst_kaldinnet2onlinedecoder_init(
   // will be set later
   filter->feature_info = NULL;
   filter->sample_rate = 0;
+  filter->audio_format = GST_AUDIO_FORMAT_S16LE;
+  filter->audio_channels = 1;
+  filter->audio_rate = 0;
   filter->decoding = false;
   filter->lmwt_scale = DEFAULT_LMWT_SCALE;
   filter->inverse_scale = FALSE;
@@ -688,10 +966,43 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
       filter->silent = g_value_get_boolean(value);
       break;
     case PROP_MODEL:
-      gst_kaldinnet2onlinedecoder_load_model(filter, value);
+      gst_kaldinnet2onlinedecoder_schedule_load(filter, prop_id, pspec, value);
       break;
     case PROP_FST:
-      gst_kaldinnet2onlinedecoder_load_fst(filter, value);
+      gst_kaldinnet2onlinedecoder_schedule_load(filter, prop_id, pspec, value);
+      break;
+    case PROP_FST_MMAP:
+      filter->fst_mmap = g_value_get_boolean(value);
+      break;
+    case PROP_ASYNC_MODEL_LOADING:
+      filter->async_model_loading = g_value_get_boolean(value);
+      break;
+    case PROP_RESAMPLE:
+      filter->resample = g_value_get_boolean(value);
+      break;
+    case PROP_MAX_LAG_IN_FRAMES:
+      filter->max_lag_in_frames = g_value_get_uint(value);
+      break;
+    case PROP_MAX_LAG_IN_MS:
+      filter->max_lag_in_ms = g_value_get_uint(value);
+      break;
+    case PROP_NNET3_BATCH_SIZE:
+      filter->nnet3_batch_size = g_value_get_uint(value);
+      break;
+    case PROP_NNET3_BATCH_FRAMES_PER_CHUNK:
+      filter->nnet3_batch_frames_per_chunk = g_value_get_uint(value);
+      break;
+    case PROP_NNET3_BATCH_MAX_WAIT_MS:
+      filter->nnet3_batch_max_wait_ms = g_value_get_uint(value);
+      break;
+    case PROP_BIG_LM_CACHE_MB:
+      filter->big_lm_cache_mb = g_value_get_uint(value);
+      break;
+    case PROP_MAX_PENDING_RESULTS:
+      filter->max_pending_results = g_value_get_uint(value);
+      break;
+    case PROP_ASYNC_SIGNALS:
+      filter->async_signals = g_value_get_boolean(value);
       break;
     case PROP_WORD_SYMS:
       gst_kaldinnet2onlinedecoder_load_word_syms(filter, value);
@@ -718,10 +1029,10 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
       filter->traceback_period_in_secs = g_value_get_float(value);
       break;
     case PROP_LM_FST:
-      gst_kaldinnet2onlinedecoder_load_lm_fst(filter, value);
+      gst_kaldinnet2onlinedecoder_schedule_load(filter, prop_id, pspec, value);
       break;
     case PROP_BIG_LM_CONST_ARPA:
-      gst_kaldinnet2onlinedecoder_load_big_lm(filter, value);
+      gst_kaldinnet2onlinedecoder_schedule_load(filter, prop_id, pspec, value);
       break;
     case PROP_WORD_BOUNDARY_FILE:
       gst_kaldinnet2onlinedecoder_load_word_boundary_info(filter, value);
@@ -785,6 +1096,72 @@ static void gst_kaldinnet2onlinedecoder_set_property(GObject * object,
         }
       }
       break;
+    case PROP_ADAPTATION_STATE_BYTES:
+      {
+        GBytes *bytes = static_cast<GBytes*>(g_value_get_boxed(value));
+        bool read = false;
+        if (bytes != NULL) {
+          try {
+            ReadStateBlob(kAdaptationStateBlob, bytes, filter->adaptation_state);
+            read = true;
+          } catch (std::runtime_error& e) {
+            GST_WARNING_OBJECT(filter, "Failed to read adaptation state from given bytes, resetting instead");
+          }
+        }
+        if (!read) {
+          GST_DEBUG_OBJECT(filter, "Resetting adaptation state");
+          delete filter->adaptation_state;
+          filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
+              filter->feature_info->ivector_extractor_info);
+        }
+      }
+      break;
+    case PROP_CMVN_STATE_BYTES:
+      {
+        GBytes *bytes = static_cast<GBytes*>(g_value_get_boxed(value));
+        bool read = false;
+        if (bytes != NULL) {
+          try {
+            ReadStateBlob(kCmvnStateBlob, bytes, filter->cmvn_state);
+            read = true;
+          } catch (std::runtime_error& e) {
+            GST_WARNING_OBJECT(filter, "Failed to read CMVN state from given bytes, resetting instead");
+          }
+        }
+        if (!read) {
+          GST_DEBUG_OBJECT(filter, "Resetting CMVN state");
+          delete filter->cmvn_state;
+          gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
+        }
+      }
+      break;
+    case PROP_SPEAKER_ID:
+      GST_OBJECT_LOCK(filter);
+      g_free(filter->speaker_id);
+      filter->speaker_id = g_value_get_string(value) != NULL ?
+          g_value_dup_string(value) : g_strdup("");
+      GST_OBJECT_UNLOCK(filter);
+      break;
+    case PROP_SPEAKER_CACHE_SIZE:
+      // The new request is added before the old one is withdrawn, so that
+      // the cache doesn't shrink in between
+      SpeakerStateCache::Instance()->RequestCapacity(g_value_get_uint(value));
+      if (filter->speaker_cache_size_requested) {
+        SpeakerStateCache::Instance()->WithdrawCapacityRequest(filter->speaker_cache_size);
+      }
+      filter->speaker_cache_size = g_value_get_uint(value);
+      filter->speaker_cache_size_requested = TRUE;
+      break;
+    case PROP_SPEAKER_CACHE_DIR: {
+      std::string dir = g_value_get_string(value) != NULL ? g_value_get_string(value) : "";
+      std::string old_dir = SpeakerStateCache::Instance()->SpillDirectory();
+      if (!old_dir.empty() && old_dir != dir) {
+        GST_WARNING_OBJECT(filter, "Changing the speaker cache directory of all decoders from %s to %s",
+                           old_dir.c_str(), dir.c_str());
+      }
+      SpeakerStateCache::Instance()->SetSpillDirectory(dir);
+      break;
+    }
     case PROP_NUM_NBEST:
       filter->num_nbest = g_value_get_uint(value);
       break;
@@ -853,10 +1230,60 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
       g_value_set_boolean(value, filter->silent);
       break;
     case PROP_MODEL:
+      g_mutex_lock(&filter->models_lock);
       g_value_set_string(value, filter->model_rspecifier);
+      g_mutex_unlock(&filter->models_lock);
       break;
     case PROP_FST:
+      g_mutex_lock(&filter->models_lock);
       g_value_set_string(value, filter->fst_rspecifier);
+      g_mutex_unlock(&filter->models_lock);
+      break;
+    case PROP_FST_MMAP:
+      g_value_set_boolean(value, filter->fst_mmap);
+      break;
+    case PROP_ASYNC_MODEL_LOADING:
+      g_value_set_boolean(value, filter->async_model_loading);
+      break;
+    case PROP_RESAMPLE:
+      g_value_set_boolean(value, filter->resample);
+      break;
+    case PROP_MAX_LAG_IN_FRAMES:
+      g_value_set_uint(value, filter->max_lag_in_frames);
+      break;
+    case PROP_MAX_LAG_IN_MS:
+      g_value_set_uint(value, filter->max_lag_in_ms);
+      break;
+    case PROP_NNET3_BATCH_SIZE:
+      g_value_set_uint(value, filter->nnet3_batch_size);
+      break;
+    case PROP_NNET3_BATCH_FRAMES_PER_CHUNK:
+      g_value_set_uint(value, filter->nnet3_batch_frames_per_chunk);
+      break;
+    case PROP_NNET3_BATCH_MAX_WAIT_MS:
+      g_value_set_uint(value, filter->nnet3_batch_max_wait_ms);
+      break;
+    case PROP_BIG_LM_CACHE_MB:
+      g_value_set_uint(value, filter->big_lm_cache_mb);
+      break;
+    case PROP_MAX_PENDING_RESULTS:
+      g_value_set_uint(value, filter->max_pending_results);
+      break;
+    case PROP_ASYNC_SIGNALS:
+      g_value_set_boolean(value, filter->async_signals);
+      break;
+    case PROP_BIG_LM_CACHE_HITS:
+    case PROP_BIG_LM_CACHE_MISSES:
+      {
+        guint64 hits = 0, misses = 0;
+        size_t num_bytes = 0;
+        g_mutex_lock(&filter->models_lock);
+        if (filter->models->big_lm_cache() != NULL) {
+          filter->models->big_lm_cache()->GetStats(&hits, &misses, &num_bytes);
+        }
+        g_mutex_unlock(&filter->models_lock);
+        g_value_set_uint64(value, prop_id == PROP_BIG_LM_CACHE_HITS ? hits : misses);
+      }
       break;
     case PROP_WORD_SYMS:
       g_value_set_string(value, filter->word_syms_filename);
@@ -886,10 +1313,14 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
       g_value_set_float(value, filter->traceback_period_in_secs);
       break;
     case PROP_LM_FST:
+      g_mutex_lock(&filter->models_lock);
       g_value_set_string(value, filter->lm_fst_name);
+      g_mutex_unlock(&filter->models_lock);
       break;
     case PROP_BIG_LM_CONST_ARPA:
+      g_mutex_lock(&filter->models_lock);
       g_value_set_string(value, filter->big_lm_const_arpa_name);
+      g_mutex_unlock(&filter->models_lock);
       break;
     case PROP_USE_THREADED_DECODER:
       g_value_set_boolean(value, filter->use_threaded_decoder);
@@ -912,6 +1343,36 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
           g_value_set_string(value, "");
       }
       break;
+    case PROP_ADAPTATION_STATE_BYTES:
+      if (filter->adaptation_state) {
+        g_value_take_boxed(value, WriteStateBlob(kAdaptationStateBlob,
+                                                 *filter->adaptation_state));
+      } else {
+        g_value_set_boxed(value, NULL);
+      }
+      break;
+    case PROP_CMVN_STATE_BYTES:
+      if (filter->cmvn_state) {
+        g_value_take_boxed(value, WriteStateBlob(kCmvnStateBlob,
+                                                 *filter->cmvn_state));
+      } else {
+        g_value_set_boxed(value, NULL);
+      }
+      break;
+    case PROP_SPEAKER_ID:
+      GST_OBJECT_LOCK(filter);
+      g_value_set_string(value, filter->speaker_id);
+      GST_OBJECT_UNLOCK(filter);
+      break;
+    case PROP_SPEAKER_CACHE_SIZE:
+      g_value_set_uint(value, SpeakerStateCache::Instance()->Capacity());
+      break;
+    case PROP_SPEAKER_CACHE_DIR:
+      g_value_set_string(value, SpeakerStateCache::Instance()->SpillDirectory().c_str());
+      break;
+    case PROP_STATS:
+      g_value_take_boxed(value, gst_kaldinnet2onlinedecoder_stats(filter));
+      break;
     case PROP_NUM_NBEST:
       g_value_set_uint(value, filter->num_nbest);
       break;
@@ -961,719 +1422,335 @@ static void gst_kaldinnet2onlinedecoder_get_property(GObject * object,
   }
 }
 
-static std::vector<PhoneAlignmentInfo> gst_kaldinnet2onlinedecoder_phone_alignment(
-    Gstkaldinnet2onlinedecoder * filter, const std::vector<int32>& alignment, 
-    const CompactLattice &clat) {
-
-  std::vector<PhoneAlignmentInfo> result;
-
-  GST_DEBUG_OBJECT(filter, "Phoneme alignment...");
-
-  // Output the alignment with the weights
-  std::vector<std::vector<int32> > split;
-  SplitToPhones(*filter->trans_model, alignment, &split);
-
-  GST_DEBUG_OBJECT(filter, "Split to phones finished");
-
-  std::vector<int32> phones;
-  for (size_t i = 0; i < split.size(); i++) {
-    KALDI_ASSERT(split[i].size() > 0);
-    phones.push_back(filter->trans_model->TransitionIdToPhone(split[i][0]));
-  }
-  Lattice lat;
-  ConvertLattice(clat, &lat);
-  ConvertLatticeToPhones(*filter->trans_model, &lat);
-  CompactLattice phone_clat;
-  ConvertLattice(lat, &phone_clat);  
-  MinimumBayesRiskOptions mbr_opts;
-  mbr_opts.decode_mbr = false; // we just want confidences
-  mbr_opts.print_silence = false; 
-  MinimumBayesRisk *mbr = new MinimumBayesRisk(phone_clat, phones, mbr_opts);
-  std::vector<BaseFloat> confidences = mbr->GetOneBestConfidences();
-  delete mbr;
-  
-  int32 current_start_frame = 0;
-
-  for (size_t i = 0; i < split.size(); i++) {
-    KALDI_ASSERT(split[i].size() > 0);
-    int32 phone = filter->trans_model->TransitionIdToPhone(split[i][0]);
-
-    PhoneAlignmentInfo alignment_info;
-    alignment_info.phone_id = phone;
-    alignment_info.start_frame = current_start_frame;
-    alignment_info.length_in_frames = split[i].size();
-    if (confidences.size() > 0) {
-      alignment_info.confidence = confidences[i];
-    }
-
-    result.push_back(alignment_info);
-    current_start_frame += split[i].size();
+// Emits a result signal, or with async-signals, queues it for the
+// dispatcher. A partial result replaces the one of the same segment that
+// is still waiting in the queue, so that handlers that fall behind skip
+// stale partial results instead of falling further behind. Partial result
+// deltas are never coalesced, since each one only carries the words that
+// changed since the previous one, but they don't keep partial results from
+// being replaced, so the queue holds at most one partial result per
+// segment.
+static void gst_kaldinnet2onlinedecoder_emit_result(
+    Gstkaldinnet2onlinedecoder * filter, guint signal, const gchar *result) {
+  if (!filter->async_signals) {
+    g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[signal], 0, result);
+    return;
   }
-  return result;
-}
-
-static std::vector<WordAlignmentInfo>  gst_kaldinnet2onlinedecoder_word_alignment(
-    Gstkaldinnet2onlinedecoder * filter, const Lattice &lat,
-    std::vector<int32> &words, CompactLattice &full_clat) {
-  std::vector<WordAlignmentInfo> result;
-  CompactLattice clat, det_lat;
-  
-  CompactLattice aligned_clat;
-
-  ConvertLattice(lat, &clat);
-
-  MinimumBayesRiskOptions mbr_opts;
-  mbr_opts.decode_mbr = false; // we just want confidences
-  mbr_opts.print_silence = false; 
-
-  MinimumBayesRisk mbr = MinimumBayesRisk(full_clat, words, mbr_opts);
-  std::vector<BaseFloat> confidences = mbr.GetOneBestConfidences();
-
-  const std::vector<std::pair<BaseFloat, BaseFloat> > &times = mbr.GetOneBestTimes();
-
-  GST_DEBUG_OBJECT(filter, "Word alignment produced %lu words", words.size());
-  KALDI_ASSERT(words.size() == times.size());
-  int confidence_i = 0;
-  for (size_t i = 0; i < words.size(); i++) {
-    if (words[i] == 0)  {
-      // Don't output anything for <eps> links, which
-      continue; // correspond to silence....
-    }
-    WordAlignmentInfo alignment_info;
-    alignment_info.word_id = words[i];
-    alignment_info.start_frame = times[i].first;
-    alignment_info.length_in_frames = times[i].second - times[i].first;
-    if (confidences.size() > 0) {
-      alignment_info.confidence = confidences[confidence_i++];
+  g_mutex_lock(&filter->signal_lock);
+  std::deque<PendingSignal> &pending_signals = *filter->pending_signals;
+  if (signal == PARTIAL_RESULT_SIGNAL && filter->pending_partial_result >= 0) {
+    GST_DEBUG_OBJECT(filter, "Dropping a stale partial result");
+    pending_signals[filter->pending_partial_result].result = result;
+  } else {
+    pending_signals.push_back(PendingSignal());
+    pending_signals.back().signal = signal;
+    pending_signals.back().result = result;
+    if (signal == PARTIAL_RESULT_SIGNAL) {
+      filter->pending_partial_result = pending_signals.size() - 1;
+    } else if (signal != PARTIAL_RESULT_DELTA_SIGNAL) {
+      // The partial results of the next segment must come after this
+      filter->pending_partial_result = -1;
     }
-    result.push_back(alignment_info);
   }
-  return result;
-}
-
-static void gst_kaldinnet2onlinedecoder_scale_lattice(
-        Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat) {
-  if (filter->inverse_scale) {
-    BaseFloat inv_acoustic_scale = 1.0;
-    if (filter->nnet_mode == NNET2) {
-      if (filter->use_threaded_decoder) {
-        inv_acoustic_scale = 1.0 / filter->
-            nnet2_decoding_threaded_config->acoustic_scale;
-      } else {
-        inv_acoustic_scale = 1.0 / filter->nnet2_decoding_config->
-            decodable_opts.acoustic_scale;
-      }
-    } else {
-      inv_acoustic_scale = 1.0 / filter->nnet3_decodable_opts->acoustic_scale;
-    }
-
-    fst::ScaleLattice(fst::AcousticLatticeScale(inv_acoustic_scale), &clat);
+  if (!filter->dispatching_signals) {
+    filter->dispatching_signals = TRUE;
+    g_thread_pool_push(filter->signal_pool, filter, NULL);
   }
-
-  fst::ScaleLattice(fst::LatticeScale(filter->lmwt_scale, 1.0), &clat);
+  g_mutex_unlock(&filter->signal_lock);
 }
 
-static std::string gst_kaldinnet2onlinedecoder_words_to_string(
-    Gstkaldinnet2onlinedecoder *filter, const std::vector<int32> &words) {
-  std::stringstream sentence;
-  for (size_t i = 0; i < words.size(); i++) {
-    std::string s = filter->word_syms->Find(words[i]);
-    if (s == "")
-      GST_ERROR_OBJECT(filter, "Word-id %d not in symbol table.", words[i]);
-    if (i > 0) {
-      sentence << " ";
+static void gst_kaldinnet2onlinedecoder_dispatch_signals(gpointer data,
+                                                         gpointer user_data) {
+  Gstkaldinnet2onlinedecoder *filter = static_cast<Gstkaldinnet2onlinedecoder*>(data);
+  PendingSignal pending_signal;
+  g_mutex_lock(&filter->signal_lock);
+  while (!filter->pending_signals->empty()) {
+    pending_signal.signal = filter->pending_signals->front().signal;
+    pending_signal.result.swap(filter->pending_signals->front().result);
+    filter->pending_signals->pop_front();
+    if (filter->pending_partial_result >= 0) {
+      filter->pending_partial_result--;
     }
-    sentence << s;
+    g_mutex_unlock(&filter->signal_lock);
+    g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[pending_signal.signal], 0,
+                  pending_signal.result.c_str());
+    g_mutex_lock(&filter->signal_lock);
   }
-  return sentence.str();
+  filter->dispatching_signals = FALSE;
+  g_cond_broadcast(&filter->signal_cond);
+  g_mutex_unlock(&filter->signal_lock);
 }
 
-
-static std::string gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(
-    Gstkaldinnet2onlinedecoder *filter, const std::vector<WordInHypothesis> &words) {
-  std::vector<int32> word_ids;
-  for (size_t i = 0; i < words.size(); i++) {
-    word_ids.push_back(words[i].word_id);
+// Waits until the queued result signals have been emitted
+static void gst_kaldinnet2onlinedecoder_wait_for_signals(
+    Gstkaldinnet2onlinedecoder * filter) {
+  g_mutex_lock(&filter->signal_lock);
+  while (filter->dispatching_signals) {
+    g_cond_wait(&filter->signal_cond, &filter->signal_lock);
   }
-  return gst_kaldinnet2onlinedecoder_words_to_string(filter, word_ids);
+  g_mutex_unlock(&filter->signal_lock);
 }
 
-static std::vector<NBestResult> gst_kaldinnet2onlinedecoder_nbest_results(
-    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat) {
-
-  std::vector<NBestResult> nbest_results;
-
-  // FIXME: is it needed?
-  //gst_kaldinnet2onlinedecoder_scale_lattice(filter, clat);
-
-  if (filter->word_boundary_info) {
-    CompactLattice aligned_clat;
-    if (WordAlignLattice(clat, *(filter->trans_model), *(filter->word_boundary_info), 0, &aligned_clat)) {
-      clat = aligned_clat;
-    }
-  }
-  
-  Lattice lat;
-  ConvertLattice(clat, &lat);
-
-  std::vector<Lattice> nbest_lats; // one lattice per path
-  {
-    Lattice nbest_lat; // one lattice with all best paths, temporary
-    fst::ShortestPath(lat, &nbest_lat, filter->num_nbest);
-    fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+// Returns the full final result as a buffer in the binary format of
+// kaldi-result.h, for downstream elements that accept it
+static GstBuffer *gst_kaldinnet2onlinedecoder_full_final_result_to_buffer(
+    Gstkaldinnet2onlinedecoder * filter, const SegmentResult &result) {
+  const std::vector<NBestResult> &nbest_results = result.nbest_results;
+  BaseFloat frame_shift = result.frame_shift;
+
+  gsize size = sizeof(KaldiResultHeader);
+  for (size_t i = 0; i < nbest_results.size(); i++) {
+    size_t num_words = nbest_results[i].word_alignment.size() > 0 ?
+        nbest_results[i].word_alignment.size() : nbest_results[i].words.size();
+    size += sizeof(KaldiResultHypothesis)
+        + (num_words + nbest_results[i].phone_alignment.size()) * sizeof(KaldiResultToken);
   }
-
-  for (size_t i=0; i < nbest_lats.size(); i++) {
-    std::vector<int32> words;
-    std::vector<int32> alignment;
-    LatticeWeight weight;
-    GetLinearSymbolSequence(nbest_lats[i], &alignment, &words, &weight);
-
-    NBestResult nbest_result;
-    nbest_result.likelihood = -(weight.Value1() + weight.Value2());
-    nbest_result.num_frames = alignment.size();
-    for (size_t j=0; j < words.size(); j++) {
-      WordInHypothesis word_in_hyp;
-      word_in_hyp.word_id = words[j];
-      nbest_result.words.push_back(word_in_hyp);
-    }
-    if (filter->do_phone_alignment) {
-      if (i < filter->num_phone_alignment) {
-        nbest_result.phone_alignment =
-            gst_kaldinnet2onlinedecoder_phone_alignment(filter, alignment, clat);
+  GstBuffer *buffer = gst_buffer_new_and_alloc(size);
+  GstMapInfo map;
+  gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+  guint8 *data = map.data;
+
+  KaldiResultHeader *header = reinterpret_cast<KaldiResultHeader*>(data);
+  header->magic = KALDI_RESULT_MAGIC;
+  header->version = KALDI_RESULT_VERSION;
+  header->flags = KALDI_RESULT_FINAL;
+  header->num_hypotheses = nbest_results.size();
+  header->segment_start = result.segment_start;
+  header->segment_length = result.segment_length;
+  header->total_length = result.total_length;
+  data += sizeof(KaldiResultHeader);
+
+  for (size_t i = 0; i < nbest_results.size(); i++) {
+    const NBestResult &nbest_result = nbest_results[i];
+    KaldiResultHypothesis *hyp = reinterpret_cast<KaldiResultHypothesis*>(data);
+    data += sizeof(KaldiResultHypothesis);
+    hyp->flags = 0;
+    hyp->likelihood = nbest_result.likelihood;
+    if (nbest_result.word_alignment.size() > 0) {
+      hyp->flags |= KALDI_RESULT_WORD_ALIGNMENT;
+      hyp->num_words = nbest_result.word_alignment.size();
+      for (size_t j = 0; j < nbest_result.word_alignment.size(); j++) {
+        const WordAlignmentInfo &alignment_info = nbest_result.word_alignment[j];
+        KaldiResultToken *token = reinterpret_cast<KaldiResultToken*>(data);
+        token->id = alignment_info.word_id;
+        token->start = alignment_info.start_frame * frame_shift;
+        token->length = alignment_info.length_in_frames * frame_shift;
+        token->confidence = alignment_info.confidence;
+        data += sizeof(KaldiResultToken);
+      }
+    } else {
+      hyp->num_words = nbest_result.words.size();
+      for (size_t j = 0; j < nbest_result.words.size(); j++) {
+        KaldiResultToken *token = reinterpret_cast<KaldiResultToken*>(data);
+        token->id = nbest_result.words[j].word_id;
+        token->start = 0.0;
+        token->length = 0.0;
+        token->confidence = 0.0;
+        data += sizeof(KaldiResultToken);
       }
     }
-    if (filter->word_boundary_info) {
-      nbest_result.word_alignment = gst_kaldinnet2onlinedecoder_word_alignment(filter, nbest_lats[i], words, clat);
+    hyp->num_phones = nbest_result.phone_alignment.size();
+    for (size_t j = 0; j < nbest_result.phone_alignment.size(); j++) {
+      const PhoneAlignmentInfo &alignment_info = nbest_result.phone_alignment[j];
+      KaldiResultToken *token = reinterpret_cast<KaldiResultToken*>(data);
+      token->id = alignment_info.phone_id;
+      token->start = alignment_info.start_frame * frame_shift;
+      token->length = alignment_info.length_in_frames * frame_shift;
+      token->confidence = alignment_info.confidence;
+      data += sizeof(KaldiResultToken);
     }
-    nbest_results.push_back(nbest_result);
   }
-  return nbest_results;
-}
-
-static std::string gst_kaldinnet2onlinedecoder_full_final_result_to_json(
-    Gstkaldinnet2onlinedecoder * filter,
-    const FullFinalResult &full_final_result) {
-
-  json_t *root = json_object();
-  json_t *result_json_object = json_object();
-  json_object_set_new( root, "status", json_integer(0));
-
-  json_object_set_new( root, "result", result_json_object);
-
-  json_object_set_new( result_json_object, "final", json_true());
-
-  if (full_final_result.nbest_results.size() > 0) {
-    BaseFloat frame_shift = filter->feature_info->FrameShiftInSeconds();
-    if (filter->nnet_mode == NNET3) {
-      frame_shift *= filter->nnet3_decodable_opts->frame_subsampling_factor;
-    }
-    json_object_set_new(root, "segment-start",  json_real(filter->segment_start_time));
-
-    json_object_set_new(root, "segment-length",  json_real(full_final_result.nbest_results[0].num_frames * frame_shift));
-    json_object_set_new(root, "total-length",  json_real(filter->total_time_decoded));
-    json_t *nbest_json_arr = json_array();
-    for(std::vector<NBestResult>::const_iterator it = full_final_result.nbest_results.begin();
-        it != full_final_result.nbest_results.end(); ++it) {
-      NBestResult nbest_result = *it;
-      json_t *nbest_result_json_object = json_object();
-      json_object_set_new(nbest_result_json_object, "transcript",
-                          json_string(gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(filter, nbest_result.words).c_str()));
-      json_object_set_new(nbest_result_json_object, "likelihood",  json_real(nbest_result.likelihood));
-      json_array_append( nbest_json_arr, nbest_result_json_object );
-      if (nbest_result.phone_alignment.size() > 0) {
-        if (strcmp(filter->phone_syms_filename, "") == 0) {
-          GST_ERROR_OBJECT(filter, "Phoneme symbol table filename (phone-syms) must be set to output phone alignment.");
-        } else if (filter->phone_syms == NULL) {
-          GST_ERROR_OBJECT(filter, "Phoneme symbol table wasn't loaded correctly. Not outputting alignment.");
-        } else {
-          json_t *phone_alignment_json_arr = json_array();
-          for (size_t j = 0; j < nbest_result.phone_alignment.size(); j++) {
-            PhoneAlignmentInfo alignment_info = nbest_result.phone_alignment[j];
-            json_t *alignment_info_json_object = json_object();
-            std::string phone = filter->phone_syms->Find(alignment_info.phone_id);
-            json_object_set_new(alignment_info_json_object, "phone",
-                                json_string(phone.c_str()));
-            json_object_set_new(alignment_info_json_object, "start",
-                                json_real(alignment_info.start_frame * frame_shift));
-            json_object_set_new(alignment_info_json_object, "length",
-                                json_real(alignment_info.length_in_frames * frame_shift));
-            json_object_set_new(alignment_info_json_object, "confidence",
-                                json_real(alignment_info.confidence));
-            json_array_append(phone_alignment_json_arr, alignment_info_json_object);
-          }
-          json_object_set_new(nbest_result_json_object, "phone-alignment", phone_alignment_json_arr);
-        }
-      }
-      if (nbest_result.word_alignment.size() > 0) {
-        json_t *word_alignment_json_arr = json_array();
-        for (size_t j = 0; j < nbest_result.word_alignment.size(); j++) {
-          WordAlignmentInfo alignment_info = nbest_result.word_alignment[j];
-          json_t *alignment_info_json_object = json_object();
-          std::string word = filter->word_syms->Find(alignment_info.word_id);
-          json_object_set_new(alignment_info_json_object, "word",
-                              json_string(word.c_str()));
-          json_object_set_new(alignment_info_json_object, "start",
-                              json_real(alignment_info.start_frame * frame_shift));
-          json_object_set_new(alignment_info_json_object, "length",
-                              json_real(alignment_info.length_in_frames * frame_shift));
-          json_object_set_new(alignment_info_json_object, "confidence",
-                              json_real(alignment_info.confidence));
-          json_array_append(word_alignment_json_arr, alignment_info_json_object);
-        }
-        json_object_set_new(nbest_result_json_object, "word-alignment", word_alignment_json_arr);
-      }
-
-    }
-
-    json_object_set_new(result_json_object, "hypotheses", nbest_json_arr);
+  gst_buffer_unmap(buffer, &map);
+
+  GstClockTime stream_start_pts = filter->audio_source->StartTimestamp();
+  if (GST_CLOCK_TIME_IS_VALID(stream_start_pts)) {
+    GST_BUFFER_PTS(buffer) = stream_start_pts + result.segment_start * GST_SECOND;
+    GST_BUFFER_DURATION(buffer) = result.segment_length * GST_SECOND;
+    gst_buffer_add_kaldi_result_meta(buffer, GST_BUFFER_PTS(buffer),
+                                     GST_BUFFER_DURATION(buffer));
   }
-
-  char *ret_strings = json_dumps(root, JSON_REAL_PRECISION(6));
-
-  json_decref(root);
-  std::string result;
-  result = ret_strings;
-  return result;
+  return buffer;
 }
 
-static void gst_kaldinnet2onlinedecoder_final_result(
-    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat,
-    guint *num_words) {
-  if (clat.NumStates() == 0) {
-    KALDI_WARN<< "Empty lattice.";
-    return;
-  }
-
-  gst_kaldinnet2onlinedecoder_scale_lattice(filter, clat);
-
-  FullFinalResult full_final_result;
-  GST_DEBUG_OBJECT(filter, "Decoding n-best results");
-  full_final_result.nbest_results = gst_kaldinnet2onlinedecoder_nbest_results(filter, clat);
-
-  if (full_final_result.nbest_results.size() > 0) {
-    std::string best_transcript = gst_kaldinnet2onlinedecoder_words_in_hyp_to_string(filter, full_final_result.nbest_results[0].words);
-
-    GST_DEBUG_OBJECT(filter, "Likelihood per frame is %f over %d frames",
-        full_final_result.nbest_results[0].likelihood/full_final_result.nbest_results[0].num_frames , full_final_result.nbest_results[0].num_frames);
-    GST_DEBUG_OBJECT(filter, "Final: %s", best_transcript.c_str());
-    guint hyp_length = best_transcript.length();
-    *num_words = full_final_result.nbest_results[0].words.size();
-
-    if (hyp_length > 0) {
-      GstBuffer *buffer = gst_buffer_new_and_alloc(hyp_length + 1);
-      gst_buffer_fill(buffer, 0, best_transcript.c_str(), hyp_length);
-      gst_buffer_memset(buffer, hyp_length, '\n', 1);
-      gst_pad_push(filter->srcpad, buffer);
-
-      /* Emit a signal for applications. */
-      g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FINAL_RESULT_SIGNAL], 0, best_transcript.c_str());
-
-      std::string full_final_result_as_json =
-          gst_kaldinnet2onlinedecoder_full_final_result_to_json(filter, full_final_result);
-      GST_DEBUG_OBJECT(filter, "Final JSON: %s", full_final_result_as_json.c_str());
-      g_signal_emit(filter, gst_kaldinnet2onlinedecoder_signals[FULL_FINAL_RESULT_SIGNAL], 0, full_final_result_as_json.c_str());
+// Posts the kaldi-segment-stats message of a segment whose results have
+// been produced
+static void gst_kaldinnet2onlinedecoder_post_segment_stats(
+    Gstkaldinnet2onlinedecoder * filter, const SegmentStats &stats) {
+  double latency = 1.0 * (g_get_monotonic_time() - stats.end_time) / G_USEC_PER_SEC;
+  double processing_time = stats.feature_time + stats.nnet_time + stats.search_time
+      + stats.lattice_time + stats.rescore_time + stats.nbest_time + stats.json_time;
+  double active_tokens = stats.num_active_token_samples > 0 ?
+      1.0 * stats.total_active_tokens / stats.num_active_token_samples : 0.0;
+  gst_element_post_message(
+      GST_ELEMENT(filter),
+      gst_message_new_element(
+          GST_OBJECT(filter),
+          gst_structure_new("kaldi-segment-stats",
+                            "segment-start", G_TYPE_DOUBLE, (gdouble) stats.segment_start,
+                            "audio-duration", G_TYPE_DOUBLE, stats.audio_duration,
+                            "feature-time", G_TYPE_DOUBLE, stats.feature_time,
+                            "nnet-time", G_TYPE_DOUBLE, stats.nnet_time,
+                            "search-time", G_TYPE_DOUBLE, stats.search_time,
+                            "lattice-time", G_TYPE_DOUBLE, stats.lattice_time,
+                            "rescore-time", G_TYPE_DOUBLE, stats.rescore_time,
+                            "nbest-time", G_TYPE_DOUBLE, stats.nbest_time,
+                            "json-time", G_TYPE_DOUBLE, stats.json_time,
+                            "frames-decoded", G_TYPE_INT, stats.num_frames,
+                            "active-tokens", G_TYPE_DOUBLE, active_tokens,
+                            "final-result-latency", G_TYPE_DOUBLE, latency,
+                            "real-time-factor", G_TYPE_DOUBLE,
+                            stats.audio_duration > 0 ? processing_time / stats.audio_duration : 0.0,
+                            NULL)));
+}
 
-    }
+// Passes the results of the stream decoder on as buffers, signals and
+// messages
+class GstDecoderListener : public StreamDecoderListener {
+ public:
+  explicit GstDecoderListener(Gstkaldinnet2onlinedecoder *filter)
+      : filter_(filter) { }
+
+  virtual ModelSet *AcquireModels() {
+    g_mutex_lock(&filter_->models_lock);
+    ModelSet *models = filter_->models;
+    models->Ref();
+    g_mutex_unlock(&filter_->models_lock);
+    return models;
   }
-}
 
-static void gst_kaldinnet2onlinedecoder_partial_result(
-    Gstkaldinnet2onlinedecoder * filter, const Lattice lat) {
-  std::vector<int32> words;
-  std::vector<int32> alignment;
-  LatticeWeight weight;
-  GetLinearSymbolSequence(lat, &alignment, &words, &weight);
-  std::string transcript = gst_kaldinnet2onlinedecoder_words_to_string(filter, words);
-  GST_DEBUG_OBJECT(filter, "Partial: %s", transcript.c_str());
-  if (transcript.length() > 0) {
+  virtual void PartialResult(const std::string &transcript) {
+    GST_DEBUG_OBJECT(filter_, "Partial: %s", transcript.c_str());
     /* Emit a signal for applications. */
-    g_signal_emit(filter,
-                  gst_kaldinnet2onlinedecoder_signals[PARTIAL_RESULT_SIGNAL], 0,
-                  transcript.c_str());
+    gst_kaldinnet2onlinedecoder_emit_result(filter_, PARTIAL_RESULT_SIGNAL,
+                                            transcript.c_str());
   }
-}
 
-static bool gst_kaldinnet2onlinedecoder_rescore_big_lm(
-    Gstkaldinnet2onlinedecoder * filter, CompactLattice &clat, CompactLattice &result_lat) {
-
-  Lattice tmp_lattice;
-  ConvertLattice(clat, &tmp_lattice);
-  // Before composing with the LM FST, we scale the lattice weights
-  // by the inverse of "lm_scale".  We'll later scale by "lm_scale".
-  // We do it this way so we can determinize and it will give the
-  // right effect (taking the "best path" through the LM) regardless
-  // of the sign of lm_scale.
-  fst::ScaleLattice(fst::GraphLatticeScale(-1.0), &tmp_lattice);
-  ArcSort(&tmp_lattice, fst::OLabelCompare<LatticeArc>());
-
-  Lattice composed_lat;
-  // Could just do, more simply: Compose(lat, lm_fst, &composed_lat);
-  // and not have lm_compose_cache at all.
-  // The command below is faster, though; it's constant not
-  // logarithmic in vocab size.
-
-  TableCompose(tmp_lattice, *(filter->lm_fst), &composed_lat, filter->lm_compose_cache);
-
-  Invert(&composed_lat); // make it so word labels are on the input.
-  CompactLattice determinized_lat;
-  DeterminizeLattice(composed_lat, &determinized_lat);
-  fst::ScaleLattice(fst::GraphLatticeScale(-1.0), &determinized_lat);
-  if (determinized_lat.Start() == fst::kNoStateId) {
-    GST_INFO_OBJECT(filter, "Empty lattice (incompatible LM?)");
-    return false;
-  } else {
-    fst::ScaleLattice(fst::GraphLatticeScale(1.0), &determinized_lat);
-    ArcSort(&determinized_lat, fst::OLabelCompare<CompactLatticeArc>());
-
-    // Wraps the ConstArpaLm format language model into FST. We re-create it
-    // for each lattice to prevent memory usage increasing with time.
-    ConstArpaLmDeterministicFst const_arpa_fst(*(filter->big_lm_const_arpa));
-
-    // Composes lattice with language model.
-    CompactLattice composed_clat;
-    ComposeCompactLatticeDeterministic(determinized_lat,
-                                       &const_arpa_fst, &composed_clat);
-
-    // Determinizes the composed lattice.
-    Lattice composed_lat;
-    ConvertLattice(composed_clat, &composed_lat);
-    Invert(&composed_lat);
-    DeterminizeLattice(composed_lat, &result_lat);
-    fst::ScaleLattice(fst::GraphLatticeScale(1.0), &result_lat);
-    if (result_lat.Start() == fst::kNoStateId) {
-      GST_INFO_OBJECT(filter, "Empty lattice (incompatible LM?)");
-      return false;
-    }
+  virtual bool WantsPartialResultDelta() {
+    return HasHandler(PARTIAL_RESULT_DELTA_SIGNAL);
   }
-  return true;
-}
-
-static void gst_kaldinnet2onlinedecoder_threaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                      bool &more_data,
-                                                      int32 chunk_length,
-                                                      BaseFloat traceback_period_secs,
-                                                      Vector<BaseFloat> *remaining_wave_part) {
-    SingleUtteranceNnet2DecoderThreaded decoder(*(filter->nnet2_decoding_threaded_config),
-                                        *(filter->trans_model), 
-                                        *(filter->am_nnet2),
-                                        *(filter->decode_fst),
-                                        *(filter->feature_info),
-                                        *(filter->adaptation_state),
-                                        *(filter->cmvn_state));
-
-    Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-    GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                     wave_part.Dim());
-    BaseFloat last_traceback = 0.0;
-    BaseFloat num_seconds_decoded = 0.0;
-    if (remaining_wave_part->Dim() > 0) {
-      GST_DEBUG_OBJECT(filter, "Submitting remaining wave of size %d", remaining_wave_part->Dim());
-      decoder.AcceptWaveform(filter->sample_rate, *remaining_wave_part);
-      filter->total_time_decoded += 1.0 * remaining_wave_part->Dim() / filter->sample_rate;
-      while (decoder.NumFramesReceivedApprox() - decoder.NumFramesDecoded() > 100) {
-        Sleep(0.1);
-      }
-    }
-    while (true) {
-      more_data = filter->audio_source->Read(&wave_part);
-      GST_DEBUG_OBJECT(filter, "Submitting wave of size: %d", wave_part.Dim());
-      decoder.AcceptWaveform(filter->sample_rate, wave_part);
-      filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      if (!more_data) {
-        decoder.InputFinished();
-        break;
-      }
-
-      if (filter->do_endpointing) {
-        GST_DEBUG_OBJECT(filter, "Before the sleep check: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
-                         decoder.NumFramesReceivedApprox(),
-                         decoder.NumFramesDecoded(),
-                         decoder.NumWaveformPiecesPending());
 
-        // Wait until there are less than one second of frames left to decode
-        // Depends of the frame shift, but one second is also selected arbitrarily
-        while (decoder.NumFramesReceivedApprox() - decoder.NumFramesDecoded() > 100) {
-          Sleep(0.1);
-        }
-
-        GST_DEBUG_OBJECT(filter, "After the sleep check: Frames received: ~ %d, frames decoded: %d, pieces pending: %d",
-                         decoder.NumFramesReceivedApprox(),
-                         decoder.NumFramesDecoded(),
-                         decoder.NumWaveformPiecesPending());
-
-        if ((decoder.NumFramesDecoded() > 0)
-            && decoder.EndpointDetected(*(filter->endpoint_config))) {
-          decoder.TerminateDecoding();
-          GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-          break;
-        }
-      }
-      num_seconds_decoded += filter->chunk_length_in_secs;
-      if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-          && (decoder.NumFramesDecoded() > 0)) {
-        Lattice lat;
-        decoder.GetBestPath(false, &lat, NULL);
-        gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-        last_traceback += traceback_period_secs;
-      }
-    }
+  virtual void PartialResultDelta(const std::string &json) {
+    gst_kaldinnet2onlinedecoder_emit_result(filter_, PARTIAL_RESULT_DELTA_SIGNAL,
+                                            json.c_str());
+  }
 
-    decoder.Wait();
-
-    decoder.GetRemainingWaveform(remaining_wave_part);
-    GST_DEBUG_OBJECT(filter, "Remaining waveform size: %d", remaining_wave_part->Dim());
-    filter->total_time_decoded -= 1.0 * remaining_wave_part->Dim() / filter->sample_rate;
-
-    if (num_seconds_decoded > 0.1) {
-      GST_DEBUG_OBJECT(filter, "Getting lattice..");
-      decoder.FinalizeDecoding();
-      CompactLattice clat;
-      bool end_of_utterance = true;
-      decoder.GetLattice(end_of_utterance, &clat, NULL);
-      GST_DEBUG_OBJECT(filter, "Lattice done");
-      if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
-        }
-      }
+  virtual bool WantsResultJson() {
+    return HasHandler(FULL_FINAL_RESULT_SIGNAL);
+  }
 
-      guint num_words = 0;
-      gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-      if (num_words >= filter->min_words_for_ivector) {
-        // Only update adaptation state if the utterance contained enough words
-        decoder.GetAdaptationState(filter->adaptation_state);
-      }
+  virtual void FinalResult(const SegmentResult &result) {
+    GST_DEBUG_OBJECT(filter_, "Final: %s", result.transcript.c_str());
+    if (filter_->binary_results) {
+      gst_pad_push(filter_->srcpad,
+                   gst_kaldinnet2onlinedecoder_full_final_result_to_buffer(filter_, result));
     } else {
-      GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
-    }
-
-}
-
-static void gst_kaldinnet2onlinedecoder_unthreaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                        bool &more_data,
-                                                        int32 chunk_length,
-                                                        BaseFloat traceback_period_secs) {
-
-  OnlineNnet2FeaturePipeline feature_pipeline(*(filter->feature_info));
-  feature_pipeline.SetAdaptationState(*(filter->adaptation_state));
-  SingleUtteranceNnet2Decoder decoder(*(filter->nnet2_decoding_config),
-                                      *(filter->trans_model), 
-                                      *(filter->am_nnet2),
-                                      *(filter->decode_fst),
-                                      &feature_pipeline);
-  OnlineSilenceWeighting silence_weighting(*(filter->trans_model),
-          *(filter->silence_weighting_config));
-
-  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-  std::vector<std::pair<int32, BaseFloat> > delta_weights;
-  GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                   wave_part.Dim());
-  BaseFloat last_traceback = 0.0;
-  BaseFloat num_seconds_decoded = 0.0;
-  while (true) {
-    more_data = filter->audio_source->Read(&wave_part);
-
-    feature_pipeline.AcceptWaveform(filter->sample_rate, wave_part);
-    if (!more_data) {
-      feature_pipeline.InputFinished();
-    }
-
-    if (silence_weighting.Active() && 
-        feature_pipeline.IvectorFeature() != NULL) {
-      silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
-      silence_weighting.GetDeltaWeights(feature_pipeline.IvectorFeature()->NumFramesReady(), 0,
-                                        &delta_weights);
-      feature_pipeline.IvectorFeature()->UpdateFrameWeights(delta_weights);
-    }
-
-    decoder.AdvanceDecoding();
-    GST_DEBUG_OBJECT(filter, "%d frames decoded", decoder.NumFramesDecoded());
-    num_seconds_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-    filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-    GST_DEBUG_OBJECT(filter, "Total amount of audio processed: %f seconds", filter->total_time_decoded);
-    if (!more_data) {
-      break;
-    }
-    if (filter->do_endpointing
-        && (decoder.NumFramesDecoded() > 0)
-        && decoder.EndpointDetected(*(filter->endpoint_config))) {
-      GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-      break;
+      guint hyp_length = result.transcript.length();
+      GstBuffer *buffer = gst_buffer_new_and_alloc(hyp_length + 1);
+      gst_buffer_fill(buffer, 0, result.transcript.c_str(), hyp_length);
+      gst_buffer_memset(buffer, hyp_length, '\n', 1);
+      gst_pad_push(filter_->srcpad, buffer);
     }
 
-    if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-        && (decoder.NumFramesDecoded() > 0)) {
-      Lattice lat;
-      decoder.GetBestPath(false, &lat);
-      gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-      last_traceback += traceback_period_secs;
+    /* Emit a signal for applications. */
+    gst_kaldinnet2onlinedecoder_emit_result(filter_, FINAL_RESULT_SIGNAL,
+                                            result.transcript.c_str());
+    if (result.json != NULL) {
+      GST_DEBUG_OBJECT(filter_, "Final JSON: %s", result.json);
+      gst_kaldinnet2onlinedecoder_emit_result(filter_, FULL_FINAL_RESULT_SIGNAL,
+                                              result.json);
     }
   }
 
-  if (num_seconds_decoded > 0.1) {
-    GST_DEBUG_OBJECT(filter, "Getting lattice..");
-    decoder.FinalizeDecoding();
-    CompactLattice clat;
-    bool end_of_utterance = true;
-    decoder.GetLattice(end_of_utterance, &clat);
-    GST_DEBUG_OBJECT(filter, "Lattice done");
-    if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-      GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-      CompactLattice rescored_lat;
-      if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-        clat = rescored_lat;
-      }
-    }
-
-    guint num_words = 0;
-    gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-    if (num_words >= filter->min_words_for_ivector) {
-      // Only update adaptation state if the utterance contained enough words
-      feature_pipeline.GetAdaptationState(filter->adaptation_state);
-      feature_pipeline.GetCmvnState(filter->cmvn_state);
-    }
-  } else {
-    GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
+  virtual void SegmentDone(const SegmentStats &stats) {
+    gst_kaldinnet2onlinedecoder_post_segment_stats(filter_, stats);
   }
-}
-
-// for nnet3, we keep this duplication to allow nnet3 specific changes
-static void gst_kaldinnet2onlinedecoder_nnet3_unthreaded_decode_segment(Gstkaldinnet2onlinedecoder * filter,
-                                                        bool &more_data,
-                                                        int32 chunk_length,
-                                                        BaseFloat traceback_period_secs) {
-
-  OnlineNnet2FeaturePipeline feature_pipeline(*(filter->feature_info));
-  feature_pipeline.SetAdaptationState(*(filter->adaptation_state));
-  feature_pipeline.SetCmvnState(*(filter->cmvn_state));
-  SingleUtteranceNnet3Decoder decoder(*(filter->decoder_opts),
-                                      *(filter->trans_model), 
-                                      *(filter->decodable_info_nnet3),
-                                      *(filter->decode_fst),
-                                      &feature_pipeline);
-  
-  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length);
-  GST_DEBUG_OBJECT(filter, "Reading audio in %d sample chunks...",
-                wave_part.Dim());
-  
-  int32 frame_offset = 0;
-
-  int32 frame_subsampling_factor = filter->nnet3_decodable_opts->frame_subsampling_factor;
-  BaseFloat frame_shift = filter->feature_info->FrameShiftInSeconds();
-
-  while (more_data) {
-    decoder.InitDecoding(frame_offset);
-    OnlineSilenceWeighting silence_weighting(*(filter->trans_model),
-          *(filter->silence_weighting_config), 
-          frame_subsampling_factor);
-    std::vector<std::pair<int32, BaseFloat> > delta_weights;
 
-    BaseFloat last_traceback = 0.0;
-    BaseFloat num_seconds_decoded = 0.0;
-
-    while (true) {
-
-      more_data = filter->audio_source->Read(&wave_part);
-
-      feature_pipeline.AcceptWaveform(filter->sample_rate, wave_part);
-      if (!more_data) {
-        feature_pipeline.InputFinished();
-      }
-
-      if (silence_weighting.Active() && 
-          feature_pipeline.IvectorFeature() != NULL) {
-        silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
-        silence_weighting.GetDeltaWeights(feature_pipeline.NumFramesReady(), 
-                                          frame_offset * frame_subsampling_factor,
-                                          &delta_weights);
-        feature_pipeline.UpdateFrameWeights(delta_weights);
-      }
-
-      decoder.AdvanceDecoding();
-      GST_DEBUG_OBJECT(filter, "%d frames decoded", decoder.NumFramesDecoded());
-      num_seconds_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      filter->total_time_decoded += 1.0 * wave_part.Dim() / filter->sample_rate;
-      GST_DEBUG_OBJECT(filter, "Total amount of audio processed: %f seconds", filter->total_time_decoded);
-      if (!more_data) {
-        break;
-      }
-      if (filter->do_endpointing
-          && (decoder.NumFramesDecoded() > 0)
-          && decoder.EndpointDetected(*(filter->endpoint_config))) {
-        GST_DEBUG_OBJECT(filter, "Endpoint detected!");
-        break;
-      }
+ private:
+  bool HasHandler(guint signal) {
+    return g_signal_has_handler_pending(filter_,
+                                        gst_kaldinnet2onlinedecoder_signals[signal],
+                                        0, FALSE);
+  }
 
-      if ((num_seconds_decoded - last_traceback > traceback_period_secs)
-          && (decoder.NumFramesDecoded() > 0)) {
-        Lattice lat;
-        decoder.GetBestPath(false, &lat);
-        gst_kaldinnet2onlinedecoder_partial_result(filter, lat);
-        last_traceback += traceback_period_secs;
-      }
-    }
+  Gstkaldinnet2onlinedecoder *filter_;
+};
 
-    if (num_seconds_decoded > 0.1) {
-      GST_DEBUG_OBJECT(filter, "Getting lattice..");
-      decoder.FinalizeDecoding();
-      frame_offset += decoder.NumFramesDecoded();
-      CompactLattice clat;
-      bool end_of_utterance = true;
-      decoder.GetLattice(end_of_utterance, &clat);
-      GST_DEBUG_OBJECT(filter, "Lattice done");
-      if ((filter->lm_fst != NULL) && (filter->big_lm_const_arpa != NULL)) {
-        GST_DEBUG_OBJECT(filter, "Rescoring lattice with a big LM");
-        CompactLattice rescored_lat;
-        if (gst_kaldinnet2onlinedecoder_rescore_big_lm(filter, clat, rescored_lat)) {
-          clat = rescored_lat;
-        }
-      }
+static StreamDecoderListener *gst_kaldinnet2onlinedecoder_new_listener(
+    Gstkaldinnet2onlinedecoder * filter) {
+  return new GstDecoderListener(filter);
+}
 
-      guint num_words = 0;
-      gst_kaldinnet2onlinedecoder_final_result(filter, clat, &num_words);
-      if (num_words >= filter->min_words_for_ivector) {
-        // Only update adaptation state if the utterance contained enough words
-        feature_pipeline.GetAdaptationState(filter->adaptation_state);
-        feature_pipeline.GetCmvnState(filter->cmvn_state);
-      }
-    } else {
-      GST_DEBUG_OBJECT(filter, "Less than 0.1 seconds decoded, discarding");
-    }
+// The options of the stream decoder, as they are set by the properties
+static void gst_kaldinnet2onlinedecoder_decoder_config(
+    Gstkaldinnet2onlinedecoder * filter, StreamDecoderConfig *config) {
+  config->nnet_mode = filter->nnet_mode;
+  config->use_threaded_decoder = filter->use_threaded_decoder;
+  config->do_endpointing = filter->do_endpointing;
+  config->chunk_length_in_secs = filter->chunk_length_in_secs;
+  config->traceback_period_in_secs = filter->traceback_period_in_secs;
+  config->max_lag_in_frames = filter->max_lag_in_frames;
+  config->max_lag_in_ms = filter->max_lag_in_ms;
+  config->nnet3_batch_size = filter->nnet3_batch_size;
+  config->nnet3_batch_frames_per_chunk = filter->nnet3_batch_frames_per_chunk;
+  config->nnet3_batch_max_wait_ms = filter->nnet3_batch_max_wait_ms;
+  config->num_nbest = filter->num_nbest;
+  config->num_phone_alignment = filter->num_phone_alignment;
+  config->do_phone_alignment = filter->do_phone_alignment;
+  config->min_words_for_ivector = filter->min_words_for_ivector;
+  config->inverse_scale = filter->inverse_scale;
+  config->lmwt_scale = filter->lmwt_scale;
+  config->max_pending_results = filter->max_pending_results;
+  config->endpoint_config = *(filter->endpoint_config);
+  config->nnet2_decoding_config = *(filter->nnet2_decoding_config);
+  config->nnet2_decoding_threaded_config = *(filter->nnet2_decoding_threaded_config);
+  config->nnet3_decodable_opts = *(filter->nnet3_decodable_opts);
+  config->decoder_opts = *(filter->decoder_opts);
+  config->silence_weighting_config = *(filter->silence_weighting_config);
+}
 
-    filter->segment_start_time = frame_offset * frame_shift * frame_subsampling_factor;
+// Sets the adaptation and CMVN states to those of a returning speaker, or
+// resets them for a new one
+static void gst_kaldinnet2onlinedecoder_load_speaker(
+    Gstkaldinnet2onlinedecoder * filter, const std::string &speaker_id) {
+  if (SpeakerStateCache::Instance()->Lookup(speaker_id, filter->adaptation_state,
+                                            filter->cmvn_state)) {
+    GST_DEBUG_OBJECT(filter, "Restored the state of speaker %s", speaker_id.c_str());
+  } else {
+    GST_DEBUG_OBJECT(filter, "New speaker %s, resetting adaptation and CMVN states",
+                     speaker_id.c_str());
+    delete filter->adaptation_state;
+    filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
+        filter->feature_info->ivector_extractor_info);
+    delete filter->cmvn_state;
+    gst_kaldinnet2onlinedecoder_reset_cmvn_state(filter);
   }
-  
 }
 
 static void gst_kaldinnet2onlinedecoder_loop(
     Gstkaldinnet2onlinedecoder * filter) {
 
   GST_DEBUG_OBJECT(filter, "Starting decoding loop..");
-  BaseFloat traceback_period_secs = filter->traceback_period_in_secs;
-
-  int32 chunk_length = int32(filter->sample_rate * filter->chunk_length_in_secs);
-
-  bool more_data = true;
-  Vector<BaseFloat> remaining_wave_part;
-  filter->segment_start_time = 0.0;
-  filter->total_time_decoded = 0.0;
-  while (more_data) {
-    if (filter->nnet_mode == NNET2) {
-      if (filter->use_threaded_decoder) {
-        gst_kaldinnet2onlinedecoder_threaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs, &remaining_wave_part);
-      } else {
-        gst_kaldinnet2onlinedecoder_unthreaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs);
-      }
-    } else {
-      gst_kaldinnet2onlinedecoder_nnet3_unthreaded_decode_segment(filter, more_data, chunk_length, traceback_period_secs);
-    }
-    filter->segment_start_time = filter->total_time_decoded;
+  gst_kaldinnet2onlinedecoder_wait_for_models(filter);
+
+  GST_OBJECT_LOCK(filter);
+  std::string speaker_id = filter->speaker_id;
+  GST_OBJECT_UNLOCK(filter);
+  if (!speaker_id.empty()) {
+    gst_kaldinnet2onlinedecoder_load_speaker(filter, speaker_id);
   }
 
+  StreamDecoderConfig config;
+  gst_kaldinnet2onlinedecoder_decoder_config(filter, &config);
+  filter->stream_decoder->Decode(config, *(filter->feature_info),
+                                 filter->audio_source,
+                                 filter->adaptation_state, filter->cmvn_state);
+
   GST_DEBUG_OBJECT(filter, "Finished decoding loop");
+  if (!speaker_id.empty()) {
+    SpeakerStateCache::Instance()->Store(speaker_id, *filter->adaptation_state,
+                                         *filter->cmvn_state);
+  }
+  gst_kaldinnet2onlinedecoder_wait_for_signals(filter);
   GST_DEBUG_OBJECT(filter, "Pushing EOS event");
   gst_pad_push_event(filter->srcpad, gst_event_new_eos());
 
@@ -1681,6 +1758,9 @@ static void gst_kaldinnet2onlinedecoder_loop(
   gst_pad_pause_task(filter->srcpad);
   delete filter->audio_source;
   filter->audio_source = new GstBufferSource();
+  filter->audio_source->SetFormat(filter->audio_format, filter->audio_channels);
+  filter->audio_source->SetSampleRate(filter->audio_rate);
+  filter->audio_source->SetOutputSampleRate(filter->sample_rate);
   filter->decoding = false;
 }
 
@@ -1702,10 +1782,22 @@ gst_kaldinnet2onlinedecoder_query (GstPad *pad, GstObject * parent, GstQuery * q
         else
           filter->sample_rate = (int) filter->feature_info->mfcc_opts.frame_opts.samp_freq;
       }
-      GstCaps *new_caps = gst_caps_new_simple ("audio/x-raw",
-            "format", G_TYPE_STRING, "S16LE",
-            "rate", G_TYPE_INT, filter->sample_rate,
-            "channels", G_TYPE_INT, 1, NULL);
+      GstCaps *filter_caps;
+      gst_query_parse_caps(query, &filter_caps);
+
+      /* Any of the supported sample formats, at the rate of the models,
+       * or at any rate if we can resample (but preferably not) */
+      GstCaps *new_caps = gst_caps_make_writable(gst_pad_get_pad_template_caps(pad));
+      gst_caps_set_simple(new_caps, "rate", G_TYPE_INT, filter->sample_rate, NULL);
+      if (filter->resample) {
+        new_caps = gst_caps_merge(new_caps, gst_pad_get_pad_template_caps(pad));
+      }
+      if (filter_caps) {
+        GstCaps *intersection = gst_caps_intersect_full(filter_caps, new_caps,
+                                                        GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref(new_caps);
+        new_caps = intersection;
+      }
 
       GST_DEBUG_OBJECT (filter, "Setting caps query result: %" GST_PTR_FORMAT, new_caps);
       gst_query_set_caps_result (query, new_caps);
@@ -1722,6 +1814,58 @@ gst_kaldinnet2onlinedecoder_query (GstPad *pad, GstObject * parent, GstQuery * q
 
 
 
+/* Chooses between text and binary results, depending on what downstream
+ * accepts, at the start of a stream or of a segment of it. Text results are
+ * pushed without caps, as they always have been. Binary results get their
+ * caps once per stream, after the stream-start forwarded from upstream, and
+ * are timestamped like the audio, so they share its segment. Takes
+ * ownership of the segment event. */
+static void gst_kaldinnet2onlinedecoder_negotiate_src(
+    Gstkaldinnet2onlinedecoder * filter, GstEvent * segment_event) {
+  GstCaps *template_caps = gst_pad_get_pad_template_caps(filter->srcpad);
+  GstCaps *peer_caps = gst_pad_peer_query_caps(filter->srcpad, template_caps);
+  gst_caps_unref(template_caps);
+
+  filter->binary_results = !gst_caps_is_empty(peer_caps)
+      && gst_structure_has_name(gst_caps_get_structure(peer_caps, 0),
+                                KALDI_RESULT_MEDIA_TYPE);
+  gst_caps_unref(peer_caps);
+  if (!filter->binary_results) {
+    filter->src_caps_pushed = FALSE;
+    gst_event_unref(segment_event);
+    return;
+  }
+
+  if (!filter->src_caps_pushed) {
+    GST_DEBUG_OBJECT(filter, "Pushing results as %s", KALDI_RESULT_MEDIA_TYPE);
+    GstEvent *stream_start = gst_pad_get_sticky_event(filter->srcpad,
+                                                      GST_EVENT_STREAM_START, 0);
+    if (stream_start) {
+      gst_event_unref(stream_start);
+    } else {
+      gchar *stream_id = gst_pad_create_stream_id(filter->srcpad,
+                                                  GST_ELEMENT(filter), NULL);
+      gst_pad_push_event(filter->srcpad, gst_event_new_stream_start(stream_id));
+      g_free(stream_id);
+    }
+    GstCaps *caps = gst_caps_new_empty_simple(KALDI_RESULT_MEDIA_TYPE);
+    gst_pad_push_event(filter->srcpad, gst_event_new_caps(caps));
+    gst_caps_unref(caps);
+    filter->src_caps_pushed = TRUE;
+  }
+
+  const GstSegment *upstream_segment;
+  gst_event_parse_segment(segment_event, &upstream_segment);
+  if (upstream_segment->format == GST_FORMAT_TIME) {
+    gst_pad_push_event(filter->srcpad, segment_event);
+  } else {
+    gst_event_unref(segment_event);
+    GstSegment segment;
+    gst_segment_init(&segment, GST_FORMAT_TIME);
+    gst_pad_push_event(filter->srcpad, gst_event_new_segment(&segment));
+  }
+}
+
 /* this function handles sink events */
 static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
                                                        GstObject * parent,
@@ -1734,7 +1878,14 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
   GST_DEBUG_OBJECT(filter, "Handling %s event", GST_EVENT_TYPE_NAME(event));
 
   switch (GST_EVENT_TYPE(event)) {
+    case GST_EVENT_STREAM_START: {
+      /* the caps of binary results are pushed again after it */
+      filter->src_caps_pushed = FALSE;
+      ret = gst_pad_event_default(pad, parent, event);
+      break;
+    }
     case GST_EVENT_SEGMENT: {
+      gst_kaldinnet2onlinedecoder_negotiate_src(filter, event);
       GST_DEBUG_OBJECT(filter, "Starting decoding task");
       filter->decoding = true;
       gst_pad_start_task(filter->srcpad,
@@ -1746,7 +1897,25 @@ static gboolean gst_kaldinnet2onlinedecoder_sink_event(GstPad * pad,
       break;
     }
     case GST_EVENT_CAPS: {
-      ret = TRUE;
+      GstCaps *caps;
+      GstAudioInfo info;
+      gst_event_parse_caps(event, &caps);
+      if (gst_audio_info_from_caps(&info, caps)
+          && (filter->resample || GST_AUDIO_INFO_RATE(&info) == filter->sample_rate)
+          && filter->audio_source->SetFormat(GST_AUDIO_INFO_FORMAT(&info),
+                                             GST_AUDIO_INFO_CHANNELS(&info))) {
+        GST_DEBUG_OBJECT(filter, "Accepted caps %" GST_PTR_FORMAT, caps);
+        filter->audio_source->SetSampleRate(GST_AUDIO_INFO_RATE(&info));
+        /* remembered for the audio sources of the following streams */
+        filter->audio_format = GST_AUDIO_INFO_FORMAT(&info);
+        filter->audio_channels = GST_AUDIO_INFO_CHANNELS(&info);
+        filter->audio_rate = GST_AUDIO_INFO_RATE(&info);
+        ret = TRUE;
+      } else {
+        GST_WARNING_OBJECT(filter, "Unsupported caps %" GST_PTR_FORMAT, caps);
+        ret = FALSE;
+      }
+      gst_event_unref(event);
       break;
     }
     case GST_EVENT_EOS: {
@@ -1806,22 +1975,28 @@ gst_kaldinnet2onlinedecoder_load_word_syms(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading word symbols file: %s", str);
 
-        fst::SymbolTable * new_word_syms = fst::SymbolTable::ReadText(str);
-        if (!new_word_syms) {
-          throw std::runtime_error("Word symbol table not read.");
-        }
-
-        // Delete old objects if needed
-        if (filter->word_syms) {
-          delete filter->word_syms;
+        const fst::SymbolTable * new_word_syms =
+            ModelRegistry::Instance()->AcquireSymbolTable(str);
+        const JsonSymbolTable * new_json_word_syms;
+        try {
+          new_json_word_syms =
+              ModelRegistry::Instance()->AcquireJsonSymbolTable(str, new_word_syms);
+        } catch (std::runtime_error& e) {
+          ModelRegistry::Instance()->Release(new_word_syms);
+          throw;
         }
 
-        // Replace the symbol table
-        filter->word_syms = new_word_syms;
+        // Replace the symbol table, the old one is released when no longer used
+        g_mutex_lock(&filter->models_lock);
+        ModelSet *new_models = filter->models->Clone();
+        new_models->SetWordSyms(new_word_syms, new_json_word_syms);
+        std::swap(filter->models, new_models);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->word_syms_filename);
         filter->word_syms_filename = g_strdup(str);
+        g_mutex_unlock(&filter->models_lock);
+        new_models->Unref();
 
       } catch (std::runtime_error& e) {
         GST_WARNING_OBJECT(filter, "Error loading the word symbol table: %s", str);
@@ -1845,22 +2020,28 @@ gst_kaldinnet2onlinedecoder_load_phone_syms(Gstkaldinnet2onlinedecoder * filter,
       try {
         GST_DEBUG_OBJECT(filter, "Loading phone symbols file: %s", str);
 
-        fst::SymbolTable * new_phone_syms = fst::SymbolTable::ReadText(str);
-        if (!new_phone_syms) {
-          throw std::runtime_error("Phone symbol table not read.");
+        const fst::SymbolTable * new_phone_syms =
+            ModelRegistry::Instance()->AcquireSymbolTable(str);
+        const JsonSymbolTable * new_json_phone_syms;
+        try {
+          new_json_phone_syms =
+              ModelRegistry::Instance()->AcquireJsonSymbolTable(str, new_phone_syms);
+        } catch (std::runtime_error& e) {
+          ModelRegistry::Instance()->Release(new_phone_syms);
+          throw;
         }
 
-        // Delete old objects if needed
-        if (filter->phone_syms) {
-          delete filter->phone_syms;
-        }
-
-        // Replace the symbol table
-        filter->phone_syms = new_phone_syms;
+        // Replace the symbol table, the old one is released when no longer used
+        g_mutex_lock(&filter->models_lock);
+        ModelSet *new_models = filter->models->Clone();
+        new_models->SetPhoneSyms(new_phone_syms, new_json_phone_syms);
+        std::swap(filter->models, new_models);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->phone_syms_filename);
         filter->phone_syms_filename = g_strdup(str);
+        g_mutex_unlock(&filter->models_lock);
+        new_models->Unref();
 
       } catch (std::runtime_error& e) {
         GST_WARNING_OBJECT(filter, "Error loading the phone symbol table: %s", str);
@@ -1883,23 +2064,20 @@ gst_kaldinnet2onlinedecoder_load_word_boundary_info(Gstkaldinnet2onlinedecoder *
     if (strcmp(str, "") != 0) {
       try {
         GST_DEBUG_OBJECT(filter, "Loading word boundary file: %s", str);
-        WordBoundaryInfoNewOpts opts; // use default opts
-        WordBoundaryInfo* new_word_boundary_info = new WordBoundaryInfo(opts, str);
-        if (!new_word_boundary_info) {
-          throw std::runtime_error("Word boundary info not read.");
-        }
+        const WordBoundaryInfo* new_word_boundary_info =
+            ModelRegistry::Instance()->AcquireWordBoundaryInfo(str);
 
-        // Delete old objects if needed
-        if (filter->word_boundary_info) {
-          delete filter->word_boundary_info;
-        }
-
-        // Replace the word boundary info
-        filter->word_boundary_info = new_word_boundary_info;
+        // Replace the word boundary info, the old one is released when no longer used
+        g_mutex_lock(&filter->models_lock);
+        ModelSet *new_models = filter->models->Clone();
+        new_models->SetWordBoundaryInfo(new_word_boundary_info);
+        std::swap(filter->models, new_models);
 
         // Only change the parameter if it has worked correctly
         g_free(filter->word_boundary_info_filename);
         filter->word_boundary_info_filename = g_strdup(str);
+        g_mutex_unlock(&filter->models_lock);
+        new_models->Unref();
 
       } catch (std::runtime_error& e) {
         GST_WARNING_OBJECT(filter, "Error loading the word boundary info: %s", str);
@@ -1912,163 +2090,312 @@ gst_kaldinnet2onlinedecoder_load_word_boundary_info(Gstkaldinnet2onlinedecoder *
   }
 }
 
-static void
-gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
-                                       const GValue * value) {
-  if (G_VALUE_HOLDS_STRING(value)) {
-    gchar* str = g_value_dup_string(value);
-
-    // Check if the model filename is not empty
-    if (strcmp(str, "") != 0) {
-      // Build objects if needed
-      if (!filter->trans_model) {
-        filter->trans_model = new TransitionModel();
-      }
-
-      if (!filter->am_nnet2) {
-        filter->am_nnet2 = new nnet2::AmNnet();
-      }
-
-      if (!filter->am_nnet3) {
-        filter->am_nnet3 = new nnet3::AmNnetSimple();
-      }
+/**
+ * A request to load the file given in one of the 'model', 'fst', 'lm-fst'
+ * and 'big-lm-const-arpa' properties. It carries copies of the other
+ * properties that affect loading, so that the result doesn't depend on
+ * when the job is run.
+ */
+struct _ModelLoadJob {
+  Gstkaldinnet2onlinedecoder *filter;
+  guint prop_id;
+  const gchar *property_name;
+  gchar *filename;
+  guint serial;
+  guint nnet_mode;
+  nnet3::NnetSimpleLoopedComputationOptions nnet3_decodable_opts;
+  gboolean fst_mmap;
+};
 
-      // Make the objects read the new models
-      try {
-        bool binary;
-        Input ki(str, &binary);
-        filter->trans_model->Read(ki.Stream(), binary);
-        if (filter->nnet_mode == NNET2) {
-          filter->am_nnet2->Read(ki.Stream(), binary);
-        }
-        else {
-          filter->am_nnet3->Read(ki.Stream(), binary);
-          SetBatchnormTestMode(true, &(filter->am_nnet3->GetNnet()));
-          SetDropoutTestMode(true, &(filter->am_nnet3->GetNnet()));
-          // this object contains precomputed stuff that is used by all decodable
-          // objects.  It takes a pointer to am_nnet because if it has iVectors it has
-          // to modify the nnet to accept iVectors at intervals.
-          filter->decodable_info_nnet3 = new nnet3::DecodableNnetSimpleLoopedInfo(*(filter->nnet3_decodable_opts),
-                                                                                  filter->am_nnet3);          
-        }
+/* Returns the serial number of the most recently requested load for the
+ * given property; must be called with models_lock held */
+static guint *
+gst_kaldinnet2onlinedecoder_latest_load_serial(Gstkaldinnet2onlinedecoder * filter,
+                                               guint prop_id) {
+  switch (prop_id) {
+    case PROP_MODEL:
+      return &filter->model_load_serial;
+    case PROP_FST:
+      return &filter->fst_load_serial;
+    case PROP_LM_FST:
+      return &filter->lm_fst_load_serial;
+    default:
+      KALDI_ASSERT(prop_id == PROP_BIG_LM_CONST_ARPA);
+      return &filter->big_lm_load_serial;
+  }
+}
 
-        // Only change the parameter if it has worked correctly
-        g_free(filter->model_rspecifier);
-        filter->model_rspecifier = g_strdup(str);
+/* Returns false if a newer load was requested for the same property while
+ * this one was running, in which case its result should be discarded;
+ * must be called with models_lock held */
+static bool
+gst_kaldinnet2onlinedecoder_load_is_current(Gstkaldinnet2onlinedecoder * filter,
+                                            const ModelLoadJob * job) {
+  return *gst_kaldinnet2onlinedecoder_latest_load_serial(filter, job->prop_id)
+      == job->serial;
+}
 
-      } catch (std::runtime_error& e) {
-        GST_WARNING_OBJECT(filter, "Error loading the model: %s", str);
-      }
+static bool
+gst_kaldinnet2onlinedecoder_load_model(Gstkaldinnet2onlinedecoder * filter,
+                                       const ModelLoadJob * job) {
+  try {
+    GST_DEBUG_OBJECT(filter, "Loading acoustic model: %s", job->filename);
+
+    const AcousticModel *new_acoustic_model =
+        ModelRegistry::Instance()->AcquireAcousticModel(
+            job->filename,
+            job->nnet_mode == NNET2 ? NULL : &(job->nnet3_decodable_opts));
+
+    g_mutex_lock(&filter->models_lock);
+    if (gst_kaldinnet2onlinedecoder_load_is_current(filter, job)) {
+      // Replace the model; segments that are being decoded keep using
+      // the old one, which is released when they finish
+      ModelSet *new_models = filter->models->Clone();
+      new_models->SetAcousticModel(new_acoustic_model, job->filename);
+      std::swap(filter->models, new_models);
+
+      // Only change the parameter if it has worked correctly
+      g_free(filter->model_rspecifier);
+      filter->model_rspecifier = g_strdup(job->filename);
+      g_mutex_unlock(&filter->models_lock);
+      new_models->Unref();
+    } else {
+      g_mutex_unlock(&filter->models_lock);
+      ModelRegistry::Instance()->Release(new_acoustic_model);
     }
-
-    g_free(str);
-  } else {
-    GST_WARNING_OBJECT(filter, "Model property must be a Kaldi rspecifier string. Ignoring it.");
+    return true;
+  } catch (std::runtime_error& e) {
+    GST_WARNING_OBJECT(filter, "Error loading the model: %s", job->filename);
+    return false;
   }
 }
 
-static void
+static bool
 gst_kaldinnet2onlinedecoder_load_fst(Gstkaldinnet2onlinedecoder * filter,
-                                     const GValue * value) {
-  if (G_VALUE_HOLDS_STRING(value)) {
-    gchar* str = g_value_dup_string(value);
-
-    // Check if the model filename is not empty
-    if (strcmp(str, "") != 0) {
-      try {
-        GST_DEBUG_OBJECT(filter, "Loading decoder graph: %s", str);
-
-        fst::Fst<fst::StdArc> * new_decode_fst = fst::ReadFstKaldiGeneric(str);
-
-        // Delete objects if needed
-        if (filter->decode_fst) {
-          delete filter->decode_fst;
-        }
-
-        // Replace the decoding graph
-        filter->decode_fst = new_decode_fst;
-
-        // Only change the parameter if it has worked correctly
-        g_free(filter->fst_rspecifier);
-        filter->fst_rspecifier = g_strdup(str);
+                                     const ModelLoadJob * job) {
+  try {
+    GST_DEBUG_OBJECT(filter, "Loading decoder graph: %s", job->filename);
+
+    const fst::Fst<fst::StdArc> * new_decode_fst =
+        ModelRegistry::Instance()->AcquireDecodeFst(job->filename, job->fst_mmap);
+
+    g_mutex_lock(&filter->models_lock);
+    if (gst_kaldinnet2onlinedecoder_load_is_current(filter, job)) {
+      // Replace the decoding graph, as above
+      ModelSet *new_models = filter->models->Clone();
+      new_models->SetDecodeFst(new_decode_fst);
+      std::swap(filter->models, new_models);
+
+      // Only change the parameter if it has worked correctly
+      g_free(filter->fst_rspecifier);
+      filter->fst_rspecifier = g_strdup(job->filename);
+      g_mutex_unlock(&filter->models_lock);
+      new_models->Unref();
+    } else {
+      g_mutex_unlock(&filter->models_lock);
+      ModelRegistry::Instance()->Release(new_decode_fst);
+    }
+    return true;
+  } catch (std::runtime_error& e) {
+    GST_WARNING_OBJECT(filter, "Error loading the FST decoding graph: %s", job->filename);
+    return false;
+  }
+}
 
-      } catch (std::runtime_error& e) {
-        GST_WARNING_OBJECT(filter, "Error loading the FST decoding graph: %s", str);
-      }
+static bool
+gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
+                                        const ModelLoadJob * job) {
+  try {
+    GST_DEBUG_OBJECT(filter, "Loading baseline language model FST: %s", job->filename);
+
+    const fst::VectorFst<fst::StdArc> *std_lm_fst =
+        ModelRegistry::Instance()->AcquireLmFst(job->filename);
+
+    g_mutex_lock(&filter->models_lock);
+    if (gst_kaldinnet2onlinedecoder_load_is_current(filter, job)) {
+      ModelSet *new_models = filter->models->Clone();
+      new_models->SetLmFst(std_lm_fst);
+      std::swap(filter->models, new_models);
+
+      // Only change the parameter if it has worked correctly
+      g_free(filter->lm_fst_name);
+      filter->lm_fst_name = g_strdup(job->filename);
+      g_mutex_unlock(&filter->models_lock);
+      new_models->Unref();
+    } else {
+      g_mutex_unlock(&filter->models_lock);
+      ModelRegistry::Instance()->Release(std_lm_fst);
     }
+    return true;
+  } catch (std::runtime_error& e) {
+    GST_WARNING_OBJECT(filter, "Error loading the LM FST: %s", job->filename);
+    return false;
+  }
+}
 
-    g_free(str);
-  } else {
-    GST_WARNING_OBJECT(filter, "FST property must be a Kaldi rspecifier string. Ignoring it.");
+static bool
+gst_kaldinnet2onlinedecoder_load_big_lm(Gstkaldinnet2onlinedecoder * filter,
+                                        const ModelLoadJob * job) {
+  try {
+    GST_DEBUG_OBJECT(filter, "Loading big language model in constant ARPA format: %s", job->filename);
+
+    const ConstArpaLm *new_big_lm_const_arpa =
+        ModelRegistry::Instance()->AcquireConstArpaLm(job->filename);
+
+    g_mutex_lock(&filter->models_lock);
+    if (gst_kaldinnet2onlinedecoder_load_is_current(filter, job)) {
+      ModelSet *new_models = filter->models->Clone();
+      new_models->SetBigLm(new_big_lm_const_arpa,
+                           static_cast<size_t>(filter->big_lm_cache_mb) * 1024 * 1024);
+      std::swap(filter->models, new_models);
+
+      // Only change the parameter if it has worked correctly
+      g_free(filter->big_lm_const_arpa_name);
+      filter->big_lm_const_arpa_name = g_strdup(job->filename);
+      g_mutex_unlock(&filter->models_lock);
+      new_models->Unref();
+    } else {
+      g_mutex_unlock(&filter->models_lock);
+      ModelRegistry::Instance()->Release(new_big_lm_const_arpa);
+    }
+    return true;
+  } catch (std::runtime_error& e) {
+    GST_WARNING_OBJECT(filter, "Error loading the big language model: %s", job->filename);
+    return false;
   }
 }
 
+/* Called when a load job has finished. Completes a pending asynchronous
+ * READY->PAUSED state change when all models have been loaded. */
 static void
-gst_kaldinnet2onlinedecoder_load_lm_fst(Gstkaldinnet2onlinedecoder * filter,
-                                        const GValue * value) {
-  if (G_VALUE_HOLDS_STRING(value)) {
-    gchar* str = g_value_dup_string(value);
+gst_kaldinnet2onlinedecoder_load_done(Gstkaldinnet2onlinedecoder * filter) {
+  gboolean commit_state = FALSE;
 
-    // Check if the model filename is not empty
-    if (strcmp(str, "") != 0) {
-      try {
-        GST_DEBUG_OBJECT(filter, "Loading baseline language model FST: %s", str);
+  g_mutex_lock(&filter->load_lock);
+  filter->num_pending_loads--;
+  if (filter->num_pending_loads == 0 && filter->async_state_change) {
+    commit_state = TRUE;
+  }
+  g_cond_broadcast(&filter->load_cond);
+  g_mutex_unlock(&filter->load_lock);
+
+  if (commit_state) {
+    // Taking the state lock makes sure that the change_state call that
+    // returned ASYNC has finished. A PAUSED->READY change may have aborted
+    // the state change while we were waiting for it, or another load may
+    // have started, so check again.
+    GST_STATE_LOCK(filter);
+    g_mutex_lock(&filter->load_lock);
+    commit_state = filter->num_pending_loads == 0 && filter->async_state_change;
+    if (commit_state) {
+      filter->async_state_change = FALSE;
+    }
+    g_mutex_unlock(&filter->load_lock);
+    if (commit_state) {
+      GST_DEBUG_OBJECT(filter, "All models loaded, completing state change");
+      gst_element_continue_state(GST_ELEMENT(filter), GST_STATE_CHANGE_SUCCESS);
+      gst_element_post_message(GST_ELEMENT(filter),
+                               gst_message_new_async_done(GST_OBJECT(filter),
+                                                          GST_CLOCK_TIME_NONE));
+    }
+    GST_STATE_UNLOCK(filter);
+  }
+}
 
-        // Delete objects if needed
-        if (filter->lm_fst) {
-          delete filter->lm_fst;
-        }
-        if (filter->lm_compose_cache) {
-          delete filter->lm_compose_cache;
-        }
+static void
+gst_kaldinnet2onlinedecoder_run_load_job(gpointer data, gpointer user_data) {
+  ModelLoadJob *job = reinterpret_cast<ModelLoadJob*>(data);
+  Gstkaldinnet2onlinedecoder *filter = job->filter;
+  bool success = false;
 
-        fst::VectorFst<fst::StdArc> *std_lm_fst =
-            fst::VectorFst<fst::StdArc>::Read(str);
-        fst::Project(std_lm_fst, fst::PROJECT_OUTPUT);
+  switch (job->prop_id) {
+    case PROP_MODEL:
+      success = gst_kaldinnet2onlinedecoder_load_model(filter, job);
+      break;
+    case PROP_FST:
+      success = gst_kaldinnet2onlinedecoder_load_fst(filter, job);
+      break;
+    case PROP_LM_FST:
+      success = gst_kaldinnet2onlinedecoder_load_lm_fst(filter, job);
+      break;
+    case PROP_BIG_LM_CONST_ARPA:
+      success = gst_kaldinnet2onlinedecoder_load_big_lm(filter, job);
+      break;
+  }
 
-        if (std_lm_fst->Properties(fst::kILabelSorted, true) == 0) {
-          // Make sure LM is sorted on ilabel.
-          fst::ILabelCompare<fst::StdArc> ilabel_comp;
-          fst::ArcSort(std_lm_fst, ilabel_comp);
-        }
+  /* Let the application know, e.g. to track the progress of a worker pool */
+  gst_element_post_message(
+      GST_ELEMENT(filter),
+      gst_message_new_element(
+          GST_OBJECT(filter),
+          gst_structure_new("kaldi-model-loaded",
+                            "property", G_TYPE_STRING, job->property_name,
+                            "filename", G_TYPE_STRING, job->filename,
+                            "success", G_TYPE_BOOLEAN, success,
+                            NULL)));
+
+  gst_kaldinnet2onlinedecoder_load_done(filter);
+
+  g_free(job->filename);
+  gst_object_unref(filter);
+  delete job;
+}
 
-        // mapped_fst is the LM fst interpreted using the LatticeWeight semiring,
-        // with all the cost on the first member of the pair (since it's a graph
-        // weight).
-        int32 num_states_cache = 50000;
-        fst::CacheOptions cache_opts(true, num_states_cache);
-        fst::MapFstOptions mapfst_opts(cache_opts);
-        fst::StdToLatticeMapper<BaseFloat> mapper;
-        filter->lm_fst = new fst::MapFst<fst::StdArc, LatticeArc,
-            fst::StdToLatticeMapper<BaseFloat> >(*std_lm_fst, mapper, mapfst_opts);
-        delete std_lm_fst;
-
-        // The next fifteen or so lines are a kind of optimization and
-        // can be ignored if you just want to understand what is going on.
-        // Change the options for TableCompose to match the input
-        // (because it's the arcs of the LM FST we want to do lookup
-        // on).
-        fst::TableComposeOptions compose_opts(fst::TableMatcherOptions(),
-                                              true, fst::SEQUENCE_FILTER,
-                                              fst::MATCH_INPUT);
-
-        // The following is an optimization for the TableCompose
-        // composition: it stores certain tables that enable fast
-        // lookup of arcs during composition.
-        filter->lm_compose_cache = new fst::TableComposeCache<fst::Fst<LatticeArc> >(compose_opts);
+/* Loads the file given in a model property, directly or in a worker
+ * thread if async-model-loading is set */
+static void
+gst_kaldinnet2onlinedecoder_schedule_load(Gstkaldinnet2onlinedecoder * filter,
+                                          guint prop_id,
+                                          GParamSpec * pspec,
+                                          const GValue * value) {
+  if (!G_VALUE_HOLDS_STRING(value)) {
+    GST_WARNING_OBJECT(filter, "%s property must be a Kaldi rspecifier string. Ignoring it.",
+                       g_param_spec_get_name(pspec));
+    return;
+  }
 
-        // Only change the parameter if it has worked correctly
-        g_free(filter->lm_fst_name);
-        filter->lm_fst_name = g_strdup(str);
-      } catch (std::runtime_error& e) {
-        GST_WARNING_OBJECT(filter, "Error loading the FST decoding graph: %s", str);
-      }
-    }
+  // Check if the model filename is not empty
+  const gchar *filename = g_value_get_string(value);
+  if (filename == NULL || strcmp(filename, "") == 0) {
+    return;
+  }
 
-    g_free(str);
+  ModelLoadJob *job = new ModelLoadJob();
+  job->filter = GST_KALDINNET2ONLINEDECODER(gst_object_ref(filter));
+  job->prop_id = prop_id;
+  job->property_name = g_param_spec_get_name(pspec);
+  job->filename = g_strdup(filename);
+  job->nnet_mode = filter->nnet_mode;
+  job->nnet3_decodable_opts = *(filter->nnet3_decodable_opts);
+  job->fst_mmap = filter->fst_mmap;
+
+  g_mutex_lock(&filter->models_lock);
+  job->serial = ++filter->load_serial;
+  *gst_kaldinnet2onlinedecoder_latest_load_serial(filter, prop_id) = job->serial;
+  g_mutex_unlock(&filter->models_lock);
+
+  g_mutex_lock(&filter->load_lock);
+  filter->num_pending_loads++;
+  g_mutex_unlock(&filter->load_lock);
+
+  if (filter->async_model_loading) {
+    GST_DEBUG_OBJECT(filter, "Loading %s in the background", filename);
+    g_thread_pool_push(gst_kaldinnet2onlinedecoder_load_pool, job, NULL);
   } else {
-    GST_WARNING_OBJECT(filter, "lm-fst property must be a Kaldi rspecifier string. Ignoring it.");
+    gst_kaldinnet2onlinedecoder_run_load_job(job, NULL);
+  }
+}
+
+static void
+gst_kaldinnet2onlinedecoder_wait_for_models(Gstkaldinnet2onlinedecoder * filter) {
+  g_mutex_lock(&filter->load_lock);
+  if (filter->num_pending_loads > 0) {
+    GST_DEBUG_OBJECT(filter, "Waiting for %u models to be loaded", filter->num_pending_loads);
+  }
+  while (filter->num_pending_loads > 0) {
+    g_cond_wait(&filter->load_cond, &filter->load_lock);
   }
+  g_mutex_unlock(&filter->load_lock);
 }
 
 static void 
@@ -2081,38 +2408,6 @@ gst_kaldinnet2onlinedecoder_reset_cmvn_state(Gstkaldinnet2onlinedecoder * filter
   filter->cmvn_state = new OnlineCmvnState(global_cmvn_stats);
 }
 
-static void
-gst_kaldinnet2onlinedecoder_load_big_lm(Gstkaldinnet2onlinedecoder * filter,
-                                        const GValue * value) {
-  if (G_VALUE_HOLDS_STRING(value)) {
-    gchar* str = g_value_dup_string(value);
-
-    // Check if the model filename is not empty
-    if (strcmp(str, "") != 0) {
-      try {
-        GST_DEBUG_OBJECT(filter, "Loading big language model in constant ARPA format: %s", str);
-
-        // Delete object if needed
-        if (filter->big_lm_const_arpa) {
-          delete filter->big_lm_const_arpa;
-        }
-        filter->big_lm_const_arpa = new ConstArpaLm();
-        ReadKaldiObject(str, filter->big_lm_const_arpa);
-
-        // Only change the parameter if it has worked correctly
-        g_free(filter->big_lm_const_arpa_name);
-        filter->big_lm_const_arpa_name = g_strdup(str);
-      } catch (std::runtime_error& e) {
-        GST_WARNING_OBJECT(filter, "Error loading the FST decoding graph: %s", str);
-      }
-    }
-
-    g_free(str);
-  } else {
-    GST_WARNING_OBJECT(filter, "lm-fst property must be a Kaldi rspecifier string. Ignoring it.");
-  }
-}
-
 static bool
 gst_kaldinnet2onlinedecoder_allocate(
     Gstkaldinnet2onlinedecoder * filter) {
@@ -2130,6 +2425,7 @@ gst_kaldinnet2onlinedecoder_allocate(
     filter->sample_rate = (int) filter->feature_info->plp_opts.frame_opts.samp_freq;
   else
     filter->sample_rate = (int) filter->feature_info->mfcc_opts.frame_opts.samp_freq;
+  filter->audio_source->SetOutputSampleRate(filter->sample_rate);
 
   filter->adaptation_state = new OnlineIvectorExtractorAdaptationState(
       filter->feature_info->ivector_extractor_info);
@@ -2161,11 +2457,45 @@ static GstStateChangeReturn gst_kaldinnet2onlinedecoder_change_state(
       break;
   }
 
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* The pads drop their sticky events */
+      filter->src_caps_pushed = FALSE;
+      /* Abort a pending asynchronous state change */
+      g_mutex_lock(&filter->load_lock);
+      if (filter->async_state_change) {
+        filter->async_state_change = FALSE;
+        gst_element_post_message(element,
+                                 gst_message_new_async_done(GST_OBJECT(filter),
+                                                            GST_CLOCK_TIME_NONE));
+      }
+      g_mutex_unlock(&filter->load_lock);
+      break;
+    default:
+      break;
+  }
+
   ret = GST_ELEMENT_CLASS(parent_class)->change_state(element, transition);
   if (ret == GST_STATE_CHANGE_FAILURE)
     return ret;
 
   switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      /* Don't report being ready for data before the models are loaded;
+       * gst_kaldinnet2onlinedecoder_load_done() completes the state change.
+       * It takes the state lock, which our caller holds, so it cannot
+       * finish before we have returned. */
+      g_mutex_lock(&filter->load_lock);
+      if (filter->num_pending_loads > 0) {
+        GST_DEBUG_OBJECT(filter, "Waiting for %u models to be loaded before going to PAUSED",
+                         filter->num_pending_loads);
+        filter->async_state_change = TRUE;
+        gst_element_post_message(element,
+                                 gst_message_new_async_start(GST_OBJECT(filter)));
+        ret = GST_STATE_CHANGE_ASYNC;
+      }
+      g_mutex_unlock(&filter->load_lock);
+      break;
     case GST_STATE_CHANGE_READY_TO_NULL:
       gst_kaldinnet2onlinedecoder_deallocate(filter);
       break;
@@ -2179,10 +2509,22 @@ static GstStateChangeReturn gst_kaldinnet2onlinedecoder_change_state(
 static void gst_kaldinnet2onlinedecoder_finalize(GObject * object) {
   Gstkaldinnet2onlinedecoder *filter = GST_KALDINNET2ONLINEDECODER(object);
 
+  // Lets pending results finish first
+  delete filter->stream_decoder;
+  delete filter->decoder_listener;
+  g_thread_pool_free(filter->signal_pool, FALSE, TRUE);
+  delete filter->pending_signals;
+  g_mutex_clear(&filter->signal_lock);
+  g_cond_clear(&filter->signal_cond);
+
   g_free(filter->model_rspecifier);
   g_free(filter->fst_rspecifier);
   g_free(filter->word_syms_filename);
   g_free(filter->phone_syms_filename);
+  g_free(filter->speaker_id);
+  if (filter->speaker_cache_size_requested) {
+    SpeakerStateCache::Instance()->WithdrawCapacityRequest(filter->speaker_cache_size);
+  }
   delete filter->endpoint_config;
   delete filter->feature_config;
   delete filter->nnet2_decoding_config;
@@ -2190,39 +2532,19 @@ static void gst_kaldinnet2onlinedecoder_finalize(GObject * object) {
   delete filter->decoder_opts;
   delete filter->silence_weighting_config;
   delete filter->simple_options;
+  delete filter->profiler;
   if (filter->feature_info) {
     delete filter->feature_info;
   }
-  if (filter->trans_model) {
-    delete filter->trans_model;
-  }
-  if (filter->am_nnet2) {
-    delete filter->am_nnet2;
-  }
-  if (filter->am_nnet3) {
-    delete filter->am_nnet3;
-  }
-  if (filter->decode_fst) {
-    delete filter->decode_fst;
-  }
-  if (filter->word_syms) {
-    delete filter->word_syms;
-  }
+  filter->models->Unref();
   if (filter->adaptation_state) {
     delete filter->adaptation_state;
   }
   g_free(filter->lm_fst_name);
   g_free(filter->big_lm_const_arpa_name);
-  if (filter->lm_fst) {
-    delete filter->lm_fst;
-  }
-  if (filter->big_lm_const_arpa) {
-    delete filter->big_lm_const_arpa;
-  }
-  if (filter->lm_compose_cache) {
-    delete filter->lm_compose_cache;
-  }
-
+  g_mutex_clear(&filter->models_lock);
+  g_mutex_clear(&filter->load_lock);
+  g_cond_clear(&filter->load_cond);
 
   G_OBJECT_CLASS(parent_class)->finalize(object);
 }
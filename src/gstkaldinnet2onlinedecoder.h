@@ -23,8 +23,14 @@
 
 #include <gst/gst.h>
 
+#include <deque>
+
 #include "./simple-options-gst.h"
 #include "./gst-audio-source.h"
+#include "./model-registry.h"
+#include "./json-writer.h"
+#include "./stage-profiler.h"
+#include "./stream-decoder.h"
 
 #include "online2/online-nnet2-decoding-threaded.h"
 #include "online2/online-nnet2-decoding.h"
@@ -60,9 +66,6 @@ G_BEGIN_DECLS
 typedef struct _Gstkaldinnet2onlinedecoder Gstkaldinnet2onlinedecoder;
 typedef struct _Gstkaldinnet2onlinedecoderClass Gstkaldinnet2onlinedecoderClass;
 
-#define NNET2  2
-#define NNET3  3
-
 struct _Gstkaldinnet2onlinedecoder {
   GstElement element;
 
@@ -80,6 +83,7 @@ struct _Gstkaldinnet2onlinedecoder {
 
   gchar* model_rspecifier;
   gchar* fst_rspecifier;
+  gboolean fst_mmap;
   gchar* word_syms_filename;
   gchar* phone_syms_filename;
   gchar* word_boundary_info_filename;
@@ -97,33 +101,82 @@ struct _Gstkaldinnet2onlinedecoder {
   OnlineSilenceWeightingConfig *silence_weighting_config;
 
   OnlineNnet2FeaturePipelineInfo *feature_info;
-  TransitionModel *trans_model;
-  nnet2::AmNnet *am_nnet2;
-  nnet3::AmNnetSimple *am_nnet3;
-  nnet3::DecodableNnetSimpleLoopedInfo *decodable_info_nnet3;
-  fst::Fst<fst::StdArc> *decode_fst;
-  fst::SymbolTable *word_syms;
-  fst::SymbolTable *phone_syms;
-  WordBoundaryInfo *word_boundary_info;
+  // The current models, replaced as a whole when a model property is set
+  // (protected by models_lock)
+  ModelSet *models;
   int sample_rate;
+  // Format of the incoming audio, as negotiated on the sink pad
+  GstAudioFormat audio_format;
+  gint audio_channels;
+  gint audio_rate;
+  gboolean resample;
   gboolean decoding;
   float chunk_length_in_secs;
   float traceback_period_in_secs;
   bool use_threaded_decoder;
+  guint max_lag_in_frames;
+  guint max_lag_in_ms;
+  guint nnet3_batch_size;
+  guint nnet3_batch_frames_per_chunk;
+  guint nnet3_batch_max_wait_ms;
+  guint big_lm_cache_mb;
   guint num_nbest;
   guint num_phone_alignment;
   guint min_words_for_ivector;
   OnlineIvectorExtractorAdaptationState *adaptation_state;
   OnlineCmvnState *cmvn_state;
-  float segment_start_time;
-  float total_time_decoded;
+  gchar *speaker_id;  // protected by the object lock
+  // The speaker cache capacity this decoder has requested, if any
+  guint speaker_cache_size;
+  gboolean speaker_cache_size_requested;
 
   // The following are needed for optional LM rescoring with a "big" LM
   gchar* lm_fst_name;
   gchar* big_lm_const_arpa_name;
-  fst::MapFst<fst::StdArc, LatticeArc, fst::StdToLatticeMapper<BaseFloat> > *lm_fst;
-  fst::TableComposeCache<fst::Fst<LatticeArc> > *lm_compose_cache;
-  ConstArpaLm *big_lm_const_arpa;
+
+  // Model loading, possibly in background threads. models_lock protects
+  // the current models and their filenames, load_lock the pending loads
+  // and state change.
+  gboolean async_model_loading;
+  GMutex models_lock;
+  guint load_serial;
+  guint model_load_serial;
+  guint fst_load_serial;
+  guint lm_fst_load_serial;
+  guint big_lm_load_serial;
+  GMutex load_lock;
+  GCond load_cond;
+  guint num_pending_loads;
+  gboolean async_state_change;
+
+  // Producing the results of segments in the background
+  guint max_pending_results;
+
+  // Emitting the result signals from a separate thread; signal_lock
+  // protects pending_signals, pending_partial_result and
+  // dispatching_signals
+  gboolean async_signals;
+  GThreadPool *signal_pool;
+  GMutex signal_lock;
+  GCond signal_cond;
+  std::deque<struct _PendingSignal> *pending_signals;
+  // Index of the partial result in pending_signals that a new one of the
+  // same segment replaces, or -1
+  gint pending_partial_result;
+  gboolean dispatching_signals;
+
+  // Whether results are pushed in the binary format of kaldi-result.h
+  // rather than as text, as negotiated at the start of a stream
+  gboolean binary_results;
+  // Whether the caps of the binary results have been pushed in this stream
+  gboolean src_caps_pushed;
+
+  // Durations of the stages of decoding, for the stats property
+  StageProfiler *profiler;
+
+  // Decodes the streams, passing the results to decoder_listener
+  StreamDecoder *stream_decoder;
+  StreamDecoderListener *decoder_listener;
 };
 
 struct _Gstkaldinnet2onlinedecoderClass {
@@ -131,6 +184,7 @@ struct _Gstkaldinnet2onlinedecoderClass {
   void (*partial_result)(GstElement *element, const gchar *result_str);
   void (*final_result)(GstElement *element, const gchar *result_str);
   void (*full_final_result)(GstElement *element, const gchar *result_str);
+  void (*partial_result_delta)(GstElement *element, const gchar *result_str);
 };
 
 GType gst_kaldinnet2onlinedecoder_get_type(void);
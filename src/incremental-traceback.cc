@@ -0,0 +1,178 @@
+// incremental-traceback.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+
+#include "./incremental-traceback.h"
+
+namespace kaldi {
+
+namespace {
+
+// Gives read access to the tokens of a LatticeFasterOnlineDecoder, which
+// it keeps to itself
+class ActiveTokens : public LatticeFasterOnlineDecoder {
+ public:
+  static const Token *LastFrame(const LatticeFasterOnlineDecoder &decoder) {
+    return (decoder.*(&ActiveTokens::active_toks_)).back().toks;
+  }
+};
+
+}  // namespace
+
+int32 NumActiveTokens(const LatticeFasterOnlineDecoder &decoder) {
+  int32 num_tokens = 0;
+  for (const LatticeFasterOnlineDecoder::Token *tok = ActiveTokens::LastFrame(decoder);
+       tok != NULL; tok = tok->next) {
+    num_tokens++;
+  }
+  return num_tokens;
+}
+
+IncrementalTraceback::IncrementalTraceback(const fst::SymbolTable *word_syms)
+    : word_syms_(word_syms), num_committed_words_(0),
+      delta_num_committed_words_(0), num_unchanged_words_(0) { }
+
+void IncrementalTraceback::Reset() {
+  path_.clear();
+  positions_.clear();
+  words_.clear();
+  transcript_.clear();
+  word_ends_.clear();
+  num_committed_words_ = 0;
+  delta_words_.clear();
+  delta_num_committed_words_ = 0;
+  num_unchanged_words_ = 0;
+}
+
+size_t IncrementalTraceback::Update(const LatticeFasterOnlineDecoder &decoder) {
+  typedef LatticeFasterOnlineDecoder::BestPathIterator BestPathIterator;
+
+  // Walk back until we reach the previous path, collecting the new
+  // elements in reverse order
+  std::vector<PathElement> suffix;
+  std::vector<int32> suffix_words;
+  size_t num_common = 0;  // length of the common part of the path
+  BestPathIterator iter = decoder.BestPathEnd(false);
+  while (!iter.Done()) {
+    std::unordered_map<void*, size_t>::const_iterator it = positions_.find(iter.tok);
+    if (it != positions_.end() && path_[it->second].frame == iter.frame) {
+      num_common = it->second + 1;
+      break;
+    }
+    LatticeArc arc;
+    BestPathIterator prev = decoder.TraceBackBestPath(iter, &arc);
+    PathElement element;
+    element.tok = iter.tok;
+    element.frame = iter.frame;
+    suffix.push_back(element);
+    suffix_words.push_back(arc.olabel);
+    iter = prev;
+  }
+
+  for (size_t i = num_common; i < path_.size(); i++) {
+    positions_.erase(path_[i].tok);
+  }
+  path_.resize(num_common);
+  size_t num_stable_words = (num_common > 0 ? path_.back().num_words : 0);
+  words_.resize(num_stable_words);
+  word_ends_.resize(num_stable_words);
+  transcript_.resize(num_stable_words > 0 ? word_ends_.back() : 0);
+  num_unchanged_words_ = std::min(num_unchanged_words_, num_stable_words);
+
+  for (size_t i = suffix.size(); i-- > 0; ) {
+    int32 word = suffix_words[i];
+    if (word != 0) {
+      std::string s = word_syms_->Find(word);
+      if (s == "")
+        KALDI_WARN << "Word-id " << word << " not in symbol table.";
+      if (!words_.empty())
+        transcript_ += ' ';
+      transcript_ += s;
+      words_.push_back(word);
+      word_ends_.push_back(transcript_.size());
+    }
+    suffix[i].num_words = words_.size();
+    positions_[suffix[i].tok] = path_.size();
+    path_.push_back(suffix[i]);
+  }
+  return num_stable_words;
+}
+
+size_t IncrementalTraceback::UpdateCommitted(const LatticeFasterOnlineDecoder &decoder) {
+  typedef LatticeFasterOnlineDecoder::Token Token;
+  KALDI_ASSERT(!path_.empty());
+
+  // Follow the back-pointers of all tokens of the last frame until they
+  // join the best path. The earliest such point is on all paths. Tokens
+  // that have already been followed are remembered, so each token is
+  // visited only once.
+  std::unordered_map<const Token*, size_t> joins;
+  std::vector<const Token*> chain;
+  size_t first_join = path_.size() - 1;
+  for (const Token *tok = ActiveTokens::LastFrame(decoder);
+       tok != NULL && first_join > 0; tok = tok->next) {
+    size_t join = 0;
+    const Token *t = tok;
+    chain.clear();
+    while (t != NULL) {
+      std::unordered_map<void*, size_t>::const_iterator on_path =
+          positions_.find(const_cast<Token*>(t));
+      if (on_path != positions_.end()) {
+        join = on_path->second;
+        break;
+      }
+      std::unordered_map<const Token*, size_t>::const_iterator seen = joins.find(t);
+      if (seen != joins.end()) {
+        join = seen->second;
+        break;
+      }
+      chain.push_back(t);
+      t = t->backpointer;
+    }
+    for (size_t i = 0; i < chain.size(); i++) {
+      joins[chain[i]] = join;
+    }
+    first_join = std::min(first_join, join);
+  }
+  num_committed_words_ = std::min(std::max(num_committed_words_, path_[first_join].num_words),
+                                  words_.size());
+  return num_committed_words_;
+}
+
+bool IncrementalTraceback::TakeDelta(size_t *offset) {
+  // Words before num_unchanged_words_ have been on the path since the last
+  // call; the ones after it may have been put back as they were
+  size_t first_change = num_unchanged_words_;
+  while (first_change < words_.size() && first_change < delta_words_.size()
+         && words_[first_change] == delta_words_[first_change]) {
+    first_change++;
+  }
+  bool changed = (first_change < words_.size() || first_change < delta_words_.size()
+                  || num_committed_words_ != delta_num_committed_words_);
+  *offset = first_change;
+
+  delta_words_.resize(first_change);
+  delta_words_.insert(delta_words_.end(), words_.begin() + first_change, words_.end());
+  delta_num_committed_words_ = num_committed_words_;
+  num_unchanged_words_ = words_.size();
+  return changed;
+}
+
+}  // namespace kaldi
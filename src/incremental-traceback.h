@@ -0,0 +1,107 @@
+// incremental-traceback.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_INCREMENTAL_TRACEBACK_H_
+#define KALDI_SRC_INCREMENTAL_TRACEBACK_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder/lattice-faster-online-decoder.h"
+#include "fst/symbol-table.h"
+
+namespace kaldi {
+
+// Keeps the best path of a LatticeFasterOnlineDecoder and its transcript
+// up to date between tracebacks. Once the tokens of a frame have been
+// processed, their back-pointers don't change, so the new best path can
+// only differ from the previous one after the last token that they have
+// in common. Update() walks back from the new best token only until it
+// reaches a token of the previous path, which makes a traceback cost
+// proportional to the part of the path that changed rather than to the
+// length of the utterance.
+class IncrementalTraceback {
+ public:
+  explicit IncrementalTraceback(const fst::SymbolTable *word_syms);
+
+  // Must be called whenever the decoder is (re)initialized
+  void Reset();
+
+  // Replaces the symbol table; should be followed by Reset(), so that the
+  // transcript doesn't mix words from both tables
+  void SetWordSymbols(const fst::SymbolTable *word_syms) { word_syms_ = word_syms; }
+
+  // Updates the path to the current best path of the decoder, which must
+  // have decoded at least one frame. Returns the number of words at the
+  // start of the transcript that were kept from the previous path.
+  size_t Update(const LatticeFasterOnlineDecoder &decoder);
+
+  const std::vector<int32> &Words() const { return words_; }
+
+  // Words separated by spaces
+  const std::string &Transcript() const { return transcript_; }
+
+  // Finds out how many words of the path are committed, i.e. shared by
+  // the paths of all the tokens that are still active, so that the best
+  // path can no longer change them. Must be called after Update(), with
+  // the same decoder. Returns the number of committed words, which never
+  // decreases between calls to Reset().
+  size_t UpdateCommitted(const LatticeFasterOnlineDecoder &decoder);
+
+  size_t NumCommittedWords() const { return num_committed_words_; }
+
+  // Returns the position from which the words differ from what they were
+  // at the last call of this function (or of Reset()) and remembers the
+  // current words and commitments. Returns false if neither the words nor
+  // the number of committed words have changed.
+  bool TakeDelta(size_t *offset);
+
+ private:
+  struct PathElement {
+    void *tok;
+    int32 frame;
+    // Number of words on the path up to and including this element
+    size_t num_words;
+  };
+
+  const fst::SymbolTable *word_syms_;
+  std::vector<PathElement> path_;
+  // Position of each token of the path in path_
+  std::unordered_map<void*, size_t> positions_;
+  std::vector<int32> words_;
+  std::string transcript_;
+  // End of each word in transcript_
+  std::vector<size_t> word_ends_;
+  size_t num_committed_words_;
+
+  // Since the last TakeDelta()
+  std::vector<int32> delta_words_;
+  size_t delta_num_committed_words_;
+  size_t num_unchanged_words_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(IncrementalTraceback);
+};
+
+// Number of tokens on the last frame that the decoder has decoded
+int32 NumActiveTokens(const LatticeFasterOnlineDecoder &decoder);
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_INCREMENTAL_TRACEBACK_H_
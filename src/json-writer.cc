@@ -0,0 +1,172 @@
+// json-writer.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <cstring>
+
+#include <glib.h>
+
+#include "./json-writer.h"
+
+namespace kaldi {
+
+void JsonWriter::Reset() {
+  buffer_.clear();
+  empty_.clear();
+  after_key_ = false;
+}
+
+void JsonWriter::BeginValue() {
+  if (after_key_) {
+    after_key_ = false;
+  } else if (!empty_.empty()) {
+    if (!empty_.back())
+      buffer_ += ", ";
+    empty_.back() = false;
+  }
+}
+
+void JsonWriter::BeginObject() {
+  BeginValue();
+  buffer_ += '{';
+  empty_.push_back(true);
+}
+
+void JsonWriter::EndObject() {
+  empty_.pop_back();
+  buffer_ += '}';
+}
+
+void JsonWriter::BeginArray() {
+  BeginValue();
+  buffer_ += '[';
+  empty_.push_back(true);
+}
+
+void JsonWriter::EndArray() {
+  empty_.pop_back();
+  buffer_ += ']';
+}
+
+void JsonWriter::Key(const char *key) {
+  BeginValue();
+  buffer_ += '"';
+  buffer_ += key;
+  buffer_ += "\": ";
+  after_key_ = true;
+}
+
+void JsonWriter::Int(int64 value) {
+  BeginValue();
+  char str[32];
+  g_snprintf(str, sizeof(str), "%" G_GINT64_FORMAT, static_cast<gint64>(value));
+  buffer_ += str;
+}
+
+void JsonWriter::Real(double value) {
+  BeginValue();
+  if (!std::isfinite(value)) {
+    buffer_ += "null";
+    return;
+  }
+  // Like jansson: "%.6g" in the C locale, with ".0" added to integral
+  // values and the exponent without a '+' or leading zeros
+  char str[G_ASCII_DTOSTR_BUF_SIZE];
+  g_ascii_formatd(str, sizeof(str), "%.6g", value);
+  char *exponent = strchr(str, 'e');
+  if (exponent == NULL) {
+    buffer_ += str;
+    if (strchr(str, '.') == NULL)
+      buffer_ += ".0";
+    return;
+  }
+  buffer_.append(str, exponent + 1 - str);
+  const char *digits = exponent + 1;
+  if (*digits == '+') {
+    digits++;
+  } else if (*digits == '-') {
+    buffer_ += '-';
+    digits++;
+  }
+  while (*digits == '0' && digits[1] != '\0')
+    digits++;
+  buffer_ += digits;
+}
+
+void JsonWriter::Bool(bool value) {
+  BeginValue();
+  buffer_ += value ? "true" : "false";
+}
+
+void JsonWriter::String(const char *str) {
+  BeginString();
+  Escape(str, &buffer_);
+  EndString();
+}
+
+void JsonWriter::BeginString() {
+  BeginValue();
+  buffer_ += '"';
+}
+
+void JsonWriter::AppendEscaped(const std::string &escaped) {
+  buffer_ += escaped;
+}
+
+void JsonWriter::EndString() {
+  buffer_ += '"';
+}
+
+void JsonWriter::Escape(const char *str, std::string *out) {
+  for (const char *c = str; *c != '\0'; c++) {
+    switch (*c) {
+      case '"': *out += "\\\""; break;
+      case '\\': *out += "\\\\"; break;
+      case '\b': *out += "\\b"; break;
+      case '\f': *out += "\\f"; break;
+      case '\n': *out += "\\n"; break;
+      case '\r': *out += "\\r"; break;
+      case '\t': *out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(*c) < 0x20) {
+          char escaped[8];
+          g_snprintf(escaped, sizeof(escaped), "\\u%04X", *c);
+          *out += escaped;
+        } else {
+          *out += *c;
+        }
+    }
+  }
+}
+
+
+JsonSymbolTable::JsonSymbolTable(const fst::SymbolTable &syms) {
+  int64 num_symbols = syms.AvailableKey();
+  symbols_.resize(num_symbols);
+  for (fst::SymbolTableIterator it(syms); !it.Done(); it.Next()) {
+    int64 id = it.Value();
+    if (id < 0)
+      continue;
+    if (id >= static_cast<int64>(symbols_.size()))
+      symbols_.resize(id + 1);
+    JsonWriter::Escape(it.Symbol().c_str(), &symbols_[id]);
+  }
+}
+
+}  // namespace kaldi
@@ -0,0 +1,110 @@
+// json-writer.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_JSON_WRITER_H_
+#define KALDI_SRC_JSON_WRITER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fst/symbol-table.h"
+
+namespace kaldi {
+
+// Streaming JSON serializer that writes into a buffer which is reused from
+// one document to the next, so that once the buffer has grown to the size
+// of a typical result, writing a result doesn't allocate any memory.
+//
+// The output is formatted like json_dumps() of jansson with the default
+// flags and JSON_REAL_PRECISION(6), with object keys in the order in which
+// they are written. The writer doesn't check that the document is well
+// formed; keys must not need escaping.
+class JsonWriter {
+ public:
+  JsonWriter() : after_key_(false) { }
+
+  // Starts a new document, keeping the memory of the buffer
+  void Reset();
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+
+  void Key(const char *key);
+
+  void Int(int64 value);
+  // Non-finite values are written as null
+  void Real(double value);
+  void Bool(bool value);
+  // Escapes the (UTF-8) string
+  void String(const char *str);
+
+  // A string value made of already escaped pieces, e.g. from a
+  // JsonSymbolTable
+  void BeginString();
+  void AppendEscaped(const std::string &escaped);
+  void AppendEscaped(char c) { buffer_ += c; }
+  void EndString();
+
+  const char *c_str() const { return buffer_.c_str(); }
+  const std::string &str() const { return buffer_; }
+
+  // Appends the contents of a JSON string literal for 'str' to 'out',
+  // without the quotes
+  static void Escape(const char *str, std::string *out);
+
+ private:
+  // Writes the separator that comes before a value or key
+  void BeginValue();
+
+  std::string buffer_;
+  // For each open object and array, whether nothing has been written into
+  // it yet
+  std::vector<bool> empty_;
+  bool after_key_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(JsonWriter);
+};
+
+// The symbols of a symbol table, escaped for JSON strings once when the
+// table is loaded instead of every time they are output.
+class JsonSymbolTable {
+ public:
+  explicit JsonSymbolTable(const fst::SymbolTable &syms);
+
+  // Returns the escaped symbol, or an empty string if there is no symbol
+  // with the given id (like fst::SymbolTable::Find())
+  const std::string &Find(int64 id) const {
+    if (id < 0 || id >= static_cast<int64>(symbols_.size()))
+      return empty_;
+    return symbols_[id];
+  }
+
+ private:
+  std::vector<std::string> symbols_;
+  std::string empty_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(JsonSymbolTable);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_JSON_WRITER_H_
@@ -0,0 +1,71 @@
+// kaldi-result.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./kaldi-result.h"
+
+GType gst_kaldi_result_meta_api_get_type(void) {
+  static volatile gsize type = 0;
+  static const gchar *tags[] = { NULL };
+  if (g_once_init_enter(&type)) {
+    GType api_type = gst_meta_api_type_register("GstKaldiResultMetaAPI", tags);
+    g_once_init_leave(&type, api_type);
+  }
+  return type;
+}
+
+static gboolean gst_kaldi_result_meta_init(GstMeta *meta, gpointer params,
+                                           GstBuffer *buffer) {
+  GstKaldiResultMeta *result_meta = (GstKaldiResultMeta*) meta;
+  result_meta->audio_pts = GST_CLOCK_TIME_NONE;
+  result_meta->audio_duration = GST_CLOCK_TIME_NONE;
+  return TRUE;
+}
+
+static gboolean gst_kaldi_result_meta_transform(GstBuffer *dest, GstMeta *meta,
+                                                GstBuffer *buffer, GQuark type,
+                                                gpointer data) {
+  GstKaldiResultMeta *result_meta = (GstKaldiResultMeta*) meta;
+  // The timestamps stay valid for copies and parts of the buffer
+  gst_buffer_add_kaldi_result_meta(dest, result_meta->audio_pts,
+                                   result_meta->audio_duration);
+  return TRUE;
+}
+
+const GstMetaInfo *gst_kaldi_result_meta_get_info(void) {
+  static const GstMetaInfo *meta_info = NULL;
+  if (g_once_init_enter((GstMetaInfo **) &meta_info)) {
+    const GstMetaInfo *info =
+        gst_meta_register(GST_KALDI_RESULT_META_API_TYPE, "GstKaldiResultMeta",
+                          sizeof(GstKaldiResultMeta),
+                          gst_kaldi_result_meta_init, NULL,
+                          gst_kaldi_result_meta_transform);
+    g_once_init_leave((GstMetaInfo **) &meta_info, (GstMetaInfo *) info);
+  }
+  return meta_info;
+}
+
+GstKaldiResultMeta *gst_buffer_add_kaldi_result_meta(GstBuffer *buffer,
+                                                     GstClockTime audio_pts,
+                                                     GstClockTime audio_duration) {
+  GstKaldiResultMeta *result_meta = (GstKaldiResultMeta*)
+      gst_buffer_add_meta(buffer, GST_KALDI_RESULT_META_INFO, NULL);
+  result_meta->audio_pts = audio_pts;
+  result_meta->audio_duration = audio_duration;
+  return result_meta;
+}
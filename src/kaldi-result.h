@@ -0,0 +1,101 @@
+// kaldi-result.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_KALDI_RESULT_H_
+#define KALDI_SRC_KALDI_RESULT_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Binary final results, pushed on the src pad of kaldinnet2onlinedecoder
+ * instead of text when downstream accepts KALDI_RESULT_MEDIA_TYPE.
+ *
+ * Each buffer holds the results of one segment: a KaldiResultHeader,
+ * followed by num_hypotheses times a KaldiResultHypothesis, its num_words
+ * KaldiResultTokens for the words and its num_phones KaldiResultTokens for
+ * the phones. All fields are in host byte order and times are in seconds.
+ * Words and phones are given by their ids in the word and phone symbol
+ * tables of the decoder.
+ */
+
+#define KALDI_RESULT_MEDIA_TYPE "application/x-kaldi-result"
+
+#define KALDI_RESULT_MAGIC 0x5345524b  /* "KRES" */
+#define KALDI_RESULT_VERSION 1
+
+/* KaldiResultHeader flags */
+#define KALDI_RESULT_FINAL (1 << 0)
+
+/* KaldiResultHypothesis flags */
+#define KALDI_RESULT_WORD_ALIGNMENT (1 << 0)  /* words have times and confidences */
+
+typedef struct {
+  guint32 magic;
+  guint16 version;
+  guint16 flags;
+  guint32 num_hypotheses;
+  gfloat segment_start;
+  gfloat segment_length;
+  gfloat total_length;
+} KaldiResultHeader;
+
+typedef struct {
+  guint32 flags;
+  gfloat likelihood;
+  guint32 num_words;
+  guint32 num_phones;
+} KaldiResultHypothesis;
+
+typedef struct {
+  gint32 id;
+  gfloat start;
+  gfloat length;
+  gfloat confidence;
+} KaldiResultToken;
+
+/*
+ * Attached to the binary result buffers: the timestamp and duration of the
+ * audio of the segment, based on the timestamp of the first audio buffer.
+ * Applications that don't link with the plugin can get the API type with
+ * g_type_from_name("GstKaldiResultMetaAPI").
+ */
+typedef struct {
+  GstMeta meta;
+  GstClockTime audio_pts;
+  GstClockTime audio_duration;
+} GstKaldiResultMeta;
+
+GType gst_kaldi_result_meta_api_get_type(void);
+#define GST_KALDI_RESULT_META_API_TYPE (gst_kaldi_result_meta_api_get_type())
+
+const GstMetaInfo *gst_kaldi_result_meta_get_info(void);
+#define GST_KALDI_RESULT_META_INFO (gst_kaldi_result_meta_get_info())
+
+#define gst_buffer_get_kaldi_result_meta(b) \
+  ((GstKaldiResultMeta*)gst_buffer_get_meta((b), GST_KALDI_RESULT_META_API_TYPE))
+
+GstKaldiResultMeta *gst_buffer_add_kaldi_result_meta(GstBuffer *buffer,
+                                                     GstClockTime audio_pts,
+                                                     GstClockTime audio_duration);
+
+G_END_DECLS
+
+#endif  // KALDI_SRC_KALDI_RESULT_H_
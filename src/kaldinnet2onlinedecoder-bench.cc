@@ -0,0 +1,513 @@
+// kaldinnet2onlinedecoder-bench.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+// Decodes many streams at once, each in its own
+// "appsrc ! kaldinnet2onlinedecoder ! appsink" pipeline in this process,
+// and reports throughput, latencies and resource usage as JSON, e.g.:
+//
+//   GST_PLUGIN_PATH=. ./kaldinnet2onlinedecoder-bench -n 8 --realtime
+//       wavs.txt model=final.mdl fst=HCLG.fst word-syms=words.txt ... > bench.json
+//
+// The arguments after the list of WAV files are decoder properties, as
+// they would be given to gst-launch-1.0.
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+
+namespace {
+
+struct WavFile {
+  std::string filename;
+  gchar *contents;
+  // 16-bit PCM samples within contents
+  const guint8 *data;
+  gsize data_size;
+  gint rate;
+  gint channels;
+
+  double Duration() const { return 1.0 * data_size / (2 * channels * rate); }
+};
+
+struct LatencyStats {
+  std::vector<double> values;
+
+  void Add(double value) { values.push_back(value); }
+  void Add(const LatencyStats &other) {
+    values.insert(values.end(), other.values.begin(), other.values.end());
+  }
+  double Percentile(double q) const {
+    if (values.empty())
+      return 0.0;
+    std::vector<double> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = std::max<size_t>(static_cast<size_t>(q * sorted.size() + 0.5), 1);
+    return sorted[std::min(rank, sorted.size()) - 1];
+  }
+};
+
+struct Stream {
+  int id;
+  const WavFile *wav;
+  GstElement *pipeline;
+  GstElement *appsrc;
+  GThread *thread;
+  gint64 start_time;
+  gint64 end_time;
+  std::string error;
+
+  // Protects the fields below, which are updated from the decoder's threads
+  GMutex lock;
+  // When the audio up to each position (in seconds) was pushed
+  std::vector<std::pair<double, gint64> > pushes;
+  // The first push not followed by a partial result yet
+  size_t num_pushes_with_partial;
+  int num_partial_results;
+  int num_segments;
+  LatencyStats partial_latency;
+  LatencyStats final_latency;
+  // From the kaldi-segment-stats messages
+  std::map<std::string, LatencyStats> segment_stats;
+};
+
+gboolean realtime = FALSE;
+gint num_streams = 0;
+gint chunk_ms = 100;
+gchar *output_filename = NULL;
+gchar *label = NULL;
+
+GOptionEntry entries[] = {
+  { "num-streams", 'n', 0, G_OPTION_ARG_INT, &num_streams,
+    "Number of concurrent streams, which take the WAV files in turn (default: one per file)", "N" },
+  { "realtime", 'r', 0, G_OPTION_ARG_NONE, &realtime,
+    "Feed the audio at real-time pace rather than as fast as possible", NULL },
+  { "chunk-ms", 'c', 0, G_OPTION_ARG_INT, &chunk_ms,
+    "Length of the audio buffers pushed, in milliseconds (default: 100)", "MS" },
+  { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_filename,
+    "Write the results to this file instead of stdout", "FILE" },
+  { "label", 'l', 0, G_OPTION_ARG_STRING, &label,
+    "Label of the run (e.g. the release) to include in the results", "LABEL" },
+  { NULL }
+};
+
+guint16 ReadUint16(const guint8 *p) { return p[0] | (p[1] << 8); }
+guint32 ReadUint32(const guint8 *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24); }
+
+// Reads a 16-bit PCM WAV file, returns false with a message on errors
+bool ReadWav(const std::string &filename, WavFile *wav, std::string *error) {
+  gsize size;
+  GError *gerror = NULL;
+  if (!g_file_get_contents(filename.c_str(), &wav->contents, &size, &gerror)) {
+    *error = gerror->message;
+    g_error_free(gerror);
+    return false;
+  }
+  wav->filename = filename;
+  const guint8 *p = reinterpret_cast<const guint8*>(wav->contents);
+  if (size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+    *error = "not a WAV file";
+    return false;
+  }
+  bool have_format = false;
+  gsize pos = 12;
+  while (pos + 8 <= size) {
+    const guint8 *chunk = p + pos;
+    gsize chunk_size = std::min<gsize>(ReadUint32(chunk + 4), size - pos - 8);
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16) {
+      guint16 format = ReadUint16(chunk + 8);
+      wav->channels = ReadUint16(chunk + 10);
+      wav->rate = ReadUint32(chunk + 12);
+      guint16 bits = ReadUint16(chunk + 22);
+      // PCM, possibly as WAVE_FORMAT_EXTENSIBLE
+      if ((format != 1 && format != 0xFFFE) || bits != 16 || wav->channels == 0) {
+        *error = "only 16-bit PCM is supported";
+        return false;
+      }
+      have_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0 && have_format) {
+      wav->data = chunk + 8;
+      wav->data_size = chunk_size - chunk_size % (2 * wav->channels);
+      return true;
+    }
+    pos += 8 + chunk_size + (chunk_size & 1);
+  }
+  *error = "no audio data";
+  return false;
+}
+
+// Time when the audio up to 'position' was pushed, or 0 if not known
+gint64 PushTime(const Stream *stream, double position) {
+  for (size_t i = 0; i < stream->pushes.size(); i++) {
+    // Positions in the results are rounded to frames
+    if (stream->pushes[i].first >= position - 0.01)
+      return stream->pushes[i].second;
+  }
+  return 0;
+}
+
+// The latency of a partial result is the time since the oldest audio that
+// had not been followed by a partial result yet was pushed
+void OnPartialResult(GstElement *decoder, const gchar *result, gpointer data) {
+  Stream *stream = static_cast<Stream*>(data);
+  gint64 now = g_get_monotonic_time();
+  g_mutex_lock(&stream->lock);
+  stream->num_partial_results++;
+  if (stream->num_pushes_with_partial < stream->pushes.size()) {
+    gint64 push_time = stream->pushes[stream->num_pushes_with_partial].second;
+    stream->partial_latency.Add(1.0 * (now - push_time) / G_USEC_PER_SEC);
+    stream->num_pushes_with_partial = stream->pushes.size();
+  }
+  g_mutex_unlock(&stream->lock);
+}
+
+// The latency of a final result is the time since the end of its segment
+// was pushed, until the kaldi-segment-stats message that follows the
+// results
+GstBusSyncReply OnMessage(GstBus *bus, GstMessage *message, gpointer data) {
+  Stream *stream = static_cast<Stream*>(data);
+  const GstStructure *structure = gst_message_get_structure(message);
+  if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ELEMENT
+      || !gst_structure_has_name(structure, "kaldi-segment-stats"))
+    return GST_BUS_PASS;
+
+  gint64 now = g_get_monotonic_time();
+  gdouble segment_start = 0.0, audio_duration = 0.0;
+  gst_structure_get_double(structure, "segment-start", &segment_start);
+  gst_structure_get_double(structure, "audio-duration", &audio_duration);
+  g_mutex_lock(&stream->lock);
+  stream->num_segments++;
+  gint64 push_time = PushTime(stream, segment_start + audio_duration);
+  if (push_time > 0)
+    stream->final_latency.Add(1.0 * (now - push_time) / G_USEC_PER_SEC);
+  const char *fields[] = { "feature-time", "nnet-time", "search-time", "lattice-time",
+                           "rescore-time", "nbest-time", "json-time",
+                           "final-result-latency", NULL };
+  for (int i = 0; fields[i] != NULL; i++) {
+    gdouble value;
+    if (gst_structure_get_double(structure, fields[i], &value))
+      stream->segment_stats[fields[i]].Add(value);
+  }
+  g_mutex_unlock(&stream->lock);
+  gst_message_unref(message);
+  return GST_BUS_DROP;
+}
+
+gpointer FeedStream(gpointer data) {
+  Stream *stream = static_cast<Stream*>(data);
+  const WavFile *wav = stream->wav;
+  gsize bytes_per_second = 2 * wav->channels * wav->rate;
+  gsize chunk_size = bytes_per_second * chunk_ms / 1000;
+  chunk_size -= chunk_size % (2 * wav->channels);
+
+  stream->start_time = g_get_monotonic_time();
+  for (gsize offset = 0; offset < wav->data_size; offset += chunk_size) {
+    gsize size = std::min(chunk_size, wav->data_size - offset);
+    double end_position = 1.0 * (offset + size) / bytes_per_second;
+    if (realtime) {
+      // A buffer can be pushed when all of its audio would have arrived
+      gint64 due = stream->start_time + static_cast<gint64>(end_position * G_USEC_PER_SEC);
+      gint64 now = g_get_monotonic_time();
+      if (due > now)
+        g_usleep(due - now);
+    }
+    GstBuffer *buffer = gst_buffer_new_wrapped_full(
+        GST_MEMORY_FLAG_READONLY, const_cast<guint8*>(wav->data + offset),
+        size, 0, size, NULL, NULL);
+    GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(offset, GST_SECOND, bytes_per_second);
+    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(size, GST_SECOND, bytes_per_second);
+    // Blocks while the queue of appsrc is full
+    if (gst_app_src_push_buffer(GST_APP_SRC(stream->appsrc), buffer) != GST_FLOW_OK)
+      break;
+    g_mutex_lock(&stream->lock);
+    stream->pushes.push_back(std::make_pair(end_position, g_get_monotonic_time()));
+    g_mutex_unlock(&stream->lock);
+  }
+  gst_app_src_end_of_stream(GST_APP_SRC(stream->appsrc));
+
+  GstBus *bus = gst_element_get_bus(stream->pipeline);
+  GstMessage *message = gst_bus_timed_pop_filtered(
+      bus, GST_CLOCK_TIME_NONE,
+      static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  stream->end_time = g_get_monotonic_time();
+  if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+    GError *error = NULL;
+    gst_message_parse_error(message, &error, NULL);
+    stream->error = error->message;
+    g_error_free(error);
+  }
+  gst_message_unref(message);
+  gst_object_unref(bus);
+  return NULL;
+}
+
+std::string JsonString(const std::string &str) {
+  std::string result = "\"";
+  for (size_t i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      g_snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      result += escaped;
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+
+std::string JsonNumber(double value) {
+  gchar buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  return g_ascii_formatd(buffer, sizeof(buffer), "%.6g", value);
+}
+
+std::string JsonPercentiles(const LatencyStats &stats) {
+  return "{\"count\": " + JsonNumber(stats.values.size())
+      + ", \"p50\": " + JsonNumber(stats.Percentile(0.50))
+      + ", \"p95\": " + JsonNumber(stats.Percentile(0.95))
+      + ", \"p99\": " + JsonNumber(stats.Percentile(0.99)) + "}";
+}
+
+double CpuTime() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+      + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context = g_option_context_new(
+      "WAV-LIST [PROPERTY=VALUE ...] - benchmark the kaldinnet2onlinedecoder element");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  GError *error = NULL;
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free(context);
+  if (argc < 2) {
+    g_printerr("Usage: %s [OPTIONS] WAV-LIST [PROPERTY=VALUE ...]\n", argv[0]);
+    return 1;
+  }
+  if (chunk_ms <= 0) {
+    g_printerr("--chunk-ms must be positive\n");
+    return 1;
+  }
+
+  gchar *list;
+  if (!g_file_get_contents(argv[1], &list, NULL, &error)) {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  std::vector<WavFile> wavs;
+  gchar **lines = g_strsplit(list, "\n", -1);
+  for (gchar **line = lines; *line != NULL; line++) {
+    g_strstrip(*line);
+    if (**line == '\0' || **line == '#')
+      continue;
+    WavFile wav;
+    std::string message;
+    if (!ReadWav(*line, &wav, &message)) {
+      g_printerr("Cannot read %s: %s\n", *line, message.c_str());
+      return 1;
+    }
+    wavs.push_back(wav);
+  }
+  g_strfreev(lines);
+  g_free(list);
+  if (wavs.empty()) {
+    g_printerr("No WAV files in %s\n", argv[1]);
+    return 1;
+  }
+  if (num_streams <= 0)
+    num_streams = wavs.size();
+
+  std::string properties;
+  for (int i = 2; i < argc; i++) {
+    properties += " ";
+    properties += argv[i];
+  }
+
+  std::vector<Stream*> streams;
+  for (int i = 0; i < num_streams; i++) {
+    Stream *stream = new Stream();
+    stream->id = i;
+    stream->wav = &wavs[i % wavs.size()];
+    stream->num_pushes_with_partial = 0;
+    stream->num_partial_results = 0;
+    stream->num_segments = 0;
+    g_mutex_init(&stream->lock);
+    gchar *description = g_strdup_printf(
+        "appsrc name=src format=time block=true max-bytes=%d "
+        "caps=audio/x-raw,format=S16LE,layout=interleaved,rate=%d,channels=%d "
+        "! kaldinnet2onlinedecoder name=decoder%s "
+        "! appsink name=sink sync=false drop=true max-buffers=16",
+        2 * stream->wav->channels * stream->wav->rate,  // one second
+        stream->wav->rate, stream->wav->channels, properties.c_str());
+    stream->pipeline = gst_parse_launch(description, &error);
+    g_free(description);
+    if (stream->pipeline == NULL) {
+      g_printerr("Cannot create the pipeline: %s\n", error->message);
+      return 1;
+    }
+    stream->appsrc = gst_bin_get_by_name(GST_BIN(stream->pipeline), "src");
+    GstElement *decoder = gst_bin_get_by_name(GST_BIN(stream->pipeline), "decoder");
+    g_signal_connect(decoder, "partial-result", G_CALLBACK(OnPartialResult), stream);
+    gst_object_unref(decoder);
+    GstBus *bus = gst_element_get_bus(stream->pipeline);
+    gst_bus_set_sync_handler(bus, OnMessage, stream, NULL);
+    gst_object_unref(bus);
+    // The models have been loaded when the properties were set (unless
+    // async-model-loading is on), so loading is not part of the run
+    if (gst_element_set_state(stream->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+      g_printerr("Cannot start stream %d\n", i);
+      return 1;
+    }
+    streams.push_back(stream);
+  }
+
+  double start_cpu_time = CpuTime();
+  gint64 start_time = g_get_monotonic_time();
+  for (size_t i = 0; i < streams.size(); i++)
+    streams[i]->thread = g_thread_new("bench-feed", FeedStream, streams[i]);
+  for (size_t i = 0; i < streams.size(); i++)
+    g_thread_join(streams[i]->thread);
+  double wall_time = 1.0 * (g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+  double cpu_time = CpuTime() - start_cpu_time;
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  double audio_duration = 0.0;
+  int num_errors = 0;
+  LatencyStats partial_latency, final_latency;
+  std::map<std::string, LatencyStats> segment_stats;
+  std::string streams_json;
+  for (size_t i = 0; i < streams.size(); i++) {
+    Stream *stream = streams[i];
+    gst_element_set_state(stream->pipeline, GST_STATE_NULL);
+    double duration = stream->wav->Duration();
+    double stream_time = 1.0 * (stream->end_time - stream->start_time) / G_USEC_PER_SEC;
+    audio_duration += duration;
+    partial_latency.Add(stream->partial_latency);
+    final_latency.Add(stream->final_latency);
+    for (std::map<std::string, LatencyStats>::const_iterator it = stream->segment_stats.begin();
+         it != stream->segment_stats.end(); ++it) {
+      segment_stats[it->first].Add(it->second);
+    }
+    if (!stream->error.empty()) {
+      num_errors++;
+      g_printerr("Stream %d (%s) failed: %s\n", stream->id,
+                 stream->wav->filename.c_str(), stream->error.c_str());
+    }
+    streams_json += std::string(i > 0 ? ",\n" : "\n")
+        + "    {\"id\": " + JsonNumber(stream->id)
+        + ", \"wav\": " + JsonString(stream->wav->filename)
+        + ", \"audio-duration\": " + JsonNumber(duration)
+        + ", \"wall-time\": " + JsonNumber(stream_time)
+        + ", \"real-time-factor\": " + JsonNumber(duration > 0 ? stream_time / duration : 0.0)
+        + ", \"segments\": " + JsonNumber(stream->num_segments)
+        + ", \"partial-results\": " + JsonNumber(stream->num_partial_results)
+        + ", \"partial-latency\": " + JsonPercentiles(stream->partial_latency)
+        + ", \"final-latency\": " + JsonPercentiles(stream->final_latency)
+        + (stream->error.empty() ? "" : ", \"error\": " + JsonString(stream->error))
+        + "}";
+  }
+
+  std::string segment_stats_json;
+  for (std::map<std::string, LatencyStats>::const_iterator it = segment_stats.begin();
+       it != segment_stats.end(); ++it) {
+    segment_stats_json += std::string(segment_stats_json.empty() ? "\n" : ",\n")
+        + "    " + JsonString(it->first) + ": " + JsonPercentiles(it->second);
+  }
+
+  FILE *output = stdout;
+  if (output_filename != NULL && (output = fopen(output_filename, "w")) == NULL) {
+    g_printerr("Cannot write to %s\n", output_filename);
+    return 1;
+  }
+  fprintf(output,
+          "{\n"
+          "  \"label\": %s,\n"
+          "  \"properties\": %s,\n"
+          "  \"num-streams\": %d,\n"
+          "  \"realtime\": %s,\n"
+          "  \"chunk-length\": %s,\n"
+          "  \"audio-duration\": %s,\n"
+          "  \"wall-time\": %s,\n"
+          "  \"real-time-factor\": %s,\n"
+          "  \"cpu-time\": %s,\n"
+          "  \"mean-cpu-time-per-stream\": %s,\n"
+          "  \"cpu-real-time-factor\": %s,\n"
+          "  \"peak-rss-kb\": %ld,\n"
+          "  \"errors\": %d,\n"
+          "  \"partial-latency\": %s,\n"
+          "  \"final-latency\": %s,\n"
+          "  \"segment-stats\": {%s\n  },\n"
+          "  \"streams\": [%s\n  ]\n"
+          "}\n",
+          JsonString(label != NULL ? label : "").c_str(),
+          JsonString(properties.empty() ? "" : properties.substr(1)).c_str(),
+          num_streams,
+          realtime ? "true" : "false",
+          JsonNumber(chunk_ms / 1000.0).c_str(),
+          JsonNumber(audio_duration).c_str(),
+          JsonNumber(wall_time).c_str(),
+          JsonNumber(audio_duration > 0 ? wall_time / audio_duration : 0.0).c_str(),
+          JsonNumber(cpu_time).c_str(),
+          JsonNumber(cpu_time / num_streams).c_str(),
+          JsonNumber(audio_duration > 0 ? cpu_time / audio_duration : 0.0).c_str(),
+          usage.ru_maxrss,
+          num_errors,
+          JsonPercentiles(partial_latency).c_str(),
+          JsonPercentiles(final_latency).c_str(),
+          segment_stats_json.c_str(),
+          streams_json.c_str());
+  if (output != stdout)
+    fclose(output);
+
+  g_printerr("%d streams, %.1f s of audio in %.1f s: real-time factor %.3f, "
+             "final latency p50 %.3f s p95 %.3f s, peak RSS %ld MB\n",
+             num_streams, audio_duration, wall_time,
+             audio_duration > 0 ? wall_time / audio_duration : 0.0,
+             final_latency.Percentile(0.50), final_latency.Percentile(0.95),
+             usage.ru_maxrss / 1024);
+
+  for (size_t i = 0; i < streams.size(); i++) {
+    gst_object_unref(streams[i]->appsrc);
+    gst_object_unref(streams[i]->pipeline);
+    g_mutex_clear(&streams[i]->lock);
+    delete streams[i];
+  }
+  for (size_t i = 0; i < wavs.size(); i++)
+    g_free(wavs[i].contents);
+  return num_errors > 0 ? 1 : 0;
+}
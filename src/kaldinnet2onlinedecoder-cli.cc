@@ -0,0 +1,259 @@
+// kaldinnet2onlinedecoder-cli.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Decodes the utterances of a wav table with the decoder of the plugin,
+// but without GStreamer, so that the decoding itself can be profiled and
+// benchmarked, e.g.:
+//
+//   ./kaldinnet2onlinedecoder-cli --nnet-mode=3 --word-syms=words.txt
+//       --mfcc-config=conf/mfcc.conf final.mdl HCLG.fst scp:wav.scp
+//
+// Each final result is printed on a line of its own, after the utterance
+// id; the time spent on each stage of decoding is logged at the end.
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "./stream-decoder.h"
+
+#include "base/timer.h"
+#include "feat/wave-reader.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+// Passes a waveform to the decoder in the pieces it asks for
+class WaveAudioSource : public StreamAudioSource {
+ public:
+  explicit WaveAudioSource(const VectorBase<BaseFloat> &wave)
+      : wave_(wave), pos_(0) { }
+
+  virtual bool Read(Vector<BaseFloat> *data) {
+    int32 n = std::min(data->Dim(), wave_.Dim() - pos_);
+    bool more_data = (n == data->Dim());
+    if (!more_data) {
+      data->Resize(n, kUndefined);
+    }
+    if (n > 0) {
+      data->CopyFromVec(wave_.Range(pos_, n));
+    }
+    pos_ += n;
+    return more_data;
+  }
+
+ private:
+  const VectorBase<BaseFloat> &wave_;
+  int32 pos_;
+};
+
+// Prints the final results and adds up the processing times
+class CliListener : public StreamDecoderListener {
+ public:
+  CliListener(ModelSet *models, bool json)
+      : models_(models), json_(json), num_segments_(0),
+        processing_time_(0.0) { }
+
+  void SetUtterance(const std::string &utt) { utt_ = utt; }
+
+  virtual ModelSet *AcquireModels() {
+    models_->Ref();
+    return models_;
+  }
+
+  virtual bool WantsResultJson() { return json_; }
+
+  virtual void FinalResult(const SegmentResult &result) {
+    std::cout << utt_ << ' '
+              << (result.json != NULL ? result.json : result.transcript)
+              << std::endl;
+  }
+
+  virtual void SegmentDone(const SegmentStats &stats) {
+    num_segments_++;
+    processing_time_ += stats.feature_time + stats.nnet_time
+        + stats.search_time + stats.lattice_time + stats.rescore_time
+        + stats.nbest_time + stats.json_time;
+  }
+
+  int32 NumSegments() const { return num_segments_; }
+  double ProcessingTime() const { return processing_time_; }
+
+ private:
+  ModelSet *models_;
+  bool json_;
+  std::string utt_;
+  int32 num_segments_;
+  double processing_time_;
+};
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Decodes the utterances of a wav table like the kaldinnet2onlinedecoder\n"
+        "GStreamer element does, and prints their final results (one line per\n"
+        "segment, after the utterance id) and the time spent on each stage\n"
+        "of decoding.\n"
+        "\n"
+        "Usage: kaldinnet2onlinedecoder-cli [options] <model-in> <fst-in> "
+        "<wav-rspecifier>\n"
+        "e.g.: kaldinnet2onlinedecoder-cli --nnet-mode=3 --word-syms=words.txt \\\n"
+        "  --mfcc-config=conf/mfcc.conf final.mdl HCLG.fst scp:wav.scp\n";
+    ParseOptions po(usage);
+
+    std::string word_syms_filename, phone_syms_filename,
+        word_boundary_filename, lm_fst_filename, big_lm_filename;
+    bool fst_mmap = false, json = false;
+    int32 big_lm_cache_mb = 64;
+    po.Register("word-syms", &word_syms_filename, "Word symbol table");
+    po.Register("phone-syms", &phone_syms_filename,
+                "Phone symbol table, for phone alignments");
+    po.Register("word-boundary-file", &word_boundary_filename,
+                "Word boundary file, for word alignments");
+    po.Register("lm-fst", &lm_fst_filename,
+                "Old LM as FST, for rescoring with big-lm-const-arpa");
+    po.Register("big-lm-const-arpa", &big_lm_filename,
+                "Big LM in ConstArpaLm format, for rescoring the lattices");
+    po.Register("big-lm-cache-mb", &big_lm_cache_mb,
+                "Size of the big LM lookup cache in MB, 0 for none");
+    po.Register("fst-mmap", &fst_mmap, "Memory-map the decoding graph");
+    po.Register("json", &json,
+                "Print the full final results as JSON instead of transcripts");
+
+    StreamDecoderConfig config;
+    config.Register(&po);
+    OnlineNnet2FeaturePipelineConfig feature_config;
+    feature_config.Register(&po);
+
+    po.Read(argc, argv);
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      return 1;
+    }
+    if (word_syms_filename.empty()) {
+      KALDI_ERR << "--word-syms is required";
+    }
+    std::string model_rxfilename = po.GetArg(1),
+        fst_rxfilename = po.GetArg(2),
+        wav_rspecifier = po.GetArg(3);
+
+    ModelRegistry *registry = ModelRegistry::Instance();
+    ModelSet *models = new ModelSet();
+    models->SetAcousticModel(
+        registry->AcquireAcousticModel(
+            model_rxfilename,
+            config.nnet_mode == NNET2 ? NULL : &config.nnet3_decodable_opts),
+        model_rxfilename);
+    models->SetDecodeFst(registry->AcquireDecodeFst(fst_rxfilename, fst_mmap));
+    const fst::SymbolTable *word_syms =
+        registry->AcquireSymbolTable(word_syms_filename);
+    models->SetWordSyms(word_syms,
+                        registry->AcquireJsonSymbolTable(word_syms_filename, word_syms));
+    if (!phone_syms_filename.empty()) {
+      const fst::SymbolTable *phone_syms =
+          registry->AcquireSymbolTable(phone_syms_filename);
+      models->SetPhoneSyms(phone_syms,
+                           registry->AcquireJsonSymbolTable(phone_syms_filename, phone_syms));
+    }
+    if (!word_boundary_filename.empty()) {
+      models->SetWordBoundaryInfo(
+          registry->AcquireWordBoundaryInfo(word_boundary_filename));
+    }
+    if (!lm_fst_filename.empty() && !big_lm_filename.empty()) {
+      models->SetLmFst(registry->AcquireLmFst(lm_fst_filename));
+      models->SetBigLm(registry->AcquireConstArpaLm(big_lm_filename),
+                       static_cast<size_t>(big_lm_cache_mb) * 1024 * 1024);
+    }
+
+    OnlineNnet2FeaturePipelineInfo feature_info(feature_config);
+    int32 sample_rate = StreamDecoder::SampleRate(feature_info);
+    Matrix<double> global_cmvn_stats;
+    if (feature_config.global_cmvn_stats_rxfilename != "")
+      ReadKaldiObject(feature_config.global_cmvn_stats_rxfilename,
+                      &global_cmvn_stats);
+
+    StageProfiler profiler;
+    CliListener listener(models, json);
+    StreamDecoder decoder(&listener, &profiler);
+
+    SequentialTableReader<WaveHolder> wav_reader(wav_rspecifier);
+    int32 num_done = 0, num_err = 0;
+    double audio_duration = 0.0;
+    Timer timer;
+    for (; !wav_reader.Done(); wav_reader.Next()) {
+      std::string utt = wav_reader.Key();
+      const WaveData &wave_data = wav_reader.Value();
+      if (wave_data.SampFreq() != sample_rate) {
+        KALDI_WARN << "Sample rate of " << utt << " is " << wave_data.SampFreq()
+                   << ", the features need " << sample_rate;
+        num_err++;
+        continue;
+      }
+      // Only the first channel is decoded
+      SubVector<BaseFloat> wave(wave_data.Data(), 0);
+      WaveAudioSource audio_source(wave);
+      // Every utterance is decoded as a new speaker
+      OnlineIvectorExtractorAdaptationState adaptation_state(
+          feature_info.ivector_extractor_info);
+      OnlineCmvnState cmvn_state(global_cmvn_stats);
+
+      listener.SetUtterance(utt);
+      decoder.Decode(config, feature_info, &audio_source,
+                     &adaptation_state, &cmvn_state);
+      audio_duration += wave_data.Duration();
+      num_done++;
+    }
+    double elapsed = timer.Elapsed();
+
+    for (int32 i = 0; i < kNumProfilerStages; i++) {
+      ProfilerStage stage = static_cast<ProfilerStage>(i);
+      const LatencyHistogram &histogram = profiler.Histogram(stage);
+      if (histogram.Count() == 0)
+        continue;
+      KALDI_LOG << StageProfiler::StageName(stage) << ": " << histogram.Count()
+                << " times, p50 " << histogram.Percentile(0.50)
+                << " s, p95 " << histogram.Percentile(0.95)
+                << " s, p99 " << histogram.Percentile(0.99) << " s";
+    }
+    for (int32 i = 0; i < kNumProfilerCounters; i++) {
+      ProfilerCounter counter = static_cast<ProfilerCounter>(i);
+      KALDI_LOG << StageProfiler::CounterName(counter) << ": "
+                << profiler.Counter(counter);
+    }
+    KALDI_LOG << "Decoded " << num_done << " utterances (" << audio_duration
+              << " s of audio) in " << listener.NumSegments() << " segments, "
+              << num_err << " failed";
+    if (audio_duration > 0) {
+      KALDI_LOG << "Real-time factor " << elapsed / audio_duration
+                << " (wall time), " << listener.ProcessingTime() / audio_duration
+                << " (decoding stages)";
+    }
+
+    models->Unref();
+    return (num_done != 0 ? 0 : 1);
+  } catch (const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
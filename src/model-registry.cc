@@ -0,0 +1,590 @@
+// model-registry.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <glib/gstdio.h>
+
+#include "./model-registry.h"
+
+#include "nnet3/nnet-utils.h"
+#include "util/kaldi-io.h"
+
+namespace kaldi {
+
+namespace {
+
+template<class T>
+void DestroyObject(void *object) {
+  delete static_cast<T*>(object);
+}
+
+void *LoadAcousticModel(const std::string &rxfilename, const void *data) {
+  const nnet3::NnetSimpleLoopedComputationOptions *nnet3_opts =
+      static_cast<const nnet3::NnetSimpleLoopedComputationOptions*>(data);
+  AcousticModel *model = new AcousticModel();
+  try {
+    bool binary;
+    Input ki(rxfilename, &binary);
+    model->trans_model.Read(ki.Stream(), binary);
+    if (nnet3_opts == NULL) {
+      model->am_nnet2.Read(ki.Stream(), binary);
+    } else {
+      model->am_nnet3.Read(ki.Stream(), binary);
+      nnet3::SetBatchnormTestMode(true, &(model->am_nnet3.GetNnet()));
+      nnet3::SetDropoutTestMode(true, &(model->am_nnet3.GetNnet()));
+      // this object contains precomputed stuff that is used by all decodable
+      // objects.  It takes a pointer to am_nnet because if it has iVectors it has
+      // to modify the nnet to accept iVectors at intervals.
+      model->decodable_info_nnet3 =
+          new nnet3::DecodableNnetSimpleLoopedInfo(*nnet3_opts, &(model->am_nnet3));
+    }
+  } catch (...) {
+    delete model;
+    throw;
+  }
+  return model;
+}
+
+void *LoadNnet3Model(const std::string &rxfilename, const void *data) {
+  AcousticModel *model = new AcousticModel();
+  try {
+    bool binary;
+    Input ki(rxfilename, &binary);
+    model->trans_model.Read(ki.Stream(), binary);
+    model->am_nnet3.Read(ki.Stream(), binary);
+    nnet3::SetBatchnormTestMode(true, &(model->am_nnet3.GetNnet()));
+    nnet3::SetDropoutTestMode(true, &(model->am_nnet3.GetNnet()));
+  } catch (...) {
+    delete model;
+    throw;
+  }
+  return model;
+}
+
+void *LoadDecodeFst(const std::string &rxfilename, const void *data) {
+  return fst::ReadFstKaldiGeneric(rxfilename);
+}
+
+bool FileIsOlder(const std::string &filename, const std::string &than_filename) {
+  GStatBuf file_stat, than_stat;
+  return g_stat(filename.c_str(), &file_stat) != 0
+      || g_stat(than_filename.c_str(), &than_stat) != 0
+      || file_stat.st_mtime < than_stat.st_mtime;
+}
+
+// Writes the graph as an aligned ConstFst, first to a temporary file that
+// is then renamed, so that concurrent processes never see a partial file
+void WriteMappableFst(const std::string &rxfilename,
+                      const std::string &mappable_filename) {
+  KALDI_LOG << "Converting " << rxfilename << " to a memory-mappable graph "
+            << mappable_filename;
+  fst::Fst<fst::StdArc> *decode_fst = fst::ReadFstKaldiGeneric(rxfilename);
+  fst::ConstFst<fst::StdArc> const_fst(*decode_fst);
+  delete decode_fst;
+
+  std::ostringstream tmp_filename;
+  tmp_filename << mappable_filename << ".tmp" << getpid();
+  std::ofstream strm(tmp_filename.str().c_str(),
+                     std::ios_base::out | std::ios_base::binary);
+  fst::FstWriteOptions write_opts(mappable_filename);
+  write_opts.align = true;
+  if (!strm || !const_fst.Write(strm, write_opts)) {
+    g_unlink(tmp_filename.str().c_str());
+    KALDI_ERR << "Could not write " << tmp_filename.str();
+  }
+  strm.close();
+  if (g_rename(tmp_filename.str().c_str(), mappable_filename.c_str()) != 0) {
+    g_unlink(tmp_filename.str().c_str());
+    KALDI_ERR << "Could not rename " << tmp_filename.str() << " to "
+              << mappable_filename;
+  }
+}
+
+void *LoadMappedDecodeFst(const std::string &rxfilename, const void *data) {
+  if (ClassifyRxfilename(rxfilename) != kFileInput) {
+    KALDI_ERR << "Only plain files can be memory-mapped, not " << rxfilename;
+  }
+
+  std::string filename = rxfilename;
+  if (!ModelRegistry::IsMappableFst(filename)) {
+    filename = ModelRegistry::MappableFstFilename(rxfilename);
+    if (FileIsOlder(filename, rxfilename)) {
+      try {
+        WriteMappableFst(rxfilename, filename);
+      } catch (const std::runtime_error &e) {
+        KALDI_WARN << "Cannot create a memory-mappable copy of " << rxfilename
+                   << ", reading it into memory instead";
+        return LoadDecodeFst(rxfilename, data);
+      }
+    }
+    if (!ModelRegistry::IsMappableFst(filename)) {
+      KALDI_ERR << filename << " is not a memory-mappable graph";
+    }
+  }
+
+  std::ifstream strm(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  fst::FstReadOptions read_opts(filename);
+  read_opts.mode = fst::FstReadOptions::MAP;
+  fst::ConstFst<fst::StdArc> *decode_fst =
+      fst::ConstFst<fst::StdArc>::Read(strm, read_opts);
+  if (decode_fst == NULL) {
+    KALDI_ERR << "Could not memory-map the decoding graph " << filename;
+  }
+  return static_cast<fst::Fst<fst::StdArc>*>(decode_fst);
+}
+
+void *LoadLmFst(const std::string &filename, const void *data) {
+  fst::VectorFst<fst::StdArc> *std_lm_fst =
+      fst::VectorFst<fst::StdArc>::Read(filename);
+  if (std_lm_fst == NULL) {
+    KALDI_ERR << "Could not read LM FST from " << filename;
+  }
+  fst::Project(std_lm_fst, fst::PROJECT_OUTPUT);
+  if (std_lm_fst->Properties(fst::kILabelSorted, true) == 0) {
+    // Make sure LM is sorted on ilabel.
+    fst::ILabelCompare<fst::StdArc> ilabel_comp;
+    fst::ArcSort(std_lm_fst, ilabel_comp);
+  }
+  return std_lm_fst;
+}
+
+void *LoadConstArpaLm(const std::string &rxfilename, const void *data) {
+  ConstArpaLm *lm = new ConstArpaLm();
+  try {
+    ReadKaldiObject(rxfilename, lm);
+  } catch (...) {
+    delete lm;
+    throw;
+  }
+  return lm;
+}
+
+void *LoadSymbolTable(const std::string &filename, const void *data) {
+  fst::SymbolTable *syms = fst::SymbolTable::ReadText(filename);
+  if (syms == NULL) {
+    KALDI_ERR << "Could not read symbol table from " << filename;
+  }
+  return syms;
+}
+
+void *LoadJsonSymbolTable(const std::string &filename, const void *data) {
+  return new JsonSymbolTable(*static_cast<const fst::SymbolTable*>(data));
+}
+
+void *LoadWordBoundaryInfo(const std::string &filename, const void *data) {
+  WordBoundaryInfoNewOpts opts;  // use default opts
+  return new WordBoundaryInfo(opts, filename);
+}
+
+}  // namespace
+
+std::string OptionValuesString(SimpleOptions *options) {
+  std::ostringstream values;
+  values.precision(std::numeric_limits<double>::digits10 + 2);
+  std::vector<std::pair<std::string, SimpleOptions::OptionInfo> > option_info_list =
+      options->GetOptionInfoList();
+  for (size_t i = 0; i < option_info_list.size(); i++) {
+    const std::string &name = option_info_list[i].first;
+    values << name << '=';
+    switch (option_info_list[i].second.type) {
+      case SimpleOptions::kBool: {
+        bool value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+      case SimpleOptions::kInt32: {
+        int32 value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+      case SimpleOptions::kUint32: {
+        uint32 value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+      case SimpleOptions::kFloat: {
+        float value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+      case SimpleOptions::kDouble: {
+        double value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+      case SimpleOptions::kString: {
+        std::string value;
+        options->GetOption(name, &value);
+        values << value;
+        break;
+      }
+    }
+    values << '\n';
+  }
+  return values.str();
+}
+
+ModelRegistry::ModelRegistry() : num_private_keys_(0) {
+  g_mutex_init(&lock_);
+  g_cond_init(&loaded_cond_);
+}
+
+std::string ModelRegistry::MappableFstFilename(const std::string &filename) {
+  return filename + ".mmap";
+}
+
+bool ModelRegistry::IsMappableFst(const std::string &filename) {
+  std::ifstream strm(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  fst::FstHeader hdr;
+  if (!strm || !hdr.Read(strm, filename))
+    return false;
+  return hdr.FstType() == "const"
+      && hdr.ArcType() == fst::StdArc::Type()
+      && (hdr.GetFlags() & fst::FstHeader::IS_ALIGNED);
+}
+
+ModelRegistry *ModelRegistry::Instance() {
+  // Never destroyed, so that elements finalized during process exit
+  // can still release their models
+  static ModelRegistry *instance = new ModelRegistry();
+  return instance;
+}
+
+std::string ModelRegistry::MakeKey(const std::string &kind,
+                                   const std::string &rxfilename,
+                                   const std::string &variant) {
+  std::ostringstream key;
+  key << kind << '\n';
+  char *path = NULL;
+  GStatBuf file_stat;
+  if (ClassifyRxfilename(rxfilename) == kFileInput
+      && (path = realpath(rxfilename.c_str(), NULL)) != NULL
+      && g_stat(path, &file_stat) == 0) {
+    key << path << '\n' << file_stat.st_size << '\n' << file_stat.st_mtime;
+  } else {
+    // Pipes, stdin etc: give every load a key of its own
+    g_mutex_lock(&lock_);
+    key << rxfilename << "\n#" << num_private_keys_++;
+    g_mutex_unlock(&lock_);
+  }
+  free(path);
+  key << '\n' << variant;
+  return key.str();
+}
+
+void *ModelRegistry::Acquire(const std::string &kind,
+                             const std::string &rxfilename,
+                             const std::string &variant,
+                             LoadFunc load, DestroyFunc destroy,
+                             const void *data) {
+  std::string key = MakeKey(kind, rxfilename, variant);
+
+  g_mutex_lock(&lock_);
+  std::map<std::string, Entry*>::iterator it;
+  while ((it = entries_.find(key)) != entries_.end()) {
+    Entry *entry = it->second;
+    if (!entry->loading) {
+      entry->ref_count++;
+      g_mutex_unlock(&lock_);
+      KALDI_VLOG(1) << "Sharing already loaded " << kind << " " << rxfilename;
+      return entry->object;
+    }
+    // Somebody else is loading it; if that fails, the entry is removed
+    // and we try ourselves
+    g_cond_wait(&loaded_cond_, &lock_);
+  }
+
+  Entry *entry = new Entry();
+  entry->object = NULL;
+  entry->destroy = destroy;
+  entry->ref_count = 1;
+  entry->loading = true;
+  entries_[key] = entry;
+  g_mutex_unlock(&lock_);
+
+  void *object = NULL;
+  try {
+    KALDI_VLOG(1) << "Loading " << kind << " " << rxfilename;
+    object = load(rxfilename, data);
+  } catch (...) {
+    g_mutex_lock(&lock_);
+    entries_.erase(key);
+    g_cond_broadcast(&loaded_cond_);
+    g_mutex_unlock(&lock_);
+    delete entry;
+    throw;
+  }
+
+  g_mutex_lock(&lock_);
+  entry->object = object;
+  entry->loading = false;
+  keys_[object] = key;
+  g_cond_broadcast(&loaded_cond_);
+  g_mutex_unlock(&lock_);
+  return object;
+}
+
+void ModelRegistry::Ref(const void *object) {
+  if (object == NULL)
+    return;
+
+  g_mutex_lock(&lock_);
+  std::map<const void*, std::string>::iterator key_it = keys_.find(object);
+  KALDI_ASSERT(key_it != keys_.end() && "Referencing an object not owned by the registry");
+  entries_[key_it->second]->ref_count++;
+  g_mutex_unlock(&lock_);
+}
+
+void ModelRegistry::Release(const void *object) {
+  if (object == NULL)
+    return;
+
+  Entry *unused_entry = NULL;
+  g_mutex_lock(&lock_);
+  std::map<const void*, std::string>::iterator key_it = keys_.find(object);
+  KALDI_ASSERT(key_it != keys_.end() && "Releasing an object not owned by the registry");
+  std::map<std::string, Entry*>::iterator it = entries_.find(key_it->second);
+  KALDI_ASSERT(it != entries_.end());
+  if (--(it->second->ref_count) == 0) {
+    unused_entry = it->second;
+    entries_.erase(it);
+    keys_.erase(key_it);
+  }
+  g_mutex_unlock(&lock_);
+
+  if (unused_entry) {
+    unused_entry->destroy(unused_entry->object);
+    delete unused_entry;
+  }
+}
+
+const AcousticModel *ModelRegistry::AcquireAcousticModel(
+    const std::string &rxfilename,
+    const nnet3::NnetSimpleLoopedComputationOptions *nnet3_opts) {
+  std::ostringstream variant;
+  if (nnet3_opts == NULL) {
+    variant << "nnet2";
+  } else {
+    // The looped computation info depends on all of these options
+    variant << "nnet3\n" << OptionsKey(*nnet3_opts);
+  }
+  return static_cast<const AcousticModel*>(
+      Acquire("acoustic model", rxfilename, variant.str(),
+              LoadAcousticModel, DestroyObject<AcousticModel>, nnet3_opts));
+}
+
+const AcousticModel *ModelRegistry::AcquireNnet3Model(
+    const std::string &rxfilename) {
+  return static_cast<const AcousticModel*>(
+      Acquire("acoustic model", rxfilename, "nnet3 unmodified",
+              LoadNnet3Model, DestroyObject<AcousticModel>, NULL));
+}
+
+const fst::Fst<fst::StdArc> *ModelRegistry::AcquireDecodeFst(
+    const std::string &rxfilename, bool mmap) {
+  return static_cast<const fst::Fst<fst::StdArc>*>(
+      Acquire("decoding graph", rxfilename, mmap ? "mmap" : "",
+              mmap ? LoadMappedDecodeFst : LoadDecodeFst,
+              DestroyObject<fst::Fst<fst::StdArc> >, NULL));
+}
+
+const fst::VectorFst<fst::StdArc> *ModelRegistry::AcquireLmFst(
+    const std::string &filename) {
+  return static_cast<const fst::VectorFst<fst::StdArc>*>(
+      Acquire("LM FST", filename, "",
+              LoadLmFst, DestroyObject<fst::VectorFst<fst::StdArc> >, NULL));
+}
+
+const ConstArpaLm *ModelRegistry::AcquireConstArpaLm(
+    const std::string &rxfilename) {
+  return static_cast<const ConstArpaLm*>(
+      Acquire("const ARPA LM", rxfilename, "",
+              LoadConstArpaLm, DestroyObject<ConstArpaLm>, NULL));
+}
+
+const fst::SymbolTable *ModelRegistry::AcquireSymbolTable(
+    const std::string &filename) {
+  return static_cast<const fst::SymbolTable*>(
+      Acquire("symbol table", filename, "",
+              LoadSymbolTable, DestroyObject<fst::SymbolTable>, NULL));
+}
+
+const JsonSymbolTable *ModelRegistry::AcquireJsonSymbolTable(
+    const std::string &filename, const fst::SymbolTable *syms) {
+  return static_cast<const JsonSymbolTable*>(
+      Acquire("JSON symbol table", filename, "",
+              LoadJsonSymbolTable, DestroyObject<JsonSymbolTable>, syms));
+}
+
+const WordBoundaryInfo *ModelRegistry::AcquireWordBoundaryInfo(
+    const std::string &filename) {
+  return static_cast<const WordBoundaryInfo*>(
+      Acquire("word boundary info", filename, "",
+              LoadWordBoundaryInfo, DestroyObject<WordBoundaryInfo>, NULL));
+}
+
+ModelSet::ModelSet()
+    : ref_count_(1), acoustic_model_(NULL), decode_fst_(NULL),
+      word_syms_(NULL), phone_syms_(NULL), json_word_syms_(NULL),
+      json_phone_syms_(NULL), word_boundary_info_(NULL),
+      std_lm_fst_(NULL), lm_fst_(NULL), lm_compose_cache_(NULL),
+      big_lm_const_arpa_(NULL), big_lm_cache_(NULL) { }
+
+ModelSet::~ModelSet() {
+  ModelRegistry *registry = ModelRegistry::Instance();
+  registry->Release(acoustic_model_);
+  registry->Release(decode_fst_);
+  registry->Release(word_syms_);
+  registry->Release(phone_syms_);
+  registry->Release(json_word_syms_);
+  registry->Release(json_phone_syms_);
+  registry->Release(word_boundary_info_);
+  delete lm_fst_;
+  delete lm_compose_cache_;
+  registry->Release(std_lm_fst_);
+  ConstArpaLmCache::Release(big_lm_cache_);
+  registry->Release(big_lm_const_arpa_);
+}
+
+ModelSet *ModelSet::Clone() const {
+  ModelRegistry *registry = ModelRegistry::Instance();
+  ModelSet *clone = new ModelSet();
+  registry->Ref(acoustic_model_);
+  clone->acoustic_model_ = acoustic_model_;
+  clone->acoustic_model_rxfilename_ = acoustic_model_rxfilename_;
+  registry->Ref(decode_fst_);
+  clone->decode_fst_ = decode_fst_;
+  registry->Ref(word_syms_);
+  clone->word_syms_ = word_syms_;
+  registry->Ref(phone_syms_);
+  clone->phone_syms_ = phone_syms_;
+  registry->Ref(json_word_syms_);
+  clone->json_word_syms_ = json_word_syms_;
+  registry->Ref(json_phone_syms_);
+  clone->json_phone_syms_ = json_phone_syms_;
+  registry->Ref(word_boundary_info_);
+  clone->word_boundary_info_ = word_boundary_info_;
+  if (std_lm_fst_ != NULL) {
+    // The rescoring caches are per set, see the class comment
+    registry->Ref(std_lm_fst_);
+    clone->SetLmFst(std_lm_fst_);
+  }
+  registry->Ref(big_lm_const_arpa_);
+  clone->big_lm_const_arpa_ = big_lm_const_arpa_;
+  ConstArpaLmCache::Ref(big_lm_cache_);
+  clone->big_lm_cache_ = big_lm_cache_;
+  return clone;
+}
+
+void ModelSet::Ref() {
+  g_atomic_int_inc(&ref_count_);
+}
+
+void ModelSet::Unref() {
+  if (g_atomic_int_dec_and_test(&ref_count_))
+    delete this;
+}
+
+void ModelSet::SetAcousticModel(const AcousticModel *acoustic_model,
+                                const std::string &rxfilename) {
+  ModelRegistry::Instance()->Release(acoustic_model_);
+  acoustic_model_ = acoustic_model;
+  acoustic_model_rxfilename_ = rxfilename;
+}
+
+void ModelSet::SetDecodeFst(const fst::Fst<fst::StdArc> *decode_fst) {
+  ModelRegistry::Instance()->Release(decode_fst_);
+  decode_fst_ = decode_fst;
+}
+
+void ModelSet::SetWordSyms(const fst::SymbolTable *word_syms,
+                           const JsonSymbolTable *json_word_syms) {
+  ModelRegistry::Instance()->Release(word_syms_);
+  ModelRegistry::Instance()->Release(json_word_syms_);
+  word_syms_ = word_syms;
+  json_word_syms_ = json_word_syms;
+}
+
+void ModelSet::SetPhoneSyms(const fst::SymbolTable *phone_syms,
+                            const JsonSymbolTable *json_phone_syms) {
+  ModelRegistry::Instance()->Release(phone_syms_);
+  ModelRegistry::Instance()->Release(json_phone_syms_);
+  phone_syms_ = phone_syms;
+  json_phone_syms_ = json_phone_syms;
+}
+
+void ModelSet::SetWordBoundaryInfo(const WordBoundaryInfo *word_boundary_info) {
+  ModelRegistry::Instance()->Release(word_boundary_info_);
+  word_boundary_info_ = word_boundary_info;
+}
+
+void ModelSet::SetLmFst(const fst::VectorFst<fst::StdArc> *std_lm_fst) {
+  delete lm_fst_;
+  delete lm_compose_cache_;
+  ModelRegistry::Instance()->Release(std_lm_fst_);
+  std_lm_fst_ = std_lm_fst;
+
+  // mapped_fst is the LM fst interpreted using the LatticeWeight semiring,
+  // with all the cost on the first member of the pair (since it's a graph
+  // weight).
+  int32 num_states_cache = 50000;
+  fst::CacheOptions cache_opts(true, num_states_cache);
+  fst::MapFstOptions mapfst_opts(cache_opts);
+  fst::StdToLatticeMapper<BaseFloat> mapper;
+  lm_fst_ = new fst::MapFst<fst::StdArc, LatticeArc,
+      fst::StdToLatticeMapper<BaseFloat> >(*std_lm_fst, mapper, mapfst_opts);
+
+  // The next fifteen or so lines are a kind of optimization and
+  // can be ignored if you just want to understand what is going on.
+  // Change the options for TableCompose to match the input
+  // (because it's the arcs of the LM FST we want to do lookup
+  // on).
+  fst::TableComposeOptions compose_opts(fst::TableMatcherOptions(),
+                                        true, fst::SEQUENCE_FILTER,
+                                        fst::MATCH_INPUT);
+
+  // The following is an optimization for the TableCompose
+  // composition: it stores certain tables that enable fast
+  // lookup of arcs during composition.
+  lm_compose_cache_ = new fst::TableComposeCache<fst::Fst<LatticeArc> >(compose_opts);
+}
+
+void ModelSet::SetBigLm(const ConstArpaLm *big_lm_const_arpa,
+                        size_t cache_bytes) {
+  ConstArpaLmCache::Release(big_lm_cache_);
+  big_lm_cache_ = NULL;
+  ModelRegistry::Instance()->Release(big_lm_const_arpa_);
+  big_lm_const_arpa_ = big_lm_const_arpa;
+  if (big_lm_const_arpa_ != NULL && cache_bytes > 0) {
+    big_lm_cache_ = ConstArpaLmCache::Acquire(big_lm_const_arpa_, cache_bytes);
+  }
+}
+
+}  // namespace kaldi
@@ -0,0 +1,250 @@
+// model-registry.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_MODEL_REGISTRY_H_
+#define KALDI_SRC_MODEL_REGISTRY_H_
+
+#include <map>
+#include <string>
+
+#include <glib.h>
+
+#include "./const-arpa-lm-cache.h"
+#include "./json-writer.h"
+
+#include "hmm/transition-model.h"
+#include "nnet2/am-nnet.h"
+#include "nnet3/am-nnet-simple.h"
+#include "nnet3/decodable-simple-looped.h"
+#include "fstext/fstext-lib.h"
+#include "lm/const-arpa-lm.h"
+#include "lat/word-align-lattice.h"
+#include "util/simple-options.h"
+
+namespace kaldi {
+
+// Acoustic model as stored in a Kaldi model file: the transition model
+// followed by either an nnet2 or an nnet3 network.
+struct AcousticModel {
+  AcousticModel() : decodable_info_nnet3(NULL) { }
+  ~AcousticModel() { delete decodable_info_nnet3; }
+
+  TransitionModel trans_model;
+  nnet2::AmNnet am_nnet2;
+  nnet3::AmNnetSimple am_nnet3;
+  // Precomputed stuff that is used by all nnet3 decodable objects,
+  // NULL for nnet2 models
+  nnet3::DecodableNnetSimpleLoopedInfo *decodable_info_nnet3;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(AcousticModel);
+};
+
+// Returns the values of all the options registered in 'options', one
+// "name=value" per line, for keying objects that are built with them
+std::string OptionValuesString(SimpleOptions *options);
+
+// Returns the values of all the options that 'opts' registers, so that
+// objects built with different options (including those set through
+// sub-configs like optimization.* and computation.*) get different keys
+template<class C>
+std::string OptionsKey(const C &opts) {
+  C registered_opts(opts);  // Register() needs non-const pointers
+  SimpleOptions options;
+  registered_opts.Register(&options);
+  return OptionValuesString(&options);
+}
+
+// Process-wide cache of read-only models, graphs, language models and
+// symbol tables, so that all decoder instances in a process that use the
+// same files share one copy in memory.
+//
+// Objects are identified by the canonical path, size and modification time
+// of the file they are read from, plus any options that change how they
+// are built. An object is loaded by its first user and freed when the last
+// user releases it. Rxfilenames that are not plain files (pipes, stdin)
+// are never shared. All methods are thread-safe; concurrent requests for
+// an object that is being loaded wait for the first load to finish.
+//
+// The Acquire* methods throw std::runtime_error if loading fails.
+class ModelRegistry {
+ public:
+  static ModelRegistry *Instance();
+
+  // 'nnet3_opts' configures the looped computation of nnet3 models;
+  // pass NULL if the file contains an nnet2 model.
+  const AcousticModel *AcquireAcousticModel(
+      const std::string &rxfilename,
+      const nnet3::NnetSimpleLoopedComputationOptions *nnet3_opts);
+
+  // Returns an nnet3 model as it is in the file, without the looped
+  // computation info (which modifies the network), for computing it in
+  // batches with NnetBatchComputer.
+  const AcousticModel *AcquireNnet3Model(const std::string &rxfilename);
+
+  // If 'mmap' is true, the graph is memory-mapped from disk instead of
+  // being read into memory, so that its pages are shared between processes
+  // through the page cache. This requires the graph to be stored as a
+  // ConstFst with aligned layout; other graphs are converted once into
+  // such a file named MappableFstFilename(rxfilename), which is recreated
+  // when it is older than the original.
+  const fst::Fst<fst::StdArc> *AcquireDecodeFst(const std::string &rxfilename,
+                                                bool mmap);
+
+  // Returns the LM FST with the input labels projected to the output and
+  // sorted on ilabel, ready to be used for lattice rescoring
+  const fst::VectorFst<fst::StdArc> *AcquireLmFst(const std::string &filename);
+
+  const ConstArpaLm *AcquireConstArpaLm(const std::string &rxfilename);
+
+  const fst::SymbolTable *AcquireSymbolTable(const std::string &filename);
+
+  // Returns the JSON-escaped symbols of 'syms', which must have been
+  // acquired from 'filename'
+  const JsonSymbolTable *AcquireJsonSymbolTable(const std::string &filename,
+                                                const fst::SymbolTable *syms);
+
+  const WordBoundaryInfo *AcquireWordBoundaryInfo(const std::string &filename);
+
+  static std::string MappableFstFilename(const std::string &filename);
+
+  // Returns true if the file holds a standard-arc ConstFst that has been
+  // written with aligned layout, i.e. can be memory-mapped as it is
+  static bool IsMappableFst(const std::string &filename);
+
+  // Adds a reference to an object obtained from one of the Acquire*
+  // methods, to be dropped with another call to Release(). NULL is ignored.
+  void Ref(const void *object);
+
+  // Drops a reference obtained from one of the Acquire* methods.
+  // NULL is ignored.
+  void Release(const void *object);
+
+ private:
+  typedef void *(*LoadFunc)(const std::string &rxfilename, const void *data);
+  typedef void (*DestroyFunc)(void *object);
+
+  struct Entry {
+    void *object;
+    DestroyFunc destroy;
+    gint ref_count;
+    bool loading;
+  };
+
+  ModelRegistry();
+
+  void *Acquire(const std::string &kind, const std::string &rxfilename,
+                const std::string &variant, LoadFunc load,
+                DestroyFunc destroy, const void *data);
+
+  std::string MakeKey(const std::string &kind, const std::string &rxfilename,
+                      const std::string &variant);
+
+  GMutex lock_;
+  GCond loaded_cond_;
+  guint64 num_private_keys_;
+  std::map<std::string, Entry*> entries_;
+  std::map<const void*, std::string> keys_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ModelRegistry);
+};
+
+// A consistent set of the models used by one decoder instance.
+//
+// A decoder uses the set that was current when it started decoding a
+// segment until the segment ends, so that models can be replaced while it
+// is running: the replacement is made on a Clone() of the current set,
+// which then becomes the current set, and the old one is freed (together
+// with the models nobody else uses) when its last user calls Unref().
+// Apart from the LM rescoring caches, which are only used by the thread
+// that produces the final results (one at a time), a set must not be
+// modified after it has been made current.
+class ModelSet {
+ public:
+  // Creates an empty set with a reference count of 1
+  ModelSet();
+
+  // Returns a new set with a reference count of 1 that shares all the
+  // models of this one
+  ModelSet *Clone() const;
+
+  void Ref();
+  void Unref();
+
+  // The Set* methods take over a reference obtained from ModelRegistry
+  // and release the model they replace
+  void SetAcousticModel(const AcousticModel *acoustic_model,
+                        const std::string &rxfilename);
+  void SetDecodeFst(const fst::Fst<fst::StdArc> *decode_fst);
+  void SetWordSyms(const fst::SymbolTable *word_syms,
+                   const JsonSymbolTable *json_word_syms);
+  void SetPhoneSyms(const fst::SymbolTable *phone_syms,
+                    const JsonSymbolTable *json_phone_syms);
+  void SetWordBoundaryInfo(const WordBoundaryInfo *word_boundary_info);
+  void SetLmFst(const fst::VectorFst<fst::StdArc> *std_lm_fst);
+  // Also gets the shared lookup cache of the LM, with the given capacity
+  // if it doesn't exist yet; 0 means no cache
+  void SetBigLm(const ConstArpaLm *big_lm_const_arpa, size_t cache_bytes);
+
+  const AcousticModel *acoustic_model() const { return acoustic_model_; }
+  // The file the acoustic model was read from
+  const std::string &acoustic_model_rxfilename() const {
+    return acoustic_model_rxfilename_;
+  }
+  const fst::Fst<fst::StdArc> *decode_fst() const { return decode_fst_; }
+  const fst::SymbolTable *word_syms() const { return word_syms_; }
+  const fst::SymbolTable *phone_syms() const { return phone_syms_; }
+  const JsonSymbolTable *json_word_syms() const { return json_word_syms_; }
+  const JsonSymbolTable *json_phone_syms() const { return json_phone_syms_; }
+  const WordBoundaryInfo *word_boundary_info() const {
+    return word_boundary_info_;
+  }
+  // The LM FST interpreted using the LatticeWeight semiring, NULL if no
+  // LM FST has been set
+  const fst::Fst<LatticeArc> *lm_fst() const { return lm_fst_; }
+  fst::TableComposeCache<fst::Fst<LatticeArc> > *lm_compose_cache() const {
+    return lm_compose_cache_;
+  }
+  const ConstArpaLm *big_lm_const_arpa() const { return big_lm_const_arpa_; }
+  // NULL if lookups in the big LM are not cached
+  ConstArpaLmCache *big_lm_cache() const { return big_lm_cache_; }
+
+ private:
+  ~ModelSet();
+
+  gint ref_count_;
+  const AcousticModel *acoustic_model_;
+  std::string acoustic_model_rxfilename_;
+  const fst::Fst<fst::StdArc> *decode_fst_;
+  const fst::SymbolTable *word_syms_;
+  const fst::SymbolTable *phone_syms_;
+  const JsonSymbolTable *json_word_syms_;
+  const JsonSymbolTable *json_phone_syms_;
+  const WordBoundaryInfo *word_boundary_info_;
+  const fst::VectorFst<fst::StdArc> *std_lm_fst_;
+  fst::MapFst<fst::StdArc, LatticeArc, fst::StdToLatticeMapper<BaseFloat> > *lm_fst_;
+  fst::TableComposeCache<fst::Fst<LatticeArc> > *lm_compose_cache_;
+  const ConstArpaLm *big_lm_const_arpa_;
+  ConstArpaLmCache *big_lm_cache_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ModelSet);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_MODEL_REGISTRY_H_
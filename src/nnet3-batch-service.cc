@@ -0,0 +1,286 @@
+// nnet3-batch-service.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <sstream>
+
+#include "./nnet3-batch-service.h"
+
+#include "base/timer.h"
+#include "nnet3/nnet-graph.h"
+#include "nnet3/nnet-utils.h"
+
+namespace kaldi {
+
+GMutex NnetBatchService::services_lock_;
+std::map<std::string, NnetBatchService*> NnetBatchService::services_;
+
+NnetBatchService *NnetBatchService::Acquire(
+    const std::string &rxfilename,
+    const nnet3::NnetSimpleLoopedComputationOptions &nnet3_opts,
+    int32 batch_size, int32 frames_per_chunk, int32 max_wait_ms) {
+  KALDI_ASSERT(batch_size > 0 && frames_per_chunk > 0);
+  nnet3::NnetBatchComputerOptions opts;
+  int32 sf = nnet3_opts.frame_subsampling_factor;
+  opts.frames_per_chunk = (frames_per_chunk + sf - 1) / sf * sf;
+  opts.frame_subsampling_factor = sf;
+  opts.acoustic_scale = nnet3_opts.acoustic_scale;
+  opts.debug_computation = nnet3_opts.debug_computation;
+  opts.optimize_config = nnet3_opts.optimize_config;
+  opts.compiler_config = nnet3_opts.compiler_config;
+  opts.compute_config = nnet3_opts.compute_config;
+  opts.minibatch_size = batch_size;
+  opts.edge_minibatch_size = batch_size;
+
+  // The looped computation info modifies the network that decoders
+  // without batching use, so we need a model of our own
+  const AcousticModel *model =
+      ModelRegistry::Instance()->AcquireNnet3Model(rxfilename);
+  if (nnet3::NnetIsRecurrent(model->am_nnet3.GetNnet())) {
+    // Chunks are computed independently, so the recurrent state would be
+    // lost at every chunk boundary
+    ModelRegistry::Instance()->Release(model);
+    throw std::runtime_error("batched computation does not support recurrent models");
+  }
+
+  // The computer is built with all of these options; the compiler options
+  // are not registered with the others
+  std::ostringstream key;
+  key << model << ' ' << batch_size << ' ' << max_wait_ms << '\n' << OptionsKey(opts)
+      << OptionsKey(opts.compiler_config);
+
+  g_mutex_lock(&services_lock_);
+  NnetBatchService *service;
+  std::map<std::string, NnetBatchService*>::iterator it = services_.find(key.str());
+  if (it != services_.end()) {
+    service = it->second;
+    service->ref_count_++;
+    g_mutex_unlock(&services_lock_);
+    ModelRegistry::Instance()->Release(model);
+  } else {
+    KALDI_LOG << "Starting batched nnet3 computation for " << rxfilename
+              << " with batches of " << batch_size << " chunks of "
+              << opts.frames_per_chunk << " frames";
+    service = new NnetBatchService(key.str(), model, opts, max_wait_ms);
+    services_[key.str()] = service;
+    g_mutex_unlock(&services_lock_);
+  }
+  return service;
+}
+
+void NnetBatchService::Release(NnetBatchService *service) {
+  g_mutex_lock(&services_lock_);
+  bool unused = (--(service->ref_count_) == 0);
+  if (unused) {
+    services_.erase(service->key_);
+  }
+  g_mutex_unlock(&services_lock_);
+  if (unused) {
+    delete service;
+  }
+}
+
+NnetBatchService::NnetBatchService(const std::string &key,
+                                   const AcousticModel *model,
+                                   const nnet3::NnetBatchComputerOptions &opts,
+                                   int32 max_wait_ms)
+    : key_(key), model_(model), opts_(opts),
+      max_wait_us_(static_cast<gint64>(max_wait_ms) * 1000),
+      ref_count_(1), num_submitted_(0), num_done_(0), first_pending_time_(0),
+      stop_(false) {
+  const nnet3::Nnet &nnet = model_->am_nnet3.GetNnet();
+  nnet3::ComputeSimpleNnetContext(nnet, &left_context_, &right_context_);
+  computer_ = new nnet3::NnetBatchComputer(opts_, nnet, model_->am_nnet3.Priors());
+  g_mutex_init(&lock_);
+  g_cond_init(&cond_);
+  thread_ = g_thread_new("nnet3-batch", NnetBatchService::Run, this);
+}
+
+NnetBatchService::~NnetBatchService() {
+  g_mutex_lock(&lock_);
+  stop_ = true;
+  g_cond_signal(&cond_);
+  g_mutex_unlock(&lock_);
+  g_thread_join(thread_);
+
+  delete computer_;
+  g_mutex_clear(&lock_);
+  g_cond_clear(&cond_);
+  ModelRegistry::Instance()->Release(model_);
+}
+
+void NnetBatchService::Compute(nnet3::NnetInferenceTask *task) {
+  g_mutex_lock(&lock_);
+  computer_->AcceptTask(task);
+  if (num_submitted_ == num_done_) {
+    first_pending_time_ = g_get_monotonic_time();
+  }
+  num_submitted_++;
+  g_cond_signal(&cond_);
+  g_mutex_unlock(&lock_);
+
+  // Signalled by NnetBatchComputer when the output is ready
+  task->semaphore.Wait();
+}
+
+gpointer NnetBatchService::Run(gpointer data) {
+  static_cast<NnetBatchService*>(data)->Run();
+  return NULL;
+}
+
+void NnetBatchService::Run() {
+  g_mutex_lock(&lock_);
+  while (!stop_) {
+    guint64 num_pending = num_submitted_ - num_done_;
+    if (num_pending == 0) {
+      g_cond_wait(&cond_, &lock_);
+      continue;
+    }
+    gint64 deadline = first_pending_time_ + max_wait_us_;
+    if (num_pending < static_cast<guint64>(opts_.minibatch_size)
+        && g_get_monotonic_time() < deadline) {
+      g_cond_wait_until(&cond_, &lock_, deadline);
+      continue;
+    }
+
+    guint64 num_submitted = num_submitted_;
+    gint64 start_time = g_get_monotonic_time();
+    g_mutex_unlock(&lock_);
+    // Compute everything that is waiting, in full minibatches as far as
+    // possible; this may include tasks submitted meanwhile
+    while (computer_->Compute(true)) { }
+    g_mutex_lock(&lock_);
+    num_done_ = num_submitted;
+    // Tasks submitted after we started may still be waiting, don't let
+    // them wait longer than they would have otherwise
+    first_pending_time_ = start_time;
+  }
+  g_mutex_unlock(&lock_);
+}
+
+
+DecodableNnetBatchedOnline::DecodableNnetBatchedOnline(
+    const TransitionModel &trans_model,
+    NnetBatchService *service,
+    OnlineFeatureInterface *input_features,
+    OnlineFeatureInterface *ivector_features)
+    : trans_model_(trans_model), service_(service),
+      input_features_(input_features), ivector_features_(ivector_features),
+      frame_offset_(0), current_log_post_subsampled_offset_(-1),
+      compute_time_(0.0) { }
+
+void DecodableNnetBatchedOnline::SetFrameOffset(int32 frame_offset) {
+  KALDI_ASSERT(0 <= frame_offset &&
+               frame_offset <= frame_offset_ + NumFramesReady());
+  frame_offset_ = frame_offset;
+}
+
+int32 DecodableNnetBatchedOnline::NumFramesReady() const {
+  int32 features_ready = input_features_->NumFramesReady();
+  if (features_ready == 0)
+    return 0;
+  bool input_finished = input_features_->IsLastFrame(features_ready - 1);
+  int32 sf = service_->FrameSubsamplingFactor();
+  if (input_finished) {
+    // The last chunk is padded with copies of the last frame
+    return (features_ready + sf - 1) / sf - frame_offset_;
+  } else {
+    int32 frames_per_chunk = service_->FramesPerChunk();
+    int32 non_subsampled_output_frames_ready =
+        std::max<int32>(0, features_ready - service_->RightContext());
+    int32 num_chunks_ready = non_subsampled_output_frames_ready / frames_per_chunk;
+    return num_chunks_ready * frames_per_chunk / sf - frame_offset_;
+  }
+}
+
+bool DecodableNnetBatchedOnline::IsLastFrame(int32 subsampled_frame) const {
+  int32 features_ready = input_features_->NumFramesReady();
+  if (features_ready == 0 || !input_features_->IsLastFrame(features_ready - 1))
+    return false;
+  int32 sf = service_->FrameSubsamplingFactor();
+  return subsampled_frame + frame_offset_ == (features_ready + sf - 1) / sf - 1;
+}
+
+BaseFloat DecodableNnetBatchedOnline::LogLikelihood(int32 subsampled_frame,
+                                                    int32 transition_id) {
+  int32 frame = subsampled_frame + frame_offset_;
+  EnsureFrameIsComputed(frame);
+  return current_log_post_(frame - current_log_post_subsampled_offset_,
+                           trans_model_.TransitionIdToPdf(transition_id));
+}
+
+void DecodableNnetBatchedOnline::EnsureFrameIsComputed(int32 subsampled_frame) {
+  if (current_log_post_subsampled_offset_ >= 0
+      && subsampled_frame >= current_log_post_subsampled_offset_
+      && subsampled_frame < current_log_post_subsampled_offset_
+                            + current_log_post_.NumRows())
+    return;
+
+  int32 sf = service_->FrameSubsamplingFactor(),
+      frames_per_chunk = service_->FramesPerChunk(),
+      left_context = service_->LeftContext(),
+      right_context = service_->RightContext();
+  int32 chunk_start = subsampled_frame * sf / frames_per_chunk * frames_per_chunk;
+  int32 features_ready = input_features_->NumFramesReady();
+  KALDI_ASSERT(features_ready > chunk_start);
+
+  // Frames before the start and after the end of the input are padded
+  // with copies of the first and last frame
+  int32 num_input_frames = left_context + frames_per_chunk + right_context;
+  std::vector<int32> input_frames(num_input_frames);
+  for (int32 i = 0; i < num_input_frames; i++) {
+    input_frames[i] = std::min(std::max(chunk_start - left_context + i, 0),
+                               features_ready - 1);
+  }
+  Matrix<BaseFloat> input(num_input_frames, input_features_->Dim(), kUndefined);
+  input_features_->GetFrames(input_frames, &input);
+
+  nnet3::NnetInferenceTask task;
+  task.input.Swap(&input);
+  // Output frame 0 is input frame chunk_start
+  task.first_input_t = -left_context;
+  task.output_t_stride = sf;
+  task.num_output_frames = frames_per_chunk / sf;
+  task.num_initial_unused_output_frames = 0;
+  task.num_used_output_frames = task.num_output_frames;
+  task.first_used_output_frame_index = chunk_start / sf;
+  task.is_irregular = false;
+  task.is_edge = false;
+  // The oldest chunks first
+  task.priority = -static_cast<double>(g_get_monotonic_time());
+  task.output_to_cpu = true;
+  if (ivector_features_ != NULL) {
+    // The latest iVector the chunk can see, as in the looped computation
+    int32 ivector_frame = std::min(chunk_start + frames_per_chunk + right_context,
+                                   ivector_features_->NumFramesReady()) - 1;
+    Vector<BaseFloat> ivector(ivector_features_->Dim());
+    ivector_features_->GetFrame(ivector_frame, &ivector);
+    task.ivector.Resize(ivector.Dim(), kUndefined);
+    task.ivector.CopyFromVec(ivector);
+  }
+
+  Timer timer;
+  service_->Compute(&task);
+  compute_time_ += timer.Elapsed();
+
+  current_log_post_.Swap(&task.output_cpu);
+  current_log_post_subsampled_offset_ = chunk_start / sf;
+}
+
+}  // namespace kaldi
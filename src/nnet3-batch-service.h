@@ -0,0 +1,160 @@
+// nnet3-batch-service.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_NNET3_BATCH_SERVICE_H_
+#define KALDI_SRC_NNET3_BATCH_SERVICE_H_
+
+#include <map>
+#include <string>
+
+#include <glib.h>
+
+#include "./model-registry.h"
+
+#include "itf/decodable-itf.h"
+#include "itf/online-feature-itf.h"
+#include "nnet3/nnet-batch-compute.h"
+
+namespace kaldi {
+
+// Process-wide service that computes the acoustic scores of many decoder
+// instances together, so that the network is evaluated on minibatches of
+// chunks from different streams instead of on one small chunk at a time.
+//
+// There is one service per nnet3 model file and set of options. Decoders
+// submit chunks with Compute(), which blocks until the chunk has been
+// computed. A worker thread runs a minibatch as soon as batch_size chunks
+// of the same shape are waiting, or when the oldest chunk has waited for
+// max_wait_ms milliseconds.
+//
+// The chunks are computed with NnetBatchComputer, i.e. each chunk with its
+// full left and right context, rather than with the looped computation
+// used by SingleUtteranceNnet3Decoder, which carries the state of the
+// network over from one chunk to the next. The context is computed again
+// for every chunk, so the chunks are longer than those of the looped
+// computation to keep that overhead down, and recurrent models, whose
+// state cannot be carried over this way, are not supported.
+class NnetBatchService {
+ public:
+  // Returns the service for the nnet3 model in 'rxfilename', starting it
+  // if needed, which computes chunks of 'frames_per_chunk' frames (rounded
+  // up to a multiple of the frame subsampling factor). Throws
+  // std::runtime_error if the model cannot be read or is recurrent.
+  static NnetBatchService *Acquire(
+      const std::string &rxfilename,
+      const nnet3::NnetSimpleLoopedComputationOptions &nnet3_opts,
+      int32 batch_size, int32 frames_per_chunk, int32 max_wait_ms);
+
+  // Drops a reference obtained with Acquire(); the service is stopped when
+  // the last one is dropped
+  static void Release(NnetBatchService *service);
+
+  // Computes the scaled log-likelihoods of the task, which must be set up
+  // as described in nnet-batch-compute.h, with output_to_cpu set.
+  // Blocks until they are in task->output_cpu.
+  void Compute(nnet3::NnetInferenceTask *task);
+
+  int32 LeftContext() const { return left_context_; }
+  int32 RightContext() const { return right_context_; }
+  int32 FramesPerChunk() const { return opts_.frames_per_chunk; }
+  int32 FrameSubsamplingFactor() const { return opts_.frame_subsampling_factor; }
+
+ private:
+  NnetBatchService(const std::string &key, const AcousticModel *model,
+                   const nnet3::NnetBatchComputerOptions &opts,
+                   int32 max_wait_ms);
+  ~NnetBatchService();
+
+  static gpointer Run(gpointer data);
+  void Run();
+
+  std::string key_;
+  const AcousticModel *model_;  // from ModelRegistry
+  nnet3::NnetBatchComputerOptions opts_;
+  gint64 max_wait_us_;
+  int32 left_context_;
+  int32 right_context_;
+  nnet3::NnetBatchComputer *computer_;
+  int32 ref_count_;  // protected by services_lock_
+
+  // Tasks are counted when they are submitted; all tasks submitted before
+  // the worker started its last round have been computed
+  GMutex lock_;
+  GCond cond_;
+  guint64 num_submitted_;
+  guint64 num_done_;
+  gint64 first_pending_time_;
+  bool stop_;
+  GThread *thread_;
+
+  static GMutex services_lock_;
+  static std::map<std::string, NnetBatchService*> services_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(NnetBatchService);
+};
+
+
+// Online decodable object that gets its scores from an NnetBatchService.
+// It works like DecodableAmNnetLoopedOnline: scores are computed a chunk
+// at a time, when the decoder asks for a frame of a chunk for which enough
+// features are ready, and frame indexes are relative to the frame offset
+// (in subsampled frames) of the current utterance.
+class DecodableNnetBatchedOnline : public DecodableInterface {
+ public:
+  // 'ivector_features' may be NULL if the model doesn't use iVectors
+  DecodableNnetBatchedOnline(const TransitionModel &trans_model,
+                             NnetBatchService *service,
+                             OnlineFeatureInterface *input_features,
+                             OnlineFeatureInterface *ivector_features);
+
+  void SetFrameOffset(int32 frame_offset);
+
+  virtual BaseFloat LogLikelihood(int32 subsampled_frame, int32 transition_id);
+
+  virtual int32 NumFramesReady() const;
+
+  virtual bool IsLastFrame(int32 subsampled_frame) const;
+
+  virtual int32 NumIndices() const { return trans_model_.NumTransitionIds(); }
+
+  // Wall time spent waiting for the service so far, in seconds
+  double ComputeTime() const { return compute_time_; }
+
+ private:
+  // Makes sure that the scores of the chunk containing the given
+  // (absolute, subsampled) frame are in current_log_post_
+  void EnsureFrameIsComputed(int32 subsampled_frame);
+
+  const TransitionModel &trans_model_;
+  NnetBatchService *service_;
+  OnlineFeatureInterface *input_features_;
+  OnlineFeatureInterface *ivector_features_;
+
+  int32 frame_offset_;
+  // Scores of one chunk, starting at this (absolute, subsampled) frame
+  Matrix<BaseFloat> current_log_post_;
+  int32 current_log_post_subsampled_offset_;
+  double compute_time_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableNnetBatchedOnline);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_NNET3_BATCH_SERVICE_H_
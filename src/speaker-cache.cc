@@ -0,0 +1,229 @@
+// speaker-cache.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include <glib/gstdio.h>
+
+#include "./speaker-cache.h"
+#include "./state-blob.h"
+
+namespace kaldi {
+
+const size_t SpeakerStateCache::kDefaultCapacity;
+
+SpeakerStateCache *SpeakerStateCache::Instance() {
+  // Never destroyed, like the model registry
+  static SpeakerStateCache *instance = new SpeakerStateCache();
+  return instance;
+}
+
+SpeakerStateCache::SpeakerStateCache() : capacity_(kDefaultCapacity), num_spilled_(0) {
+  g_mutex_init(&lock_);
+}
+
+void SpeakerStateCache::RequestCapacity(size_t max_speakers) {
+  EntryList evicted;
+  g_mutex_lock(&lock_);
+  capacity_requests_.insert(max_speakers);
+  UpdateCapacity(&evicted);
+  std::string spill_dir = spill_dir_;
+  g_mutex_unlock(&lock_);
+  Spill(&evicted, spill_dir);
+}
+
+void SpeakerStateCache::WithdrawCapacityRequest(size_t max_speakers) {
+  EntryList evicted;
+  g_mutex_lock(&lock_);
+  std::multiset<size_t>::iterator it = capacity_requests_.find(max_speakers);
+  if (it != capacity_requests_.end()) {
+    capacity_requests_.erase(it);
+  }
+  UpdateCapacity(&evicted);
+  std::string spill_dir = spill_dir_;
+  g_mutex_unlock(&lock_);
+  Spill(&evicted, spill_dir);
+}
+
+void SpeakerStateCache::UpdateCapacity(EntryList *evicted) {
+  capacity_ = capacity_requests_.empty() ? kDefaultCapacity : *capacity_requests_.rbegin();
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().speaker_id);
+    evicted->splice(evicted->end(), entries_, --entries_.end());
+  }
+}
+
+size_t SpeakerStateCache::Capacity() const {
+  g_mutex_lock(&lock_);
+  size_t capacity = capacity_;
+  g_mutex_unlock(&lock_);
+  return capacity;
+}
+
+void SpeakerStateCache::SetSpillDirectory(const std::string &dir) {
+  g_mutex_lock(&lock_);
+  spill_dir_ = dir;
+  g_mutex_unlock(&lock_);
+}
+
+std::string SpeakerStateCache::SpillDirectory() const {
+  g_mutex_lock(&lock_);
+  std::string dir = spill_dir_;
+  g_mutex_unlock(&lock_);
+  return dir;
+}
+
+bool SpeakerStateCache::Lookup(
+    const std::string &speaker_id,
+    OnlineIvectorExtractorAdaptationState *adaptation_state,
+    OnlineCmvnState *cmvn_state) {
+  g_mutex_lock(&lock_);
+  std::unordered_map<std::string, EntryList::iterator>::iterator it =
+      index_.find(speaker_id);
+  if (it != index_.end()) {
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *adaptation_state = *it->second->adaptation_state;
+    *cmvn_state = *it->second->cmvn_state;
+    g_mutex_unlock(&lock_);
+    return true;
+  }
+  std::string spill_dir = spill_dir_;
+  g_mutex_unlock(&lock_);
+
+  if (spill_dir.empty()) {
+    return false;
+  }
+  // Read into copies, so that the states are left as they were on failure
+  OnlineIvectorExtractorAdaptationState spilled_adaptation_state(*adaptation_state);
+  OnlineCmvnState spilled_cmvn_state(*cmvn_state);
+  if (!ReadSpilled(spill_dir, speaker_id, &spilled_adaptation_state,
+                   &spilled_cmvn_state)) {
+    return false;
+  }
+  // The speaker is in memory again, and is written back when evicted
+  g_unlink(SpillFilename(spill_dir, speaker_id).c_str());
+  *adaptation_state = spilled_adaptation_state;
+  *cmvn_state = spilled_cmvn_state;
+  Store(speaker_id, spilled_adaptation_state, spilled_cmvn_state);
+  return true;
+}
+
+void SpeakerStateCache::Store(
+    const std::string &speaker_id,
+    const OnlineIvectorExtractorAdaptationState &adaptation_state,
+    const OnlineCmvnState &cmvn_state) {
+  Entry entry;
+  entry.speaker_id = speaker_id;
+  entry.adaptation_state = new OnlineIvectorExtractorAdaptationState(adaptation_state);
+  entry.cmvn_state = new OnlineCmvnState(cmvn_state);
+
+  EntryList evicted;
+  g_mutex_lock(&lock_);
+  Insert(entry, &evicted);
+  std::string spill_dir = spill_dir_;
+  g_mutex_unlock(&lock_);
+  Spill(&evicted, spill_dir);
+}
+
+void SpeakerStateCache::Insert(const Entry &entry, EntryList *evicted) {
+  std::unordered_map<std::string, EntryList::iterator>::iterator it =
+      index_.find(entry.speaker_id);
+  if (it != index_.end()) {
+    delete it->second->adaptation_state;
+    delete it->second->cmvn_state;
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  entries_.push_front(entry);
+  index_[entry.speaker_id] = entries_.begin();
+  while (entries_.size() > capacity_) {
+    index_.erase(entries_.back().speaker_id);
+    evicted->splice(evicted->end(), entries_, --entries_.end());
+  }
+}
+
+void SpeakerStateCache::Spill(EntryList *evicted, const std::string &spill_dir) {
+  for (EntryList::iterator it = evicted->begin(); it != evicted->end(); ++it) {
+    if (!spill_dir.empty()) {
+      std::string filename = SpillFilename(spill_dir, it->speaker_id);
+      // Written to a temporary file first, so that a reader never sees a
+      // partial one. Its name is unique to the process and the spill, as
+      // the directory can be shared and the same speaker spilled twice.
+      std::ostringstream tmp_filename_strm;
+      tmp_filename_strm << filename << ".tmp" << getpid() << "."
+                        << g_atomic_int_add(&num_spilled_, 1);
+      std::string tmp_filename = tmp_filename_strm.str();
+      std::ofstream os(tmp_filename.c_str(), std::ios::binary);
+      WriteStateBlobHeader(kAdaptationStateBlob, os);
+      it->adaptation_state->Write(os, true);
+      WriteStateBlobHeader(kCmvnStateBlob, os);
+      it->cmvn_state->Write(os, true);
+      os.close();
+      if (!os || g_rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        KALDI_WARN << "Could not write the state of speaker " << it->speaker_id
+                   << " to " << filename;
+        g_unlink(tmp_filename.c_str());
+      }
+    }
+    delete it->adaptation_state;
+    delete it->cmvn_state;
+  }
+  evicted->clear();
+}
+
+bool SpeakerStateCache::ReadSpilled(
+    const std::string &spill_dir, const std::string &speaker_id,
+    OnlineIvectorExtractorAdaptationState *adaptation_state,
+    OnlineCmvnState *cmvn_state) {
+  std::string filename = SpillFilename(spill_dir, speaker_id);
+  std::ifstream is(filename.c_str(), std::ios::binary);
+  if (!is) {
+    return false;
+  }
+  try {
+    ReadStateBlobHeader(kAdaptationStateBlob, is);
+    adaptation_state->Read(is, true);
+    ReadStateBlobHeader(kCmvnStateBlob, is);
+    cmvn_state->Read(is, true);
+  } catch (std::runtime_error &e) {
+    KALDI_WARN << "Could not read the state of speaker " << speaker_id
+               << " from " << filename << ", removing it";
+    is.close();
+    g_unlink(filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string SpeakerStateCache::SpillFilename(const std::string &spill_dir,
+                                             const std::string &speaker_id) {
+  // Speaker ids can be anything, so the file is named after a hash of it
+  gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1,
+                                              speaker_id.c_str(), -1);
+  gchar *filename = g_build_filename(spill_dir.c_str(), hash, NULL);
+  std::string result = std::string(filename) + ".state";
+  g_free(filename);
+  g_free(hash);
+  return result;
+}
+
+}  // namespace kaldi
@@ -0,0 +1,119 @@
+// speaker-cache.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_SPEAKER_CACHE_H_
+#define KALDI_SRC_SPEAKER_CACHE_H_
+
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include <glib.h>
+
+#include "online2/online-ivector-feature.h"
+#include "feat/online-feature.h"
+
+namespace kaldi {
+
+// Process-wide LRU cache of the adaptation and CMVN states of speakers, so
+// that a returning speaker starts from where their last session ended
+// without the application having to save and restore the states.
+//
+// At most Capacity() speakers are kept in memory. If a spill directory is
+// set, the states of speakers that are evicted are written there (in the
+// format of state-blob.h, one file per speaker) and read back when the
+// speaker returns, which removes the file, so the directory only holds
+// speakers that are not in memory. All methods are thread-safe.
+class SpeakerStateCache {
+ public:
+  static SpeakerStateCache *Instance();
+
+  static const size_t kDefaultCapacity = 1000;
+
+  // The cache is shared by all the decoders of the process, so it keeps as
+  // many speakers as the largest capacity that any of them has requested
+  // and not withdrawn, or kDefaultCapacity if there is none. A decoder can
+  // therefore never shrink the cache under the others.
+  void RequestCapacity(size_t max_speakers);
+  void WithdrawCapacityRequest(size_t max_speakers);
+  size_t Capacity() const;
+
+  // An empty directory disables spilling. The directory is the same for
+  // all decoders; the last one set is used.
+  void SetSpillDirectory(const std::string &dir);
+  std::string SpillDirectory() const;
+
+  // Copies the states of a speaker into the given ones, or returns false
+  // (leaving them as they are) if the speaker is not known
+  bool Lookup(const std::string &speaker_id,
+              OnlineIvectorExtractorAdaptationState *adaptation_state,
+              OnlineCmvnState *cmvn_state);
+
+  // Stores copies of the states of a speaker
+  void Store(const std::string &speaker_id,
+             const OnlineIvectorExtractorAdaptationState &adaptation_state,
+             const OnlineCmvnState &cmvn_state);
+
+ private:
+  struct Entry {
+    std::string speaker_id;
+    OnlineIvectorExtractorAdaptationState *adaptation_state;
+    OnlineCmvnState *cmvn_state;
+  };
+  typedef std::list<Entry> EntryList;
+
+  SpeakerStateCache();
+
+  // Adds an entry (taking over its states) as the most recently used one,
+  // replacing any entry of the same speaker. The entries that no longer
+  // fit are moved to 'evicted'. Must be called with lock_ held.
+  void Insert(const Entry &entry, EntryList *evicted);
+
+  // Sets capacity_ from the requests and moves the entries that no longer
+  // fit to 'evicted'. Must be called with lock_ held.
+  void UpdateCapacity(EntryList *evicted);
+
+  // Writes the evicted entries to the spill directory, if there is one,
+  // and frees them
+  void Spill(EntryList *evicted, const std::string &spill_dir);
+
+  // Reads the states of a speaker from the spill directory
+  static bool ReadSpilled(const std::string &spill_dir,
+                          const std::string &speaker_id,
+                          OnlineIvectorExtractorAdaptationState *adaptation_state,
+                          OnlineCmvnState *cmvn_state);
+
+  static std::string SpillFilename(const std::string &spill_dir,
+                                   const std::string &speaker_id);
+
+  mutable GMutex lock_;
+  EntryList entries_;  // most recently used first
+  std::unordered_map<std::string, EntryList::iterator> index_;
+  size_t capacity_;
+  std::multiset<size_t> capacity_requests_;
+  std::string spill_dir_;
+  gint num_spilled_;  // for naming temporary files
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(SpeakerStateCache);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_SPEAKER_CACHE_H_
@@ -0,0 +1,112 @@
+// stage-profiler.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./stage-profiler.h"
+
+namespace kaldi {
+
+LatencyHistogram::LatencyHistogram() {
+  for (int32 i = 0; i < kNumBuckets; i++)
+    counts_[i].store(0, std::memory_order_relaxed);
+}
+
+int32 LatencyHistogram::BucketIndex(guint64 us) {
+  if (us < static_cast<guint64>(kSubBuckets))
+    return static_cast<int32>(us);
+  // Values with the highest bit at position kSubBucketBits - 1 + shift
+  // are in buckets of width 2^(shift - 1)
+  int32 shift = (63 - __builtin_clzll(us)) - kSubBucketBits + 1;
+  if (shift > kMaxShift)
+    return kNumBuckets - 1;
+  int32 sub_bucket = static_cast<int32>(us >> (shift - 1)) - kSubBuckets;
+  return shift * kSubBuckets + sub_bucket;
+}
+
+double LatencyHistogram::BucketValue(int32 index) {
+  int32 shift = index / kSubBuckets;
+  int32 sub_bucket = index % kSubBuckets;
+  if (shift == 0)
+    return 1.0 * sub_bucket / G_USEC_PER_SEC;
+  guint64 lowest = static_cast<guint64>(kSubBuckets + sub_bucket) << (shift - 1);
+  guint64 width = static_cast<guint64>(1) << (shift - 1);
+  return (lowest + 0.5 * width) / G_USEC_PER_SEC;
+}
+
+void LatencyHistogram::Record(gint64 us) {
+  counts_[BucketIndex(std::max<gint64>(us, 0))].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+guint64 LatencyHistogram::Count() const {
+  guint64 count = 0;
+  for (int32 i = 0; i < kNumBuckets; i++)
+    count += counts_[i].load(std::memory_order_relaxed);
+  return count;
+}
+
+double LatencyHistogram::Percentile(double q) const {
+  // Other threads may be recording meanwhile, so work on a snapshot
+  guint64 counts[kNumBuckets];
+  guint64 total = 0;
+  for (int32 i = 0; i < kNumBuckets; i++) {
+    counts[i] = counts_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0)
+    return 0.0;
+  guint64 rank = std::max<guint64>(static_cast<guint64>(q * total + 0.5), 1);
+  guint64 seen = 0;
+  for (int32 i = 0; i < kNumBuckets; i++) {
+    seen += counts[i];
+    if (seen >= rank)
+      return BucketValue(i);
+  }
+  return BucketValue(kNumBuckets - 1);
+}
+
+StageProfiler::StageProfiler() {
+  for (int32 i = 0; i < kNumProfilerCounters; i++)
+    counters_[i].store(0, std::memory_order_relaxed);
+}
+
+const char *StageProfiler::StageName(ProfilerStage stage) {
+  switch (stage) {
+    case kFeatureStage: return "feature";
+    case kNnetStage: return "nnet";
+    case kSearchStage: return "search";
+    case kLatticeStage: return "lattice";
+    case kRescoreStage: return "rescore";
+    case kNbestStage: return "nbest";
+    case kJsonStage: return "json";
+    case kPartialResultStage: return "partial-result";
+    default: return "unknown";
+  }
+}
+
+const char *StageProfiler::CounterName(ProfilerCounter counter) {
+  switch (counter) {
+    case kSegmentsCounter: return "segments";
+    case kEndpointsCounter: return "endpoints";
+    case kPartialResultsCounter: return "partial-results";
+    case kRescoreFailuresCounter: return "rescore-failures";
+    default: return "unknown";
+  }
+}
+
+}  // namespace kaldi
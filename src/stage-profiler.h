@@ -0,0 +1,160 @@
+// stage-profiler.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_STAGE_PROFILER_H_
+#define KALDI_SRC_STAGE_PROFILER_H_
+
+#include <algorithm>
+#include <atomic>
+
+#include <glib.h>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// The parts of decoding that are timed separately
+enum ProfilerStage {
+  kFeatureStage = 0,
+  kNnetStage,
+  kSearchStage,
+  kLatticeStage,
+  kRescoreStage,
+  kNbestStage,
+  kJsonStage,
+  kPartialResultStage,
+  kNumProfilerStages
+};
+
+enum ProfilerCounter {
+  kSegmentsCounter = 0,
+  kEndpointsCounter,
+  kPartialResultsCounter,
+  kRescoreFailuresCounter,
+  kNumProfilerCounters
+};
+
+// Histogram of durations in microseconds, with buckets whose width grows
+// with the value (as in HdrHistogram): values below 16 have a bucket each,
+// and each power of two above that is split into 16 buckets, so the
+// percentiles are within about 3% of the exact ones. Record() is
+// lock-free and may be called from any thread.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Record(gint64 us);
+
+  // Number of values recorded
+  guint64 Count() const;
+
+  // The value (in seconds) below which the fraction 'q' of the recorded
+  // values lie, or 0 if there are none
+  double Percentile(double q) const;
+
+ private:
+  static const int32 kSubBucketBits = 4;
+  static const int32 kSubBuckets = 1 << kSubBucketBits;
+  // Up to 2^40 microseconds, longer durations go to the last bucket
+  static const int32 kMaxShift = 40 - kSubBucketBits;
+  static const int32 kNumBuckets = (kMaxShift + 1) * kSubBuckets;
+
+  static int32 BucketIndex(guint64 us);
+  // The middle of the values of a bucket
+  static double BucketValue(int32 index);
+
+  std::atomic<guint64> counts_[kNumBuckets];
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+// Durations of the stages of decoding and counts of events, cheap enough
+// to be always on
+class StageProfiler {
+ public:
+  StageProfiler();
+
+  void Record(ProfilerStage stage, gint64 us) { histograms_[stage].Record(us); }
+
+  void Increment(ProfilerCounter counter) {
+    counters_[counter].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const LatencyHistogram &Histogram(ProfilerStage stage) const {
+    return histograms_[stage];
+  }
+
+  guint64 Counter(ProfilerCounter counter) const {
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  // Names for reporting, e.g. "search" and "partial-results"
+  static const char *StageName(ProfilerStage stage);
+  static const char *CounterName(ProfilerCounter counter);
+
+ private:
+  LatencyHistogram histograms_[kNumProfilerStages];
+  std::atomic<guint64> counters_[kNumProfilerCounters];
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(StageProfiler);
+};
+
+// Times a stage from construction to Stop() or destruction, recording
+// the duration in the profiler (if not NULL) and adding it (in seconds)
+// to '*total' (if not NULL)
+class StageTimer {
+ public:
+  StageTimer(StageProfiler *profiler, ProfilerStage stage, double *total = NULL)
+      : profiler_(profiler), stage_(stage), total_(total),
+        start_(g_get_monotonic_time()), excluded_(0), stopped_(false) { }
+
+  ~StageTimer() { Stop(); }
+
+  // Leaves out time that was spent on something timed separately
+  void Exclude(double seconds) {
+    excluded_ += static_cast<gint64>(seconds * G_USEC_PER_SEC);
+  }
+
+  // Returns the duration in seconds
+  double Stop() {
+    gint64 us = std::max<gint64>(g_get_monotonic_time() - start_ - excluded_, 0);
+    if (!stopped_) {
+      stopped_ = true;
+      if (profiler_ != NULL)
+        profiler_->Record(stage_, us);
+      if (total_ != NULL)
+        *total_ += 1.0 * us / G_USEC_PER_SEC;
+    }
+    return 1.0 * us / G_USEC_PER_SEC;
+  }
+
+ private:
+  StageProfiler *profiler_;
+  ProfilerStage stage_;
+  double *total_;
+  gint64 start_;
+  gint64 excluded_;
+  bool stopped_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(StageTimer);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_STAGE_PROFILER_H_
@@ -0,0 +1,67 @@
+// state-blob.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "./state-blob.h"
+
+namespace kaldi {
+
+static const char kStateBlobMagic[4] = { 'G', 'K', 'S', 'T' };
+static const guint8 kStateBlobVersion = 1;
+static const size_t kStateBlobHeaderSize = 8;
+
+void WriteStateBlobHeader(StateBlobKind kind, std::ostream &os) {
+  char header[kStateBlobHeaderSize] = { 0 };
+  memcpy(header, kStateBlobMagic, sizeof(kStateBlobMagic));
+  header[4] = kStateBlobVersion;
+  header[5] = kind;
+  os.write(header, kStateBlobHeaderSize);
+}
+
+size_t CheckStateBlobHeader(StateBlobKind kind, const guint8 *data, size_t size) {
+  if (size < kStateBlobHeaderSize
+      || memcmp(data, kStateBlobMagic, sizeof(kStateBlobMagic)) != 0) {
+    KALDI_ERR << "Not a binary state";
+  }
+  if (data[4] != kStateBlobVersion) {
+    KALDI_ERR << "Unsupported version " << static_cast<int>(data[4])
+              << " of binary state";
+  }
+  if (data[5] != kind) {
+    KALDI_ERR << "Binary state is of the wrong kind ("
+              << static_cast<int>(data[5]) << ", expected " << kind << ")";
+  }
+  return kStateBlobHeaderSize;
+}
+
+void ReadStateBlobHeader(StateBlobKind kind, std::istream &is) {
+  guint8 header[kStateBlobHeaderSize];
+  is.read(reinterpret_cast<char*>(header), kStateBlobHeaderSize);
+  if (!is) {
+    KALDI_ERR << "Could not read the header of a binary state";
+  }
+  CheckStateBlobHeader(kind, header, kStateBlobHeaderSize);
+}
+
+void FreeStateBlobString(gpointer data) {
+  delete static_cast<std::string*>(data);
+}
+
+}  // namespace kaldi
@@ -0,0 +1,100 @@
+// state-blob.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_SRC_STATE_BLOB_H_
+#define KALDI_SRC_STATE_BLOB_H_
+
+#include <sstream>
+#include <streambuf>
+#include <string>
+
+#include <glib.h>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// Binary form of the per-speaker states (iVector adaptation state, online
+// CMVN state) that applications save between sessions: an 8-byte header
+// (the magic "GKST", a format version, the kind of state and two reserved
+// bytes) followed by the state as written by its Write() in binary mode.
+enum StateBlobKind {
+  kAdaptationStateBlob = 1,
+  kCmvnStateBlob = 2
+};
+
+// Returns the binary form of 'state', which is an
+// OnlineIvectorExtractorAdaptationState or an OnlineCmvnState.
+// The bytes are handed over without being copied.
+template<class State>
+GBytes *WriteStateBlob(StateBlobKind kind, const State &state);
+
+// Reads 'state' from its binary form. Throws std::runtime_error if the
+// bytes are not a state of the given kind in a known version.
+template<class State>
+void ReadStateBlob(StateBlobKind kind, GBytes *bytes, State *state);
+
+
+// Implementation details
+
+// Writes the header of a state blob
+void WriteStateBlobHeader(StateBlobKind kind, std::ostream &os);
+
+// Checks the header and returns the size of it
+size_t CheckStateBlobHeader(StateBlobKind kind, const guint8 *data, size_t size);
+
+// Reads and checks the header of a state blob from a stream
+void ReadStateBlobHeader(StateBlobKind kind, std::istream &is);
+
+// Read-only stream buffer over memory that isn't ours, to read it without
+// copying it into a std::istringstream
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  MemoryStreamBuf(const guint8 *data, size_t size) {
+    char *begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+    setg(begin, begin, begin + size);
+  }
+};
+
+// The GBytes free function for a std::string
+void FreeStateBlobString(gpointer data);
+
+template<class State>
+GBytes *WriteStateBlob(StateBlobKind kind, const State &state) {
+  std::ostringstream os;
+  WriteStateBlobHeader(kind, os);
+  state.Write(os, true);
+  std::string *blob = new std::string(os.str());
+  return g_bytes_new_with_free_func(blob->data(), blob->size(),
+                                    FreeStateBlobString, blob);
+}
+
+template<class State>
+void ReadStateBlob(StateBlobKind kind, GBytes *bytes, State *state) {
+  gsize size;
+  const guint8 *data = static_cast<const guint8*>(g_bytes_get_data(bytes, &size));
+  size_t header_size = CheckStateBlobHeader(kind, data, size);
+  MemoryStreamBuf buf(data + header_size, size - header_size);
+  std::istream is(&buf);
+  state->Read(is, true);
+}
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_STATE_BLOB_H_
@@ -0,0 +1,1658 @@
+// stream-decoder.cc
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <algorithm>
+#include <deque>
+#include <sstream>
+
+#include "./stream-decoder.h"
+#include "./nnet3-batch-service.h"
+
+#include "decoder/decodable-matrix.h"
+#include "hmm/hmm-utils.h"
+#include "lat/confidence.h"
+#include "lat/determinize-lattice-pruned.h"
+#include "lat/lattice-functions.h"
+#include "lat/sausages.h"
+#include "util/parse-options.h"
+
+namespace kaldi {
+
+void StreamDecoderConfig::Register(OptionsItf *opts) {
+  opts->Register("nnet-mode", &nnet_mode,
+                 "Neural network mode: 2 for nnet2, 3 for nnet3");
+  opts->Register("use-threaded-decoder", &use_threaded_decoder,
+                 "Use a decoder that does feature calculation and the network "
+                 "in separate threads");
+  opts->Register("do-endpointing", &do_endpointing,
+                 "If true, apply endpoint detection and split the audio into "
+                 "segments");
+  opts->Register("chunk-length-in-secs", &chunk_length_in_secs,
+                 "Length of the chunks of audio that are decoded at a time");
+  opts->Register("traceback-period-in-secs", &traceback_period_in_secs,
+                 "Time between partial results");
+  opts->Register("max-lag-in-frames", &max_lag_in_frames,
+                 "How far the threaded decoders may fall behind the audio, "
+                 "in frames");
+  opts->Register("max-lag-in-ms", &max_lag_in_ms,
+                 "If > 0, how far the threaded decoders may fall behind the "
+                 "audio, in milliseconds; overrides max-lag-in-frames");
+  opts->Register("nnet3-batch-size", &nnet3_batch_size,
+                 "If > 0, compute the nnet3 network in batches of this many "
+                 "chunks, shared by all decoders in the process");
+  opts->Register("nnet3-batch-frames-per-chunk", &nnet3_batch_frames_per_chunk,
+                 "Number of frames in the chunks of the batched nnet3 "
+                 "computation, which are computed with their full context");
+  opts->Register("nnet3-batch-max-wait-ms", &nnet3_batch_max_wait_ms,
+                 "How long a chunk may wait for a batch to fill up");
+  opts->Register("num-nbest", &num_nbest,
+                 "Number of hypotheses in the full final results");
+  opts->Register("num-phone-alignment", &num_phone_alignment,
+                 "Number of hypotheses with a phone alignment");
+  opts->Register("do-phone-alignment", &do_phone_alignment,
+                 "If true, output phone alignments");
+  opts->Register("min-words-for-ivector", &min_words_for_ivector,
+                 "Minimum number of words in a segment for updating the "
+                 "adaptation state");
+  opts->Register("inverse-scale", &inverse_scale,
+                 "If true, scale the lattices by the inverse of the acoustic "
+                 "scale");
+  opts->Register("lmwt-scale", &lmwt_scale,
+                 "LM weight scale of the lattices");
+  opts->Register("max-pending-results", &max_pending_results,
+                 "If > 0, produce the final results in the background while "
+                 "decoding goes on, with at most this many segments waiting");
+
+  endpoint_config.Register(opts);
+  silence_weighting_config.Register(opts);
+  nnet3_decodable_opts.Register(opts);
+  decoder_opts.Register(opts);
+  ParseOptions nnet2_opts("nnet2", opts);
+  nnet2_decoding_config.Register(&nnet2_opts);
+  ParseOptions nnet2_threaded_opts("nnet2-threaded", opts);
+  nnet2_decoding_threaded_config.Register(&nnet2_threaded_opts);
+}
+
+
+// The lattice of a segment and what is needed to turn it into results,
+// possibly after decoding has moved on to the next segment. Partial
+// results that have to wait for those results go through the same queue,
+// with 'partial' set and no models or lattice.
+struct StreamDecoder::Finalization {
+  StreamDecoder *decoder;
+  ModelSet *models;  // holds a reference
+  CompactLattice clat;
+  float segment_start_time;
+  float total_time_decoded;
+  SegmentStats stats;
+  bool partial;
+  std::string transcript;
+  std::string delta_json;
+};
+
+// The looped nnet3 decodable of the pipelined mode, which can copy the
+// scores it has computed out a whole block of rows at a time instead of
+// one LogLikelihood() call per pdf
+class DecodableNnetLoopedRows : public nnet3::DecodableNnetLoopedOnline {
+ public:
+  DecodableNnetLoopedRows(const nnet3::DecodableNnetSimpleLoopedInfo &info,
+                          OnlineFeatureInterface *input_features,
+                          OnlineFeatureInterface *ivector_features)
+      : nnet3::DecodableNnetLoopedOnline(info, input_features, ivector_features) { }
+
+  // Copies the scaled scores of frames [begin_frame, begin_frame +
+  // output->NumRows()), indexed by pdf, into 'output'. Frames must be
+  // copied in order, as with LogLikelihood(); the decodable must not have
+  // a frame offset.
+  void GetOutput(int32 begin_frame, MatrixBase<BaseFloat> *output) {
+    int32 end_frame = begin_frame + output->NumRows();
+    for (int32 t = begin_frame; t < end_frame; ) {
+      EnsureFrameIsComputed(t);
+      int32 row = t - current_log_post_subsampled_offset_;
+      int32 num_rows = std::min(end_frame - t, current_log_post_.NumRows() - row);
+      output->RowRange(t - begin_frame, num_rows).CopyFromMat(
+          current_log_post_.RowRange(row, num_rows));
+      t += num_rows;
+    }
+    output->Scale(info_.opts.acoustic_scale);
+  }
+};
+
+// Scores of the audio of one Read() in the pipelined nnet3 mode
+struct StreamDecoder::Nnet3PipelineChunk {
+  Vector<BaseFloat> wave;
+  Matrix<BaseFloat> loglikes;  // scaled, indexed by pdf
+  int32 num_feature_frames_ready;
+  bool last;
+  // Time spent on the features and scores in the compute thread
+  double feature_time;
+  double nnet_time;
+};
+
+// State shared by the threads of the pipelined nnet3 mode: the compute
+// thread reads the audio and computes the features and scores, and the
+// thread that calls Decode() does the search
+struct StreamDecoder::Nnet3Pipeline {
+  StreamDecoder *decoder;
+  OnlineNnet2FeaturePipeline *feature_pipeline;
+  DecodableNnetLoopedRows *decodable;
+  // Protects feature_pipeline against the compute thread
+  GMutex feature_lock;
+  // Protects the fields below
+  GMutex lock;
+  GCond cond;
+  std::deque<Nnet3PipelineChunk*> chunks;
+  int32 num_queued_frames;
+  // Frame weights from silence weighting, not yet passed to the features
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+  // Tells the compute thread to stop after its current chunk
+  bool stop;
+};
+
+// What nnet3 decoding carries from one segment of a stream to the next:
+// the features, and the decoder that is reinitialized at every segment.
+// Only one of 'decoder' and 'lattice_decoder' is set, depending on the
+// mode; the latter decodes with 'batched_decodable' or, in the pipelined
+// mode, with the scores that 'pipeline' computes using 'nnet_decodable'.
+struct StreamDecoder::Nnet3Stream {
+  ModelSet *models;  // holds a reference
+  OnlineNnet2FeaturePipeline *feature_pipeline;
+  SingleUtteranceNnet3Decoder *decoder;
+  LatticeFasterOnlineDecoder *lattice_decoder;
+  NnetBatchService *batch_service;
+  DecodableNnetBatchedOnline *batched_decodable;
+  DecodableNnetLoopedRows *nnet_decodable;
+  Nnet3Pipeline *pipeline;
+  GThread *compute_thread;
+  IncrementalTraceback *traceback;
+  // Frames decoded since the start of feature_pipeline, and where in the
+  // stream its audio starts
+  int32 frame_offset;
+  float start_time;
+};
+
+
+StreamDecoder::StreamDecoder(StreamDecoderListener *listener,
+                             StageProfiler *profiler)
+    : listener_(listener), profiler_(profiler), feature_info_(NULL),
+      audio_source_(NULL), adaptation_state_(NULL), cmvn_state_(NULL),
+      sample_rate_(0), chunk_length_(0), max_lag_in_frames_(0),
+      segment_models_(NULL),
+      segment_start_time_(0.0), total_time_decoded_(0.0),
+      nnet3_stream_(NULL), replay_audio_ended_(false),
+      num_pending_finalizations_(0), num_pending_partial_results_(0) {
+  KALDI_ASSERT(listener_ != NULL && profiler_ != NULL);
+  finalize_pool_ = g_thread_pool_new(StreamDecoder::RunFinalization,
+                                     NULL, 1, FALSE, NULL);
+  g_mutex_init(&finalize_lock_);
+  g_cond_init(&finalize_cond_);
+}
+
+StreamDecoder::~StreamDecoder() {
+  // Lets pending results finish first
+  g_thread_pool_free(finalize_pool_, FALSE, TRUE);
+  g_mutex_clear(&finalize_lock_);
+  g_cond_clear(&finalize_cond_);
+}
+
+int32 StreamDecoder::SampleRate(
+    const OnlineNnet2FeaturePipelineInfo &feature_info) {
+  if (feature_info.feature_type == "plp")
+    return static_cast<int32>(feature_info.plp_opts.frame_opts.samp_freq);
+  return static_cast<int32>(feature_info.mfcc_opts.frame_opts.samp_freq);
+}
+
+void StreamDecoder::Decode(const StreamDecoderConfig &config,
+                           const OnlineNnet2FeaturePipelineInfo &feature_info,
+                           StreamAudioSource *audio_source,
+                           OnlineIvectorExtractorAdaptationState *adaptation_state,
+                           OnlineCmvnState *cmvn_state) {
+  config_ = config;
+  feature_info_ = &feature_info;
+  audio_source_ = audio_source;
+  adaptation_state_ = adaptation_state;
+  cmvn_state_ = cmvn_state;
+  sample_rate_ = SampleRate(feature_info);
+  chunk_length_ = static_cast<int32>(sample_rate_ * config_.chunk_length_in_secs);
+  max_lag_in_frames_ = config_.max_lag_in_frames;
+  if (config_.max_lag_in_ms > 0) {
+    // In the frames that the threaded decoders count: feature frames with
+    // nnet2, scored (subsampled) frames with nnet3
+    max_lag_in_frames_ = std::max(1, static_cast<int32>(
+        config_.max_lag_in_ms / (1000.0 * FrameShift()) + 0.5));
+  }
+
+  bool more_data = true;
+  Vector<BaseFloat> remaining_wave_part;
+  segment_start_time_ = 0.0;
+  total_time_decoded_ = 0.0;
+  while (more_data) {
+    // Each segment is decoded with the models that are current when it
+    // starts, even if they are replaced in the meantime
+    segment_models_ = listener_->AcquireModels();
+
+    if (config_.nnet_mode == NNET2) {
+      if (config_.use_threaded_decoder) {
+        ThreadedDecodeSegment(&more_data, &remaining_wave_part);
+      } else {
+        UnthreadedDecodeSegment(&more_data);
+      }
+    } else {
+      if ((nnet3_stream_ != NULL) && (nnet3_stream_->models != segment_models_)) {
+        const ModelSet *stream_models = nnet3_stream_->models;
+        if (stream_models->acoustic_model() != segment_models_->acoustic_model()
+            || stream_models->decode_fst() != segment_models_->decode_fst()) {
+          // A new network would have to be run over all the features of the
+          // stream so far, so the features are started anew as well
+          KALDI_VLOG(1) << "Models have changed, restarting the features";
+          EndNnet3Stream();
+        } else {
+          // Only models that are used after the search (symbol tables,
+          // LMs, word boundaries) have changed, so the stream goes on; the
+          // segment resets the traceback before using the new symbols
+          segment_models_->Ref();
+          nnet3_stream_->models->Unref();
+          nnet3_stream_->models = segment_models_;
+          nnet3_stream_->traceback->SetWordSymbols(segment_models_->word_syms());
+        }
+      }
+      if (nnet3_stream_ == NULL) {
+        StartNnet3Stream();
+      }
+      if (nnet3_stream_->batched_decodable != NULL) {
+        Nnet3BatchedDecodeSegment(&more_data);
+      } else if (nnet3_stream_->pipeline != NULL) {
+        Nnet3ThreadedDecodeSegment(&more_data);
+      } else {
+        Nnet3UnthreadedDecodeSegment(&more_data);
+      }
+    }
+    segment_models_->Unref();
+    segment_models_ = NULL;
+    segment_start_time_ = total_time_decoded_;
+  }
+  if (nnet3_stream_ != NULL) {
+    EndNnet3Stream();
+  }
+  WaitForResults();
+
+  feature_info_ = NULL;
+  audio_source_ = NULL;
+  adaptation_state_ = NULL;
+  cmvn_state_ = NULL;
+}
+
+// Confidence of a word or phone of a hypothesis other than the one an MBR
+// object was created with: its highest posterior in the sausage bins that
+// overlap it
+static BaseFloat SausageConfidence(const MinimumBayesRisk &mbr, int32 label,
+                                   BaseFloat start_frame, BaseFloat end_frame) {
+  const std::vector<std::vector<std::pair<int32, BaseFloat> > > &stats = mbr.GetSausageStats();
+  const std::vector<std::pair<BaseFloat, BaseFloat> > &times = mbr.GetSausageTimes();
+  BaseFloat confidence = 0.0;
+  for (size_t i = 0; i < stats.size(); i++) {
+    if (times[i].second <= start_frame || times[i].first >= end_frame) {
+      continue;
+    }
+    for (size_t j = 0; j < stats[i].size(); j++) {
+      if (stats[i][j].first == label) {
+        confidence = std::max(confidence, stats[i][j].second);
+      }
+    }
+  }
+  return confidence;
+}
+
+// The phone-level MBR is computed for the first hypothesis and kept in
+// *phone_mbr, whose sausages give the confidences of the others
+static std::vector<PhoneAlignmentInfo> PhoneAlignment(
+    const ModelSet *models, const std::vector<int32> &alignment,
+    const CompactLattice &clat, MinimumBayesRisk **phone_mbr) {
+  std::vector<PhoneAlignmentInfo> result;
+  const TransitionModel &trans_model = models->acoustic_model()->trans_model;
+
+  std::vector<std::vector<int32> > split;
+  SplitToPhones(trans_model, alignment, &split);
+
+  std::vector<int32> phones;
+  for (size_t i = 0; i < split.size(); i++) {
+    KALDI_ASSERT(split[i].size() > 0);
+    phones.push_back(trans_model.TransitionIdToPhone(split[i][0]));
+  }
+  std::vector<BaseFloat> confidences;
+  bool first_hypothesis = (*phone_mbr == NULL);
+  if (first_hypothesis) {
+    Lattice lat;
+    ConvertLattice(clat, &lat);
+    ConvertLatticeToPhones(trans_model, &lat);
+    CompactLattice phone_clat;
+    ConvertLattice(lat, &phone_clat);
+    MinimumBayesRiskOptions mbr_opts;
+    mbr_opts.decode_mbr = false;  // we just want confidences
+    mbr_opts.print_silence = false;
+    *phone_mbr = new MinimumBayesRisk(phone_clat, phones, mbr_opts);
+    confidences = (*phone_mbr)->GetOneBestConfidences();
+  }
+
+  int32 current_start_frame = 0;
+  for (size_t i = 0; i < split.size(); i++) {
+    PhoneAlignmentInfo alignment_info;
+    alignment_info.phone_id = phones[i];
+    alignment_info.start_frame = current_start_frame;
+    alignment_info.length_in_frames = split[i].size();
+    alignment_info.confidence = 0.0;
+    if (!first_hypothesis) {
+      alignment_info.confidence = SausageConfidence(
+          **phone_mbr, phones[i], current_start_frame,
+          current_start_frame + split[i].size());
+    } else if (confidences.size() > 0) {
+      alignment_info.confidence = confidences[i];
+    }
+    result.push_back(alignment_info);
+    current_start_frame += split[i].size();
+  }
+  return result;
+}
+
+// Word times and confidences of a hypothesis from its own word-level MBR,
+// which is returned in *hyp_mbr
+static std::vector<WordAlignmentInfo> MbrWordAlignment(
+    const std::vector<int32> &words, const CompactLattice &full_clat,
+    MinimumBayesRisk **hyp_mbr) {
+  std::vector<WordAlignmentInfo> result;
+
+  MinimumBayesRiskOptions mbr_opts;
+  mbr_opts.decode_mbr = false;  // we just want confidences
+  mbr_opts.print_silence = false;
+
+  *hyp_mbr = new MinimumBayesRisk(full_clat, words, mbr_opts);
+  std::vector<BaseFloat> confidences = (*hyp_mbr)->GetOneBestConfidences();
+  const std::vector<std::pair<BaseFloat, BaseFloat> > &times = (*hyp_mbr)->GetOneBestTimes();
+
+  KALDI_ASSERT(words.size() == times.size());
+  int32 confidence_i = 0;
+  for (size_t i = 0; i < words.size(); i++) {
+    if (words[i] == 0) {
+      // Don't output anything for <eps> links, which
+      continue;  // correspond to silence....
+    }
+    WordAlignmentInfo alignment_info;
+    alignment_info.word_id = words[i];
+    alignment_info.start_frame = times[i].first;
+    alignment_info.length_in_frames = times[i].second - times[i].first;
+    alignment_info.confidence = 0.0;
+    if (confidences.size() > 0) {
+      alignment_info.confidence = confidences[confidence_i++];
+    }
+    result.push_back(alignment_info);
+  }
+  return result;
+}
+
+// The word-level MBR is computed for the first hypothesis and kept in
+// *mbr. If the lattice is word-aligned, the other hypotheses take their
+// times from their path and their confidences from the sausages of *mbr;
+// otherwise each of them gets its own MBR.
+static std::vector<WordAlignmentInfo> WordAlignment(
+    const Lattice &lat, const std::vector<int32> &words,
+    const CompactLattice &full_clat, bool word_aligned, MinimumBayesRisk **mbr) {
+  if (word_aligned && *mbr != NULL) {
+    std::vector<WordAlignmentInfo> result;
+    CompactLattice clat;
+    ConvertLattice(lat, &clat);
+    std::vector<int32> path_words, begin_times, lengths;
+    if (CompactLatticeToWordAlignment(clat, &path_words, &begin_times, &lengths)) {
+      for (size_t i = 0; i < path_words.size(); i++) {
+        if (path_words[i] == 0) {
+          // Don't output anything for <eps> links, which
+          continue;  // correspond to silence....
+        }
+        WordAlignmentInfo alignment_info;
+        alignment_info.word_id = path_words[i];
+        alignment_info.start_frame = begin_times[i];
+        alignment_info.length_in_frames = lengths[i];
+        alignment_info.confidence = SausageConfidence(
+            **mbr, path_words[i], begin_times[i], begin_times[i] + lengths[i]);
+        result.push_back(alignment_info);
+      }
+      return result;
+    }
+    KALDI_WARN << "Could not get the word alignment of the path, computing its own MBR";
+  }
+
+  MinimumBayesRisk *hyp_mbr = NULL;
+  std::vector<WordAlignmentInfo> result = MbrWordAlignment(words, full_clat, &hyp_mbr);
+  if (*mbr == NULL) {
+    *mbr = hyp_mbr;
+  } else {
+    delete hyp_mbr;
+  }
+  return result;
+}
+
+void StreamDecoder::ScaleLattice(CompactLattice *clat) const {
+  if (config_.inverse_scale) {
+    BaseFloat inv_acoustic_scale = 1.0;
+    if (config_.nnet_mode == NNET2) {
+      if (config_.use_threaded_decoder) {
+        inv_acoustic_scale = 1.0 / config_.nnet2_decoding_threaded_config.acoustic_scale;
+      } else {
+        inv_acoustic_scale = 1.0 / config_.nnet2_decoding_config.decodable_opts.acoustic_scale;
+      }
+    } else {
+      inv_acoustic_scale = 1.0 / config_.nnet3_decodable_opts.acoustic_scale;
+    }
+    fst::ScaleLattice(fst::AcousticLatticeScale(inv_acoustic_scale), clat);
+  }
+  fst::ScaleLattice(fst::LatticeScale(config_.lmwt_scale, 1.0), clat);
+}
+
+// Number of words on the best path of the first-pass lattice, i.e. in the
+// final result if the lattice is not rescored
+int32 StreamDecoder::NumBestPathWords(const CompactLattice &clat) const {
+  if (clat.NumStates() == 0) {
+    return 0;
+  }
+  CompactLattice scaled_clat(clat);
+  ScaleLattice(&scaled_clat);
+  CompactLattice best_path_clat;
+  CompactLatticeShortestPath(scaled_clat, &best_path_clat);
+  Lattice best_path_lat;
+  ConvertLattice(best_path_clat, &best_path_lat);
+  std::vector<int32> words;
+  std::vector<int32> alignment;
+  LatticeWeight weight;
+  GetLinearSymbolSequence(best_path_lat, &alignment, &words, &weight);
+  return words.size();
+}
+
+// Length of a frame of the alignments, in seconds
+BaseFloat StreamDecoder::FrameShift() const {
+  BaseFloat frame_shift = feature_info_->FrameShiftInSeconds();
+  if (config_.nnet_mode == NNET3) {
+    frame_shift *= config_.nnet3_decodable_opts.frame_subsampling_factor;
+  }
+  return frame_shift;
+}
+
+std::string StreamDecoder::WordsToString(const ModelSet *models,
+                                         const std::vector<int32> &words) const {
+  std::stringstream sentence;
+  for (size_t i = 0; i < words.size(); i++) {
+    std::string s = models->word_syms()->Find(words[i]);
+    if (s == "")
+      KALDI_WARN << "Word-id " << words[i] << " not in symbol table.";
+    if (i > 0) {
+      sentence << " ";
+    }
+    sentence << s;
+  }
+  return sentence.str();
+}
+
+std::vector<NBestResult> StreamDecoder::NBestResults(const ModelSet *models,
+                                                     CompactLattice *clat) const {
+  std::vector<NBestResult> nbest_results;
+
+  // Whether the n-best paths are word-aligned, so that their word times
+  // can be read off them
+  bool word_aligned = false;
+  if (models->word_boundary_info()) {
+    CompactLattice aligned_clat;
+    if (WordAlignLattice(*clat, models->acoustic_model()->trans_model,
+                         *(models->word_boundary_info()), 0, &aligned_clat)) {
+      *clat = aligned_clat;
+      word_aligned = true;
+    } else {
+      KALDI_WARN << "Failed to word-align the lattice, computing the word "
+                 << "times of each hypothesis with its own MBR";
+    }
+  }
+
+  Lattice lat;
+  ConvertLattice(*clat, &lat);
+
+  std::vector<Lattice> nbest_lats;  // one lattice per path
+  {
+    Lattice nbest_lat;  // one lattice with all best paths, temporary
+    fst::ShortestPath(lat, &nbest_lat, config_.num_nbest);
+    fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+  }
+
+  // The lattice posteriors are computed once, with the first hypothesis,
+  // and shared by the others
+  MinimumBayesRisk *word_mbr = NULL;
+  MinimumBayesRisk *phone_mbr = NULL;
+  for (size_t i = 0; i < nbest_lats.size(); i++) {
+    std::vector<int32> words;
+    std::vector<int32> alignment;
+    LatticeWeight weight;
+    GetLinearSymbolSequence(nbest_lats[i], &alignment, &words, &weight);
+
+    NBestResult nbest_result;
+    nbest_result.likelihood = -(weight.Value1() + weight.Value2());
+    nbest_result.num_frames = alignment.size();
+    for (size_t j = 0; j < words.size(); j++) {
+      WordInHypothesis word_in_hyp;
+      word_in_hyp.word_id = words[j];
+      nbest_result.words.push_back(word_in_hyp);
+    }
+    if (config_.do_phone_alignment
+        && static_cast<int32>(i) < config_.num_phone_alignment) {
+      nbest_result.phone_alignment = PhoneAlignment(models, alignment, *clat, &phone_mbr);
+    }
+    if (models->word_boundary_info()) {
+      nbest_result.word_alignment = WordAlignment(nbest_lats[i], words, *clat,
+                                                  word_aligned, &word_mbr);
+    }
+    nbest_results.push_back(nbest_result);
+  }
+  delete word_mbr;
+  delete phone_mbr;
+  return nbest_results;
+}
+
+bool StreamDecoder::RescoreBigLm(const ModelSet *models,
+                                 const CompactLattice &clat,
+                                 CompactLattice *result_lat) const {
+  Lattice tmp_lattice;
+  ConvertLattice(clat, &tmp_lattice);
+  // Before composing with the LM FST, we scale the lattice weights
+  // by the inverse of "lm_scale".  We'll later scale by "lm_scale".
+  // We do it this way so we can determinize and it will give the
+  // right effect (taking the "best path" through the LM) regardless
+  // of the sign of lm_scale.
+  fst::ScaleLattice(fst::GraphLatticeScale(-1.0), &tmp_lattice);
+  ArcSort(&tmp_lattice, fst::OLabelCompare<LatticeArc>());
+
+  Lattice composed_lat;
+  // Could just do, more simply: Compose(lat, lm_fst, &composed_lat);
+  // and not have lm_compose_cache at all.
+  // The command below is faster, though; it's constant not
+  // logarithmic in vocab size.
+  TableCompose(tmp_lattice, *(models->lm_fst()), &composed_lat,
+               models->lm_compose_cache());
+
+  Invert(&composed_lat);  // make it so word labels are on the input.
+  CompactLattice determinized_lat;
+  DeterminizeLattice(composed_lat, &determinized_lat);
+  fst::ScaleLattice(fst::GraphLatticeScale(-1.0), &determinized_lat);
+  if (determinized_lat.Start() == fst::kNoStateId) {
+    KALDI_WARN << "Empty lattice (incompatible LM?)";
+    return false;
+  }
+  fst::ScaleLattice(fst::GraphLatticeScale(1.0), &determinized_lat);
+  ArcSort(&determinized_lat, fst::OLabelCompare<CompactLatticeArc>());
+
+  // Wraps the ConstArpaLm format language model into FST. We re-create it
+  // for each lattice to prevent memory usage increasing with time; the
+  // LM lookups themselves are kept in the bounded shared cache.
+  CompactLattice composed_clat;
+  ConstArpaLmCache *big_lm_cache = models->big_lm_cache();
+  if (big_lm_cache != NULL) {
+    CachedConstArpaLmDeterministicFst const_arpa_fst(big_lm_cache);
+    // Composes lattice with language model.
+    ComposeCompactLatticeDeterministic(determinized_lat,
+                                       &const_arpa_fst, &composed_clat);
+  } else {
+    ConstArpaLmDeterministicFst const_arpa_fst(*(models->big_lm_const_arpa()));
+    // Composes lattice with language model.
+    ComposeCompactLatticeDeterministic(determinized_lat,
+                                       &const_arpa_fst, &composed_clat);
+  }
+
+  // Determinizes the composed lattice.
+  Lattice big_lm_composed_lat;
+  ConvertLattice(composed_clat, &big_lm_composed_lat);
+  Invert(&big_lm_composed_lat);
+  DeterminizeLattice(big_lm_composed_lat, result_lat);
+  fst::ScaleLattice(fst::GraphLatticeScale(1.0), result_lat);
+  if (result_lat->Start() == fst::kNoStateId) {
+    KALDI_WARN << "Empty lattice (incompatible LM?)";
+    return false;
+  }
+  return true;
+}
+
+// Writes the full final result as JSON into result_json_
+void StreamDecoder::FullFinalResultToJson(const SegmentResult &result) {
+  JsonWriter &json = result_json_;
+  const JsonSymbolTable &word_syms = *result.models->json_word_syms();
+  const std::vector<NBestResult> &nbest_results = result.nbest_results;
+  BaseFloat frame_shift = result.frame_shift;
+
+  json.Reset();
+  json.BeginObject();
+  json.Key("status");
+  json.Int(0);
+  json.Key("result");
+  json.BeginObject();
+  json.Key("final");
+  json.Bool(true);
+  json.Key("hypotheses");
+  json.BeginArray();
+  for (size_t i = 0; i < nbest_results.size(); i++) {
+    const NBestResult &nbest_result = nbest_results[i];
+    json.BeginObject();
+    json.Key("transcript");
+    json.BeginString();
+    for (size_t j = 0; j < nbest_result.words.size(); j++) {
+      if (j > 0) {
+        json.AppendEscaped(' ');
+      }
+      json.AppendEscaped(word_syms.Find(nbest_result.words[j].word_id));
+    }
+    json.EndString();
+    json.Key("likelihood");
+    json.Real(nbest_result.likelihood);
+    if (nbest_result.phone_alignment.size() > 0) {
+      if (result.models->phone_syms() == NULL) {
+        KALDI_WARN << "Phoneme symbol table (phone-syms) must be set to "
+                   << "output phone alignment.";
+      } else {
+        const JsonSymbolTable &phone_syms = *result.models->json_phone_syms();
+        json.Key("phone-alignment");
+        json.BeginArray();
+        for (size_t j = 0; j < nbest_result.phone_alignment.size(); j++) {
+          const PhoneAlignmentInfo &alignment_info = nbest_result.phone_alignment[j];
+          json.BeginObject();
+          json.Key("phone");
+          json.BeginString();
+          json.AppendEscaped(phone_syms.Find(alignment_info.phone_id));
+          json.EndString();
+          json.Key("start");
+          json.Real(alignment_info.start_frame * frame_shift);
+          json.Key("length");
+          json.Real(alignment_info.length_in_frames * frame_shift);
+          json.Key("confidence");
+          json.Real(alignment_info.confidence);
+          json.EndObject();
+        }
+        json.EndArray();
+      }
+    }
+    if (nbest_result.word_alignment.size() > 0) {
+      json.Key("word-alignment");
+      json.BeginArray();
+      for (size_t j = 0; j < nbest_result.word_alignment.size(); j++) {
+        const WordAlignmentInfo &alignment_info = nbest_result.word_alignment[j];
+        json.BeginObject();
+        json.Key("word");
+        json.BeginString();
+        json.AppendEscaped(word_syms.Find(alignment_info.word_id));
+        json.EndString();
+        json.Key("start");
+        json.Real(alignment_info.start_frame * frame_shift);
+        json.Key("length");
+        json.Real(alignment_info.length_in_frames * frame_shift);
+        json.Key("confidence");
+        json.Real(alignment_info.confidence);
+        json.EndObject();
+      }
+      json.EndArray();
+    }
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+
+  json.Key("segment-start");
+  json.Real(result.segment_start);
+  json.Key("segment-length");
+  json.Real(result.segment_length);
+  json.Key("total-length");
+  json.Real(result.total_length);
+  json.EndObject();
+}
+
+void StreamDecoder::FinalResult(Finalization *segment, int32 *num_words) {
+  CompactLattice &clat = segment->clat;
+  if (clat.NumStates() == 0) {
+    KALDI_WARN << "Empty lattice.";
+    return;
+  }
+
+  ScaleLattice(&clat);
+
+  SegmentResult result;
+  result.models = segment->models;
+  result.segment_start = segment->segment_start_time;
+  result.total_length = segment->total_time_decoded;
+  result.frame_shift = FrameShift();
+  result.json = NULL;
+  StageTimer nbest_timer(profiler_, kNbestStage, &segment->stats.nbest_time);
+  result.nbest_results = NBestResults(segment->models, &clat);
+  nbest_timer.Stop();
+  if (result.nbest_results.empty()) {
+    return;
+  }
+
+  const NBestResult &best = result.nbest_results[0];
+  *num_words = best.words.size();
+  std::vector<int32> words;
+  for (size_t i = 0; i < best.words.size(); i++) {
+    words.push_back(best.words[i].word_id);
+  }
+  result.transcript = WordsToString(segment->models, words);
+  result.segment_length = best.num_frames * result.frame_shift;
+  KALDI_VLOG(2) << "Likelihood per frame is " << best.likelihood / best.num_frames
+                << " over " << best.num_frames << " frames";
+  KALDI_VLOG(2) << "Final: " << result.transcript;
+  if (result.transcript.empty()) {
+    return;
+  }
+
+  if (listener_->WantsResultJson()) {
+    StageTimer json_timer(profiler_, kJsonStage, &segment->stats.json_time);
+    FullFinalResultToJson(result);
+    json_timer.Stop();
+    result.json = result_json_.c_str();
+  }
+  listener_->FinalResult(result);
+}
+
+void StreamDecoder::FinalizeSegment(Finalization *segment,
+                                    int32 *num_words) {
+  if ((segment->models->lm_fst() != NULL)
+      && (segment->models->big_lm_const_arpa() != NULL)) {
+    KALDI_VLOG(2) << "Rescoring lattice with a big LM";
+    StageTimer rescore_timer(profiler_, kRescoreStage, &segment->stats.rescore_time);
+    CompactLattice rescored_lat;
+    if (RescoreBigLm(segment->models, segment->clat, &rescored_lat)) {
+      segment->clat = rescored_lat;
+    } else {
+      profiler_->Increment(kRescoreFailuresCounter);
+    }
+    rescore_timer.Stop();
+  }
+  FinalResult(segment, num_words);
+  listener_->SegmentDone(segment->stats);
+}
+
+void StreamDecoder::RunFinalization(gpointer data, gpointer user_data) {
+  Finalization *segment = static_cast<Finalization*>(data);
+  StreamDecoder *decoder = segment->decoder;
+  if (segment->partial) {
+    decoder->PassPartialResult(segment->transcript, segment->delta_json);
+    delete segment;
+    g_mutex_lock(&decoder->finalize_lock_);
+    decoder->num_pending_partial_results_--;
+    g_cond_broadcast(&decoder->finalize_cond_);
+    g_mutex_unlock(&decoder->finalize_lock_);
+    return;
+  }
+  int32 num_words = 0;
+  decoder->FinalizeSegment(segment, &num_words);
+  segment->models->Unref();
+  delete segment;
+
+  g_mutex_lock(&decoder->finalize_lock_);
+  decoder->num_pending_finalizations_--;
+  g_cond_broadcast(&decoder->finalize_cond_);
+  g_mutex_unlock(&decoder->finalize_lock_);
+}
+
+// Produces the results of a segment from its lattice, either right away
+// or, if max-pending-results is set, in the background while decoding goes
+// on. The background thread handles one segment at a time, so the results
+// come out in order. Returns the number of words in the best hypothesis,
+// which in the background case is taken from the first-pass lattice.
+int32 StreamDecoder::SegmentDone(const CompactLattice &clat,
+                                 const SegmentStats &stats) {
+  profiler_->Increment(kSegmentsCounter);
+  Finalization *segment = new Finalization();
+  segment->decoder = this;
+  segment->partial = false;
+  segment->models = segment_models_;
+  segment->models->Ref();
+  segment->clat = clat;
+  segment->segment_start_time = segment_start_time_;
+  segment->total_time_decoded = total_time_decoded_;
+  segment->stats = stats;
+  segment->stats.segment_start = segment_start_time_;
+  // The end was found right before the lattice was made
+  segment->stats.end_time = g_get_monotonic_time()
+      - static_cast<gint64>(stats.lattice_time * G_USEC_PER_SEC);
+
+  int32 num_words = 0;
+  if (config_.max_pending_results <= 0) {
+    FinalizeSegment(segment, &num_words);
+    segment->models->Unref();
+    delete segment;
+    return num_words;
+  }
+
+  num_words = NumBestPathWords(segment->clat);
+  g_mutex_lock(&finalize_lock_);
+  while (num_pending_finalizations_ >= config_.max_pending_results) {
+    KALDI_VLOG(2) << "Waiting for the results of earlier segments";
+    g_cond_wait(&finalize_cond_, &finalize_lock_);
+  }
+  num_pending_finalizations_++;
+  g_mutex_unlock(&finalize_lock_);
+  g_thread_pool_push(finalize_pool_, segment, NULL);
+  return num_words;
+}
+
+// Waits until the results of all segments have been produced
+void StreamDecoder::WaitForResults() {
+  g_mutex_lock(&finalize_lock_);
+  while (num_pending_finalizations_ + num_pending_partial_results_ > 0) {
+    g_cond_wait(&finalize_cond_, &finalize_lock_);
+  }
+  g_mutex_unlock(&finalize_lock_);
+}
+
+void StreamDecoder::PassPartialResult(const std::string &transcript,
+                                      const std::string &delta_json) {
+  if (!transcript.empty()) {
+    listener_->PartialResult(transcript);
+  }
+  if (!delta_json.empty()) {
+    listener_->PartialResultDelta(delta_json);
+  }
+}
+
+// Passes a partial result and its delta (either may be empty) to the
+// listener. While the final results of earlier segments are being
+// produced in the background, they are queued behind them, so that the
+// partial results of a segment never come before the final result of the
+// previous one.
+void StreamDecoder::EmitPartialResult(const std::string &transcript,
+                                      const std::string &delta_json) {
+  if (config_.max_pending_results > 0) {
+    g_mutex_lock(&finalize_lock_);
+    bool queue = (num_pending_finalizations_ + num_pending_partial_results_ > 0);
+    if (queue) {
+      num_pending_partial_results_++;
+    }
+    g_mutex_unlock(&finalize_lock_);
+    if (queue) {
+      Finalization *partial = new Finalization();
+      partial->decoder = this;
+      partial->models = NULL;
+      partial->partial = true;
+      partial->transcript = transcript;
+      partial->delta_json = delta_json;
+      g_thread_pool_push(finalize_pool_, partial, NULL);
+      return;
+    }
+  }
+  PassPartialResult(transcript, delta_json);
+}
+
+void StreamDecoder::PartialResult(const Lattice &lat) {
+  StageTimer timer(profiler_, kPartialResultStage);
+  std::vector<int32> words;
+  std::vector<int32> alignment;
+  LatticeWeight weight;
+  GetLinearSymbolSequence(lat, &alignment, &words, &weight);
+  std::string transcript = WordsToString(segment_models_, words);
+  KALDI_VLOG(2) << "Partial: " << transcript;
+  if (transcript.length() > 0) {
+    EmitPartialResult(transcript, std::string());
+    profiler_->Increment(kPartialResultsCounter);
+  }
+}
+
+// Writes the partial result delta as JSON into partial_result_json_
+void StreamDecoder::PartialResultDeltaToJson(
+    const IncrementalTraceback &traceback, size_t offset) {
+  JsonWriter &json = partial_result_json_;
+  const JsonSymbolTable &word_syms = *segment_models_->json_word_syms();
+
+  json.Reset();
+  json.BeginObject();
+  json.Key("status");
+  json.Int(0);
+  json.Key("segment-start");
+  json.Real(segment_start_time_);
+  json.Key("result");
+  json.BeginObject();
+  json.Key("final");
+  json.Bool(false);
+  json.Key("offset");
+  json.Int(offset);
+  json.Key("num-committed");
+  json.Int(traceback.NumCommittedWords());
+  json.Key("words");
+  json.BeginArray();
+  const std::vector<int32> &words = traceback.Words();
+  for (size_t i = offset; i < words.size(); i++) {
+    json.BeginString();
+    json.AppendEscaped(word_syms.Find(words[i]));
+    json.EndString();
+  }
+  json.EndArray();
+  json.EndObject();
+  json.EndObject();
+}
+
+// Passes on the partial result of a decoder that we can trace back
+// ourselves, and its changes as a structured delta if they are wanted
+void StreamDecoder::IncrementalPartialResult(
+    const LatticeFasterOnlineDecoder &decoder,
+    IncrementalTraceback *traceback) {
+  StageTimer timer(profiler_, kPartialResultStage);
+  traceback->Update(decoder);
+  const std::string &transcript = traceback->Transcript();
+  KALDI_VLOG(2) << "Partial: " << transcript;
+  if (transcript.length() > 0) {
+    profiler_->Increment(kPartialResultsCounter);
+  }
+
+  std::string delta_json;
+  if (listener_->WantsPartialResultDelta()) {
+    traceback->UpdateCommitted(decoder);
+    size_t offset;
+    if (traceback->TakeDelta(&offset)) {
+      PartialResultDeltaToJson(*traceback, offset);
+      KALDI_VLOG(2) << "Partial delta JSON: " << partial_result_json_.str();
+      delta_json = partial_result_json_.str();
+    }
+  }
+  EmitPartialResult(transcript, delta_json);
+}
+
+/* Waits until the decoder threads are at most max-lag-in-frames (or
+ * max-lag-in-ms) behind the received audio. SingleUtteranceNnet2DecoderThreaded doesn't expose its
+ * internal semaphores, so we have to poll, but start with a short interval
+ * and back off, so that we return soon after the frames are decoded. */
+void StreamDecoder::WaitForDecoder(SingleUtteranceNnet2DecoderThreaded *decoder) {
+  const BaseFloat kMinPollInterval = 0.001, kMaxPollInterval = 0.01;
+  BaseFloat poll_interval = kMinPollInterval;
+  while (decoder->NumFramesReceivedApprox() - decoder->NumFramesDecoded()
+         > max_lag_in_frames_) {
+    Sleep(poll_interval);
+    poll_interval = std::min(2 * poll_interval, kMaxPollInterval);
+  }
+}
+
+void StreamDecoder::ThreadedDecodeSegment(bool *more_data,
+                                          Vector<BaseFloat> *remaining_wave_part) {
+  SingleUtteranceNnet2DecoderThreaded decoder(config_.nnet2_decoding_threaded_config,
+                                              segment_models_->acoustic_model()->trans_model,
+                                              segment_models_->acoustic_model()->am_nnet2,
+                                              *(segment_models_->decode_fst()),
+                                              *feature_info_,
+                                              *adaptation_state_,
+                                              *cmvn_state_);
+
+  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length_);
+  KALDI_VLOG(2) << "Reading audio in " << wave_part.Dim() << " sample chunks...";
+  BaseFloat last_traceback = 0.0;
+  BaseFloat num_seconds_decoded = 0.0;
+  // The features, network and search run in the decoder's own threads,
+  // only the time spent waiting for them can be measured here
+  SegmentStats stats;
+  if (remaining_wave_part->Dim() > 0) {
+    KALDI_VLOG(2) << "Submitting remaining wave of size " << remaining_wave_part->Dim();
+    decoder.AcceptWaveform(sample_rate_, *remaining_wave_part);
+    total_time_decoded_ += 1.0 * remaining_wave_part->Dim() / sample_rate_;
+    StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+    WaitForDecoder(&decoder);
+    search_timer.Stop();
+  }
+  while (true) {
+    *more_data = audio_source_->Read(&wave_part);
+    KALDI_VLOG(2) << "Submitting wave of size: " << wave_part.Dim();
+    decoder.AcceptWaveform(sample_rate_, wave_part);
+    total_time_decoded_ += 1.0 * wave_part.Dim() / sample_rate_;
+    if (!*more_data) {
+      decoder.InputFinished();
+      break;
+    }
+
+    if (config_.do_endpointing) {
+      // Wait until there are at most max-lag-in-frames frames left to decode
+      // (by default 100, i.e. one second with the usual frame shift), or
+      // max-lag-in-ms worth of them
+      StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+      WaitForDecoder(&decoder);
+      search_timer.Stop();
+
+      if ((decoder.NumFramesDecoded() > 0)
+          && decoder.EndpointDetected(config_.endpoint_config)) {
+        decoder.TerminateDecoding();
+        KALDI_VLOG(2) << "Endpoint detected!";
+        profiler_->Increment(kEndpointsCounter);
+        break;
+      }
+    }
+    num_seconds_decoded += config_.chunk_length_in_secs;
+    if ((num_seconds_decoded - last_traceback > config_.traceback_period_in_secs)
+        && (decoder.NumFramesDecoded() > 0)) {
+      Lattice lat;
+      decoder.GetBestPath(false, &lat, NULL);
+      PartialResult(lat);
+      last_traceback += config_.traceback_period_in_secs;
+    }
+  }
+
+  StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+  decoder.Wait();
+  search_timer.Stop();
+
+  decoder.GetRemainingWaveform(remaining_wave_part);
+  KALDI_VLOG(2) << "Remaining waveform size: " << remaining_wave_part->Dim();
+  total_time_decoded_ -= 1.0 * remaining_wave_part->Dim() / sample_rate_;
+
+  if (num_seconds_decoded > 0.1) {
+    StageTimer lattice_timer(profiler_, kLatticeStage, &stats.lattice_time);
+    decoder.FinalizeDecoding();
+    CompactLattice clat;
+    bool end_of_utterance = true;
+    decoder.GetLattice(end_of_utterance, &clat, NULL);
+    lattice_timer.Stop();
+    stats.audio_duration = num_seconds_decoded;
+    stats.num_frames = decoder.NumFramesDecoded();
+    int32 num_words = SegmentDone(clat, stats);
+    if (num_words >= config_.min_words_for_ivector) {
+      // Only update adaptation state if the utterance contained enough words
+      decoder.GetAdaptationState(adaptation_state_);
+    }
+  } else {
+    KALDI_VLOG(2) << "Less than 0.1 seconds decoded, discarding";
+  }
+}
+
+void StreamDecoder::UnthreadedDecodeSegment(bool *more_data) {
+  OnlineNnet2FeaturePipeline feature_pipeline(*feature_info_);
+  feature_pipeline.SetAdaptationState(*adaptation_state_);
+  SingleUtteranceNnet2Decoder decoder(config_.nnet2_decoding_config,
+                                      segment_models_->acoustic_model()->trans_model,
+                                      segment_models_->acoustic_model()->am_nnet2,
+                                      *(segment_models_->decode_fst()),
+                                      &feature_pipeline);
+  OnlineSilenceWeighting silence_weighting(segment_models_->acoustic_model()->trans_model,
+                                           config_.silence_weighting_config);
+  IncrementalTraceback traceback(segment_models_->word_syms());
+
+  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length_);
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+  KALDI_VLOG(2) << "Reading audio in " << wave_part.Dim() << " sample chunks...";
+  BaseFloat last_traceback = 0.0;
+  BaseFloat num_seconds_decoded = 0.0;
+  SegmentStats stats;
+  while (true) {
+    *more_data = audio_source_->Read(&wave_part);
+
+    StageTimer feature_timer(profiler_, kFeatureStage, &stats.feature_time);
+    feature_pipeline.AcceptWaveform(sample_rate_, wave_part);
+    if (!*more_data) {
+      feature_pipeline.InputFinished();
+    }
+    feature_timer.Stop();
+
+    if (silence_weighting.Active() &&
+        feature_pipeline.IvectorFeature() != NULL) {
+      silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
+      silence_weighting.GetDeltaWeights(feature_pipeline.IvectorFeature()->NumFramesReady(), 0,
+                                        &delta_weights);
+      feature_pipeline.IvectorFeature()->UpdateFrameWeights(delta_weights);
+    }
+
+    StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+    decoder.AdvanceDecoding();
+    search_timer.Stop();
+    stats.total_active_tokens += NumActiveTokens(decoder.Decoder());
+    stats.num_active_token_samples++;
+    num_seconds_decoded += 1.0 * wave_part.Dim() / sample_rate_;
+    total_time_decoded_ += 1.0 * wave_part.Dim() / sample_rate_;
+    if (!*more_data) {
+      break;
+    }
+    if (config_.do_endpointing
+        && (decoder.NumFramesDecoded() > 0)
+        && decoder.EndpointDetected(config_.endpoint_config)) {
+      KALDI_VLOG(2) << "Endpoint detected!";
+      profiler_->Increment(kEndpointsCounter);
+      break;
+    }
+
+    if ((num_seconds_decoded - last_traceback > config_.traceback_period_in_secs)
+        && (decoder.NumFramesDecoded() > 0)) {
+      IncrementalPartialResult(decoder.Decoder(), &traceback);
+      last_traceback += config_.traceback_period_in_secs;
+    }
+  }
+
+  if (num_seconds_decoded > 0.1) {
+    StageTimer lattice_timer(profiler_, kLatticeStage, &stats.lattice_time);
+    decoder.FinalizeDecoding();
+    CompactLattice clat;
+    bool end_of_utterance = true;
+    decoder.GetLattice(end_of_utterance, &clat);
+    lattice_timer.Stop();
+    stats.audio_duration = num_seconds_decoded;
+    stats.num_frames = decoder.NumFramesDecoded();
+    int32 num_words = SegmentDone(clat, stats);
+    if (num_words >= config_.min_words_for_ivector) {
+      // Only update adaptation state if the utterance contained enough words
+      feature_pipeline.GetAdaptationState(adaptation_state_);
+      feature_pipeline.GetCmvnState(cmvn_state_);
+    }
+  } else {
+    KALDI_VLOG(2) << "Less than 0.1 seconds decoded, discarding";
+  }
+}
+
+// Starts decoding a stream, or restarts it after the models have changed,
+// with the models of the current segment
+void StreamDecoder::StartNnet3Stream() {
+  Nnet3Stream *stream = new Nnet3Stream();
+  stream->models = segment_models_;
+  stream->models->Ref();
+  stream->feature_pipeline = new OnlineNnet2FeaturePipeline(*feature_info_);
+  stream->feature_pipeline->SetAdaptationState(*adaptation_state_);
+  stream->feature_pipeline->SetCmvnState(*cmvn_state_);
+  stream->traceback = new IncrementalTraceback(segment_models_->word_syms());
+  stream->frame_offset = 0;
+  stream->start_time = total_time_decoded_;
+
+  const TransitionModel &trans_model = segment_models_->acoustic_model()->trans_model;
+  if (config_.nnet3_batch_size > 0) {
+    try {
+      stream->batch_service = NnetBatchService::Acquire(segment_models_->acoustic_model_rxfilename(),
+                                                        config_.nnet3_decodable_opts,
+                                                        config_.nnet3_batch_size,
+                                                        config_.nnet3_batch_frames_per_chunk,
+                                                        config_.nnet3_batch_max_wait_ms);
+    } catch (std::runtime_error& e) {
+      KALDI_WARN << "Cannot start batched computation, decoding without it: " << e.what();
+    }
+  }
+
+  if (stream->batch_service != NULL) {
+    stream->batched_decodable = new DecodableNnetBatchedOnline(
+        trans_model, stream->batch_service,
+        stream->feature_pipeline->InputFeature(),
+        stream->feature_pipeline->IvectorFeature());
+    stream->lattice_decoder = new LatticeFasterOnlineDecoder(*(segment_models_->decode_fst()),
+                                                             config_.decoder_opts);
+  } else if (config_.nnet3_batch_size <= 0 && config_.use_threaded_decoder) {
+    stream->nnet_decodable = new DecodableNnetLoopedRows(
+        *(segment_models_->acoustic_model()->decodable_info_nnet3),
+        stream->feature_pipeline->InputFeature(),
+        stream->feature_pipeline->IvectorFeature());
+    stream->lattice_decoder = new LatticeFasterOnlineDecoder(*(segment_models_->decode_fst()),
+                                                             config_.decoder_opts);
+    Nnet3Pipeline *pipeline = new Nnet3Pipeline();
+    pipeline->decoder = this;
+    pipeline->feature_pipeline = stream->feature_pipeline;
+    pipeline->decodable = stream->nnet_decodable;
+    pipeline->num_queued_frames = 0;
+    pipeline->stop = false;
+    g_mutex_init(&pipeline->feature_lock);
+    g_mutex_init(&pipeline->lock);
+    g_cond_init(&pipeline->cond);
+    stream->pipeline = pipeline;
+    stream->compute_thread = g_thread_new("kaldi-nnet3-compute",
+                                          StreamDecoder::Nnet3ComputeThread,
+                                          pipeline);
+  } else {
+    stream->decoder = new SingleUtteranceNnet3Decoder(config_.decoder_opts,
+                                                      trans_model,
+                                                      *(segment_models_->acoustic_model()->decodable_info_nnet3),
+                                                      *(segment_models_->decode_fst()),
+                                                      stream->feature_pipeline);
+  }
+  nnet3_stream_ = stream;
+}
+
+// Stops decoding the stream at the end of a segment. Audio that the compute
+// thread of the pipelined mode has read but that has not been decoded yet
+// is kept in replay_audio_, to be decoded when the stream is restarted.
+void StreamDecoder::EndNnet3Stream() {
+  Nnet3Stream *stream = nnet3_stream_;
+  if (stream->pipeline != NULL) {
+    Nnet3Pipeline *pipeline = stream->pipeline;
+    g_mutex_lock(&pipeline->lock);
+    pipeline->stop = true;
+    g_cond_broadcast(&pipeline->cond);
+    g_mutex_unlock(&pipeline->lock);
+    // With a live source, the compute thread may be waiting for audio that
+    // is yet to come; what it has read is kept for the next stream
+    audio_source_->Interrupt();
+    g_thread_join(stream->compute_thread);
+
+    std::deque<Vector<BaseFloat>*> replay_audio;
+    for (size_t i = 0; i < pipeline->chunks.size(); i++) {
+      Nnet3PipelineChunk *chunk = pipeline->chunks[i];
+      replay_audio.push_back(new Vector<BaseFloat>(chunk->wave));
+      replay_audio_ended_ = replay_audio_ended_ || chunk->last;
+      delete chunk;
+    }
+    // Whatever was left of earlier replayed audio comes after it
+    replay_audio.insert(replay_audio.end(), replay_audio_.begin(), replay_audio_.end());
+    replay_audio_.swap(replay_audio);
+
+    g_mutex_clear(&pipeline->feature_lock);
+    g_mutex_clear(&pipeline->lock);
+    g_cond_clear(&pipeline->cond);
+    delete pipeline;
+  }
+  delete stream->decoder;
+  delete stream->lattice_decoder;
+  delete stream->batched_decodable;
+  delete stream->nnet_decodable;
+  if (stream->batch_service != NULL) {
+    NnetBatchService::Release(stream->batch_service);
+  }
+  delete stream->traceback;
+  delete stream->feature_pipeline;
+  stream->models->Unref();
+  delete stream;
+  nnet3_stream_ = NULL;
+}
+
+// Reads audio like the audio source, but first returns the audio kept by
+// EndNnet3Stream()
+bool StreamDecoder::ReadAudio(Vector<BaseFloat> *data) {
+  if (replay_audio_.empty()) {
+    return audio_source_->Read(data);
+  }
+  Vector<BaseFloat> *wave_part = replay_audio_.front();
+  replay_audio_.pop_front();
+  data->Resize(wave_part->Dim(), kUndefined);
+  data->CopyFromVec(*wave_part);
+  delete wave_part;
+  if (replay_audio_.empty() && replay_audio_ended_) {
+    replay_audio_ended_ = false;
+    return false;
+  }
+  return true;
+}
+
+// for nnet3, we keep this duplication to allow nnet3 specific changes
+void StreamDecoder::Nnet3UnthreadedDecodeSegment(bool *more_data) {
+  Nnet3Stream *stream = nnet3_stream_;
+  OnlineNnet2FeaturePipeline &feature_pipeline = *(stream->feature_pipeline);
+  SingleUtteranceNnet3Decoder &decoder = *(stream->decoder);
+  IncrementalTraceback &traceback = *(stream->traceback);
+
+  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length_);
+  KALDI_VLOG(2) << "Reading audio in " << wave_part.Dim() << " sample chunks...";
+
+  int32 frame_offset = stream->frame_offset;
+  int32 frame_subsampling_factor = config_.nnet3_decodable_opts.frame_subsampling_factor;
+  BaseFloat frame_shift = feature_info_->FrameShiftInSeconds();
+  segment_start_time_ = stream->start_time
+      + frame_offset * frame_shift * frame_subsampling_factor;
+
+  decoder.InitDecoding(frame_offset);
+  traceback.Reset();
+  OnlineSilenceWeighting silence_weighting(segment_models_->acoustic_model()->trans_model,
+                                           config_.silence_weighting_config,
+                                           frame_subsampling_factor);
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+
+  BaseFloat last_traceback = 0.0;
+  BaseFloat num_seconds_decoded = 0.0;
+  SegmentStats stats;
+
+  while (true) {
+    *more_data = audio_source_->Read(&wave_part);
+
+    StageTimer feature_timer(profiler_, kFeatureStage, &stats.feature_time);
+    feature_pipeline.AcceptWaveform(sample_rate_, wave_part);
+    if (!*more_data) {
+      feature_pipeline.InputFinished();
+    }
+    feature_timer.Stop();
+
+    if (silence_weighting.Active() &&
+        feature_pipeline.IvectorFeature() != NULL) {
+      silence_weighting.ComputeCurrentTraceback(decoder.Decoder());
+      silence_weighting.GetDeltaWeights(feature_pipeline.NumFramesReady(),
+                                        frame_offset * frame_subsampling_factor,
+                                        &delta_weights);
+      feature_pipeline.UpdateFrameWeights(delta_weights);
+    }
+
+    // This includes evaluating the network, which is done on demand
+    StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+    decoder.AdvanceDecoding();
+    search_timer.Stop();
+    stats.total_active_tokens += NumActiveTokens(decoder.Decoder());
+    stats.num_active_token_samples++;
+    num_seconds_decoded += 1.0 * wave_part.Dim() / sample_rate_;
+    total_time_decoded_ += 1.0 * wave_part.Dim() / sample_rate_;
+    if (!*more_data) {
+      break;
+    }
+    if (config_.do_endpointing
+        && (decoder.NumFramesDecoded() > 0)
+        && decoder.EndpointDetected(config_.endpoint_config)) {
+      KALDI_VLOG(2) << "Endpoint detected!";
+      profiler_->Increment(kEndpointsCounter);
+      break;
+    }
+
+    if ((num_seconds_decoded - last_traceback > config_.traceback_period_in_secs)
+        && (decoder.NumFramesDecoded() > 0)) {
+      IncrementalPartialResult(decoder.Decoder(), &traceback);
+      last_traceback += config_.traceback_period_in_secs;
+    }
+  }
+
+  if (num_seconds_decoded > 0.1) {
+    StageTimer lattice_timer(profiler_, kLatticeStage, &stats.lattice_time);
+    decoder.FinalizeDecoding();
+    stream->frame_offset += decoder.NumFramesDecoded();
+    CompactLattice clat;
+    bool end_of_utterance = true;
+    decoder.GetLattice(end_of_utterance, &clat);
+    lattice_timer.Stop();
+    stats.audio_duration = num_seconds_decoded;
+    stats.num_frames = decoder.NumFramesDecoded();
+    int32 num_words = SegmentDone(clat, stats);
+    if (num_words >= config_.min_words_for_ivector) {
+      // Only update adaptation state if the utterance contained enough words
+      feature_pipeline.GetAdaptationState(adaptation_state_);
+      feature_pipeline.GetCmvnState(cmvn_state_);
+    }
+  } else {
+    KALDI_VLOG(2) << "Less than 0.1 seconds decoded, discarding";
+  }
+}
+
+// Like the above, but the acoustic scores are computed by a shared
+// NnetBatchService together with those of other decoders
+void StreamDecoder::Nnet3BatchedDecodeSegment(bool *more_data) {
+  Nnet3Stream *stream = nnet3_stream_;
+  const TransitionModel &trans_model = segment_models_->acoustic_model()->trans_model;
+  OnlineNnet2FeaturePipeline &feature_pipeline = *(stream->feature_pipeline);
+  DecodableNnetBatchedOnline &decodable = *(stream->batched_decodable);
+  LatticeFasterOnlineDecoder &decoder = *(stream->lattice_decoder);
+  IncrementalTraceback &traceback = *(stream->traceback);
+
+  Vector<BaseFloat> wave_part = Vector<BaseFloat>(chunk_length_);
+  KALDI_VLOG(2) << "Reading audio in " << wave_part.Dim() << " sample chunks...";
+
+  int32 frame_offset = stream->frame_offset;
+  int32 frame_subsampling_factor = config_.nnet3_decodable_opts.frame_subsampling_factor;
+  BaseFloat frame_shift = feature_info_->FrameShiftInSeconds();
+  segment_start_time_ = stream->start_time
+      + frame_offset * frame_shift * frame_subsampling_factor;
+
+  decoder.InitDecoding();
+  traceback.Reset();
+  decodable.SetFrameOffset(frame_offset);
+  OnlineSilenceWeighting silence_weighting(trans_model,
+                                           config_.silence_weighting_config,
+                                           frame_subsampling_factor);
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+
+  BaseFloat last_traceback = 0.0;
+  BaseFloat num_seconds_decoded = 0.0;
+  SegmentStats stats;
+
+  while (true) {
+    *more_data = audio_source_->Read(&wave_part);
+
+    StageTimer feature_timer(profiler_, kFeatureStage, &stats.feature_time);
+    feature_pipeline.AcceptWaveform(sample_rate_, wave_part);
+    if (!*more_data) {
+      feature_pipeline.InputFinished();
+    }
+    feature_timer.Stop();
+
+    if (silence_weighting.Active() &&
+        feature_pipeline.IvectorFeature() != NULL) {
+      silence_weighting.ComputeCurrentTraceback(decoder);
+      silence_weighting.GetDeltaWeights(feature_pipeline.NumFramesReady(),
+                                        frame_offset * frame_subsampling_factor,
+                                        &delta_weights);
+      feature_pipeline.UpdateFrameWeights(delta_weights);
+    }
+
+    // Time spent waiting for the batch service counts as network time
+    double compute_time = decodable.ComputeTime();
+    StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+    decoder.AdvanceDecoding(&decodable);
+    double nnet_time = decodable.ComputeTime() - compute_time;
+    search_timer.Exclude(nnet_time);
+    search_timer.Stop();
+    if (nnet_time > 0) {
+      stats.nnet_time += nnet_time;
+      profiler_->Record(kNnetStage, static_cast<gint64>(nnet_time * G_USEC_PER_SEC));
+    }
+    stats.total_active_tokens += NumActiveTokens(decoder);
+    stats.num_active_token_samples++;
+    num_seconds_decoded += 1.0 * wave_part.Dim() / sample_rate_;
+    total_time_decoded_ += 1.0 * wave_part.Dim() / sample_rate_;
+    if (!*more_data) {
+      break;
+    }
+    if (config_.do_endpointing
+        && (decoder.NumFramesDecoded() > 0)
+        && EndpointDetected(config_.endpoint_config, trans_model,
+                            frame_shift * frame_subsampling_factor, decoder)) {
+      KALDI_VLOG(2) << "Endpoint detected!";
+      profiler_->Increment(kEndpointsCounter);
+      break;
+    }
+
+    if ((num_seconds_decoded - last_traceback > config_.traceback_period_in_secs)
+        && (decoder.NumFramesDecoded() > 0)) {
+      IncrementalPartialResult(decoder, &traceback);
+      last_traceback += config_.traceback_period_in_secs;
+    }
+  }
+
+  if (num_seconds_decoded > 0.1) {
+    StageTimer lattice_timer(profiler_, kLatticeStage, &stats.lattice_time);
+    decoder.FinalizeDecoding();
+    stream->frame_offset += decoder.NumFramesDecoded();
+    Lattice raw_lat;
+    decoder.GetRawLattice(&raw_lat, true);
+    CompactLattice clat;
+    DeterminizeLatticePhonePrunedWrapper(trans_model, &raw_lat,
+                                         config_.decoder_opts.lattice_beam,
+                                         &clat, config_.decoder_opts.det_opts);
+    lattice_timer.Stop();
+    stats.audio_duration = num_seconds_decoded;
+    stats.num_frames = decoder.NumFramesDecoded();
+    int32 num_words = SegmentDone(clat, stats);
+    if (num_words >= config_.min_words_for_ivector) {
+      // Only update adaptation state if the utterance contained enough words
+      feature_pipeline.GetAdaptationState(adaptation_state_);
+      feature_pipeline.GetCmvnState(cmvn_state_);
+    }
+  } else {
+    KALDI_VLOG(2) << "Less than 0.1 seconds decoded, discarding";
+  }
+}
+
+gpointer StreamDecoder::Nnet3ComputeThread(gpointer data) {
+  Nnet3Pipeline *pipeline = static_cast<Nnet3Pipeline*>(data);
+  StreamDecoder *decoder = pipeline->decoder;
+  Vector<BaseFloat> wave_part = Vector<BaseFloat>(decoder->chunk_length_);
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+  int32 num_frames_computed = 0;
+  bool more_data = true;
+  bool stop = false;
+
+  while (more_data && !stop) {
+    more_data = decoder->ReadAudio(&wave_part);
+
+    g_mutex_lock(&pipeline->lock);
+    delta_weights.swap(pipeline->delta_weights);
+    g_mutex_unlock(&pipeline->lock);
+
+    Nnet3PipelineChunk *chunk = new Nnet3PipelineChunk();
+    chunk->wave = wave_part;
+    chunk->last = !more_data;
+    chunk->feature_time = 0.0;
+    chunk->nnet_time = 0.0;
+
+    g_mutex_lock(&pipeline->feature_lock);
+    if (!delta_weights.empty()) {
+      pipeline->feature_pipeline->UpdateFrameWeights(delta_weights);
+      delta_weights.clear();
+    }
+    StageTimer feature_timer(decoder->profiler_, kFeatureStage, &chunk->feature_time);
+    pipeline->feature_pipeline->AcceptWaveform(decoder->sample_rate_, wave_part);
+    if (!more_data) {
+      pipeline->feature_pipeline->InputFinished();
+    }
+    feature_timer.Stop();
+    StageTimer nnet_timer(decoder->profiler_, kNnetStage, &chunk->nnet_time);
+    int32 num_frames_ready = pipeline->decodable->NumFramesReady();
+    int32 num_pdfs = pipeline->decodable->NumIndices();
+    chunk->loglikes.Resize(num_frames_ready - num_frames_computed, num_pdfs, kUndefined);
+    pipeline->decodable->GetOutput(num_frames_computed, &chunk->loglikes);
+    chunk->num_feature_frames_ready = pipeline->feature_pipeline->NumFramesReady();
+    g_mutex_unlock(&pipeline->feature_lock);
+    nnet_timer.Stop();
+    num_frames_computed = num_frames_ready;
+
+    g_mutex_lock(&pipeline->lock);
+    while (!pipeline->chunks.empty()
+           && pipeline->num_queued_frames > decoder->max_lag_in_frames_
+           && !pipeline->stop) {
+      g_cond_wait(&pipeline->cond, &pipeline->lock);
+    }
+    pipeline->chunks.push_back(chunk);
+    pipeline->num_queued_frames += chunk->loglikes.NumRows();
+    g_cond_signal(&pipeline->cond);
+    stop = pipeline->stop;
+    g_mutex_unlock(&pipeline->lock);
+  }
+  return NULL;
+}
+
+// Pipelined nnet3 decoding: features and scores are computed in a separate
+// thread, and the search runs here. The scores of each Read() are decoded
+// together, so endpointing and partial results work like in the
+// unthreaded mode.
+void StreamDecoder::Nnet3ThreadedDecodeSegment(bool *more_data) {
+  Nnet3Stream *stream = nnet3_stream_;
+  const TransitionModel &trans_model = segment_models_->acoustic_model()->trans_model;
+  OnlineNnet2FeaturePipeline &feature_pipeline = *(stream->feature_pipeline);
+  LatticeFasterOnlineDecoder &decoder = *(stream->lattice_decoder);
+  IncrementalTraceback &traceback = *(stream->traceback);
+  Nnet3Pipeline &pipeline = *(stream->pipeline);
+
+  KALDI_VLOG(2) << "Reading audio in " << chunk_length_ << " sample chunks...";
+
+  int32 frame_offset = stream->frame_offset;
+  int32 frame_subsampling_factor = config_.nnet3_decodable_opts.frame_subsampling_factor;
+  BaseFloat frame_shift = feature_info_->FrameShiftInSeconds();
+  segment_start_time_ = stream->start_time
+      + frame_offset * frame_shift * frame_subsampling_factor;
+
+  decoder.InitDecoding();
+  traceback.Reset();
+  OnlineSilenceWeighting silence_weighting(trans_model,
+                                           config_.silence_weighting_config,
+                                           frame_subsampling_factor);
+  std::vector<std::pair<int32, BaseFloat> > delta_weights;
+
+  BaseFloat last_traceback = 0.0;
+  BaseFloat num_seconds_decoded = 0.0;
+  SegmentStats stats;
+
+  while (true) {
+    g_mutex_lock(&pipeline.lock);
+    while (pipeline.chunks.empty()) {
+      g_cond_wait(&pipeline.cond, &pipeline.lock);
+    }
+    Nnet3PipelineChunk *chunk = pipeline.chunks.front();
+    pipeline.chunks.pop_front();
+    pipeline.num_queued_frames -= chunk->loglikes.NumRows();
+    g_cond_signal(&pipeline.cond);
+    g_mutex_unlock(&pipeline.lock);
+
+    *more_data = !chunk->last;
+    stats.feature_time += chunk->feature_time;
+    stats.nnet_time += chunk->nnet_time;
+    if (chunk->loglikes.NumRows() > 0) {
+      StageTimer search_timer(profiler_, kSearchStage, &stats.search_time);
+      DecodableMatrixMapped decodable(trans_model, chunk->loglikes,
+                                      decoder.NumFramesDecoded());
+      decoder.AdvanceDecoding(&decodable);
+      search_timer.Stop();
+      stats.total_active_tokens += NumActiveTokens(decoder);
+      stats.num_active_token_samples++;
+    }
+
+    if (silence_weighting.Active() &&
+        feature_pipeline.IvectorFeature() != NULL) {
+      silence_weighting.ComputeCurrentTraceback(decoder);
+      silence_weighting.GetDeltaWeights(chunk->num_feature_frames_ready,
+                                        frame_offset * frame_subsampling_factor,
+                                        &delta_weights);
+      g_mutex_lock(&pipeline.lock);
+      pipeline.delta_weights.insert(pipeline.delta_weights.end(),
+                                    delta_weights.begin(), delta_weights.end());
+      g_mutex_unlock(&pipeline.lock);
+    }
+
+    num_seconds_decoded += 1.0 * chunk->wave.Dim() / sample_rate_;
+    total_time_decoded_ += 1.0 * chunk->wave.Dim() / sample_rate_;
+    delete chunk;
+    if (!*more_data) {
+      break;
+    }
+    if (config_.do_endpointing
+        && (decoder.NumFramesDecoded() > 0)
+        && EndpointDetected(config_.endpoint_config, trans_model,
+                            frame_shift * frame_subsampling_factor, decoder)) {
+      KALDI_VLOG(2) << "Endpoint detected!";
+      profiler_->Increment(kEndpointsCounter);
+      break;
+    }
+
+    if ((num_seconds_decoded - last_traceback > config_.traceback_period_in_secs)
+        && (decoder.NumFramesDecoded() > 0)) {
+      IncrementalPartialResult(decoder, &traceback);
+      last_traceback += config_.traceback_period_in_secs;
+    }
+  }
+
+  if (num_seconds_decoded > 0.1) {
+    StageTimer lattice_timer(profiler_, kLatticeStage, &stats.lattice_time);
+    decoder.FinalizeDecoding();
+    stream->frame_offset += decoder.NumFramesDecoded();
+    Lattice raw_lat;
+    decoder.GetRawLattice(&raw_lat, true);
+    CompactLattice clat;
+    DeterminizeLatticePhonePrunedWrapper(trans_model, &raw_lat,
+                                         config_.decoder_opts.lattice_beam,
+                                         &clat, config_.decoder_opts.det_opts);
+    lattice_timer.Stop();
+    stats.audio_duration = num_seconds_decoded;
+    stats.num_frames = decoder.NumFramesDecoded();
+    int32 num_words = SegmentDone(clat, stats);
+    if (num_words >= config_.min_words_for_ivector) {
+      // Only update adaptation state if the utterance contained enough words
+      g_mutex_lock(&pipeline.feature_lock);
+      feature_pipeline.GetAdaptationState(adaptation_state_);
+      feature_pipeline.GetCmvnState(cmvn_state_);
+      g_mutex_unlock(&pipeline.feature_lock);
+    }
+  } else {
+    KALDI_VLOG(2) << "Less than 0.1 seconds decoded, discarding";
+  }
+}
+
+}  // namespace kaldi
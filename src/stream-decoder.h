@@ -0,0 +1,318 @@
+// stream-decoder.h
+
+// Copyright 2026 gst-kaldi-nnet2-online authors
+
+// See ../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef KALDI_SRC_STREAM_DECODER_H_
+#define KALDI_SRC_STREAM_DECODER_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "./model-registry.h"
+#include "./incremental-traceback.h"
+#include "./json-writer.h"
+#include "./stage-profiler.h"
+
+#include "itf/options-itf.h"
+#include "online2/online-nnet2-decoding-threaded.h"
+#include "online2/online-nnet2-decoding.h"
+#include "online2/online-nnet3-decoding.h"
+#include "online2/online-endpoint.h"
+
+namespace kaldi {
+
+#define NNET2  2
+#define NNET3  3
+
+struct WordInHypothesis {
+  int32 word_id;
+};
+
+struct WordAlignmentInfo {
+  int32 word_id;
+  int32 start_frame;
+  int32 length_in_frames;
+  double confidence;
+};
+
+struct PhoneAlignmentInfo {
+  int32 phone_id;
+  int32 start_frame;
+  int32 length_in_frames;
+  double confidence;
+};
+
+struct NBestResult {
+  int32 num_frames;
+  double likelihood;
+  std::vector<WordInHypothesis> words;
+  std::vector<PhoneAlignmentInfo> phone_alignment;
+  std::vector<WordAlignmentInfo> word_alignment;
+};
+
+// The final result of a segment. Times are in seconds from the start of
+// the stream; alignments are in frames of frame_shift seconds.
+struct SegmentResult {
+  const ModelSet *models;  // the models the segment was decoded with
+  float segment_start;
+  float segment_length;
+  float total_length;  // of the audio decoded so far
+  BaseFloat frame_shift;
+  std::vector<NBestResult> nbest_results;  // best first, never empty
+  std::string transcript;  // of the best hypothesis, never empty
+  // The full result as JSON if the listener wants it, otherwise NULL
+  const char *json;
+};
+
+// Where the time went while decoding a segment. Times are wall times in
+// seconds. Where the network is evaluated on demand by the search, its
+// time is included in search_time.
+struct SegmentStats {
+  SegmentStats()
+      : segment_start(0.0), audio_duration(0.0), feature_time(0.0),
+        nnet_time(0.0), search_time(0.0), lattice_time(0.0),
+        rescore_time(0.0), nbest_time(0.0), json_time(0.0), num_frames(0),
+        num_active_token_samples(0), total_active_tokens(0), end_time(0) { }
+  float segment_start;
+  double audio_duration;
+  double feature_time;
+  double nnet_time;
+  double search_time;
+  double lattice_time;
+  double rescore_time;
+  double nbest_time;
+  double json_time;
+  int32 num_frames;
+  // Tokens on the last frame, sampled after each chunk of audio
+  int32 num_active_token_samples;
+  int64 total_active_tokens;
+  // Monotonic time (in microseconds) when the end of the segment was found
+  gint64 end_time;
+};
+
+// Everything that controls how a stream is decoded, apart from the
+// models and the features. The defaults are those of the GStreamer
+// element, and the options have the names of its properties.
+struct StreamDecoderConfig {
+  int32 nnet_mode;
+  bool use_threaded_decoder;
+  bool do_endpointing;
+  BaseFloat chunk_length_in_secs;
+  BaseFloat traceback_period_in_secs;
+  int32 max_lag_in_frames;
+  int32 max_lag_in_ms;
+  int32 nnet3_batch_size;
+  int32 nnet3_batch_frames_per_chunk;
+  int32 nnet3_batch_max_wait_ms;
+  int32 num_nbest;
+  int32 num_phone_alignment;
+  bool do_phone_alignment;
+  int32 min_words_for_ivector;
+  bool inverse_scale;
+  BaseFloat lmwt_scale;
+  int32 max_pending_results;
+
+  OnlineEndpointConfig endpoint_config;
+  OnlineNnet2DecodingConfig nnet2_decoding_config;
+  OnlineNnet2DecodingThreadedConfig nnet2_decoding_threaded_config;
+  nnet3::NnetSimpleLoopedComputationOptions nnet3_decodable_opts;
+  LatticeFasterDecoderConfig decoder_opts;
+  OnlineSilenceWeightingConfig silence_weighting_config;
+
+  StreamDecoderConfig()
+      : nnet_mode(NNET2), use_threaded_decoder(false), do_endpointing(false),
+        chunk_length_in_secs(0.05), traceback_period_in_secs(0.5),
+        max_lag_in_frames(100), max_lag_in_ms(0), nnet3_batch_size(0),
+        nnet3_batch_frames_per_chunk(50), nnet3_batch_max_wait_ms(10), num_nbest(1), num_phone_alignment(1),
+        do_phone_alignment(false), min_words_for_ivector(2),
+        inverse_scale(false), lmwt_scale(1.0), max_pending_results(0) { }
+
+  // The nnet2 decoder configs, whose options overlap with the nnet3 ones,
+  // are registered with the prefixes "nnet2" and "nnet2-threaded"
+  void Register(OptionsItf *opts);
+};
+
+// Where a StreamDecoder gets its audio from
+class StreamAudioSource {
+ public:
+  // Fills 'data' with samples at the sample rate of the features, waiting
+  // for them if needed. At the end of the stream, resizes 'data' to the
+  // samples that were left and returns false.
+  virtual bool Read(Vector<BaseFloat> *data) = 0;
+
+  // Makes a Read() that is waiting for audio (or the next one, if none is)
+  // return the samples it has so far, possibly none, without ending the
+  // stream. May be called from any thread. Sources that never wait need
+  // not implement it.
+  virtual void Interrupt() { }
+
+  virtual ~StreamAudioSource() { }
+};
+
+// Receives the results of a StreamDecoder. Partial results come from the
+// thread that calls Decode(), final results and segment statistics from
+// the one that produces them, which is a background thread if
+// max_pending_results is set. In that case, partial results that follow a
+// final result still being produced come from the background thread too,
+// after it. All results always come in order.
+class StreamDecoderListener {
+ public:
+  // Returns a reference to the models to decode the next segment with,
+  // which the decoder drops when it is done with them
+  virtual ModelSet *AcquireModels() = 0;
+
+  virtual void PartialResult(const std::string &transcript) { }
+
+  // Whether to compute the changes of the partial results, which are
+  // passed as JSON to PartialResultDelta(). Only decoders whose best path
+  // we trace back ourselves produce them.
+  virtual bool WantsPartialResultDelta() { return false; }
+  virtual void PartialResultDelta(const std::string &json) { }
+
+  // Whether to write the full final results as JSON
+  virtual bool WantsResultJson() { return false; }
+  virtual void FinalResult(const SegmentResult &result) { }
+
+  // Called after the results of every segment, even if it had none
+  virtual void SegmentDone(const SegmentStats &stats) { }
+
+  virtual ~StreamDecoderListener() { }
+};
+
+// Decodes audio streams in any of the modes of the GStreamer element,
+// without depending on GStreamer: the audio comes from a
+// StreamAudioSource, the models from the listener, and the results go to
+// the listener. The audio is split into segments at endpoints; each
+// segment is decoded with the models that are current when it starts.
+//
+// A decoder decodes one stream at a time, but can be reused for any
+// number of them.
+class StreamDecoder {
+ public:
+  // Records the durations of the stages of decoding in 'profiler', which
+  // must outlive the decoder
+  StreamDecoder(StreamDecoderListener *listener, StageProfiler *profiler);
+  ~StreamDecoder();
+
+  // Decodes a stream until the end of its audio and returns when all its
+  // results have been produced. 'adaptation_state' and 'cmvn_state' are
+  // used at the start and updated after every segment with enough words.
+  void Decode(const StreamDecoderConfig &config,
+              const OnlineNnet2FeaturePipelineInfo &feature_info,
+              StreamAudioSource *audio_source,
+              OnlineIvectorExtractorAdaptationState *adaptation_state,
+              OnlineCmvnState *cmvn_state);
+
+  // Sample rate of the audio the features expect
+  static int32 SampleRate(const OnlineNnet2FeaturePipelineInfo &feature_info);
+
+ private:
+  struct Finalization;
+  struct Nnet3Pipeline;
+  struct Nnet3PipelineChunk;
+  struct Nnet3Stream;
+
+  void ThreadedDecodeSegment(bool *more_data,
+                             Vector<BaseFloat> *remaining_wave_part);
+  void UnthreadedDecodeSegment(bool *more_data);
+  void StartNnet3Stream();
+  void EndNnet3Stream();
+  bool ReadAudio(Vector<BaseFloat> *data);
+  void Nnet3UnthreadedDecodeSegment(bool *more_data);
+  void Nnet3BatchedDecodeSegment(bool *more_data);
+  void Nnet3ThreadedDecodeSegment(bool *more_data);
+  static gpointer Nnet3ComputeThread(gpointer data);
+  void WaitForDecoder(SingleUtteranceNnet2DecoderThreaded *decoder);
+
+  void PartialResult(const Lattice &lat);
+  void EmitPartialResult(const std::string &transcript,
+                         const std::string &delta_json);
+  void PassPartialResult(const std::string &transcript,
+                         const std::string &delta_json);
+  void IncrementalPartialResult(const LatticeFasterOnlineDecoder &decoder,
+                                IncrementalTraceback *traceback);
+  void PartialResultDeltaToJson(const IncrementalTraceback &traceback,
+                                size_t offset);
+
+  // Produces the results of a segment from its lattice, right away or in
+  // the background. Returns the number of words of the best hypothesis.
+  int32 SegmentDone(const CompactLattice &clat, const SegmentStats &stats);
+  static void RunFinalization(gpointer data, gpointer user_data);
+  void FinalizeSegment(Finalization *segment, int32 *num_words);
+  void FinalResult(Finalization *segment, int32 *num_words);
+  void WaitForResults();
+
+  void ScaleLattice(CompactLattice *clat) const;
+  int32 NumBestPathWords(const CompactLattice &clat) const;
+  BaseFloat FrameShift() const;
+  std::string WordsToString(const ModelSet *models,
+                            const std::vector<int32> &words) const;
+  std::vector<NBestResult> NBestResults(const ModelSet *models,
+                                        CompactLattice *clat) const;
+  bool RescoreBigLm(const ModelSet *models, const CompactLattice &clat,
+                    CompactLattice *result_lat) const;
+  void FullFinalResultToJson(const SegmentResult &result);
+
+  StreamDecoderListener *listener_;
+  StageProfiler *profiler_;
+
+  // The stream being decoded, only valid during Decode()
+  StreamDecoderConfig config_;
+  const OnlineNnet2FeaturePipelineInfo *feature_info_;
+  StreamAudioSource *audio_source_;
+  OnlineIvectorExtractorAdaptationState *adaptation_state_;
+  OnlineCmvnState *cmvn_state_;
+  int32 sample_rate_;
+  int32 chunk_length_;
+  // max-lag-in-frames, or max-lag-in-ms converted to frames
+  int32 max_lag_in_frames_;
+  // The models of the segment being decoded
+  ModelSet *segment_models_;
+  float segment_start_time_;
+  float total_time_decoded_;
+  // The state of nnet3 decoding between segments, rebuilt when the models
+  // change, and the audio to decode again after that
+  Nnet3Stream *nnet3_stream_;
+  std::deque<Vector<BaseFloat>*> replay_audio_;
+  bool replay_audio_ended_;  // whether replay_audio_ ends the stream
+
+  // Producing the results of segments in the background, and passing on
+  // the partial results that wait for them; finalize_lock_ protects the
+  // counts
+  GThreadPool *finalize_pool_;
+  GMutex finalize_lock_;
+  GCond finalize_cond_;
+  int32 num_pending_finalizations_;
+  int32 num_pending_partial_results_;
+
+  // Reused buffers for the JSON results: result_json_ is only used by the
+  // thread that produces the final results, partial_result_json_ by the
+  // one that calls Decode()
+  JsonWriter result_json_;
+  JsonWriter partial_result_json_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(StreamDecoder);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_SRC_STREAM_DECODER_H_